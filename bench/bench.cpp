@@ -19,10 +19,46 @@ DEFINE_uint64(max_key, 10 * 1000, "The max key");
 DEFINE_uint64(max_value_size, 4 * 1024, "The max value size");
 DEFINE_uint64(thread_nr, 8, "The number of threads");
 DEFINE_uint32(read_ratio, 80, "[0-100] the percentage of read");
+DEFINE_uint32(visit_ratio, 0, "[0-100] the percentage of the reads that visit a range");
+DEFINE_double(visit_range, 0.01, "(0, 1) the share of the keys a visit covers");
+DEFINE_string(visit_mode,
+              "values",
+              "values|keys|lazy: visit() reading every value, visit_keys() "
+              "reading none, or visit_lazy() reading one in "
+              "--lazy_fetch_every");
+DEFINE_uint64(lazy_fetch_every, 10, "--visit_mode=lazy: read the value of one key in this many");
+DEFINE_uint64(multi_get_batch,
+              0,
+              "Time reads of this many keys at a time with multi_get() instead "
+              "of the mixed workload, 0 for off");
+DEFINE_bool(multi_get_as_gets,
+            false,
+            "--multi_get_batch: read each batch with get()s instead, to compare");
+DEFINE_bool(multi_get_prefetch,
+            false,
+            "--multi_get_batch: have multi_get() prefetch the pages of a "
+            "batch, see EngineOptions::multi_get_prefetch");
+DEFINE_bool(warmup,
+            true,
+            "Put every key first, else go on with the store in kvdir (cold "
+            "after dropping the page cache)");
 DEFINE_bool(is_skew, true, "Whether uniform or zipfian distribution");
 DEFINE_double(zip_para, 0.99, "The zipfian distribution parameter");
 DEFINE_uint64(rand_seed, 2022, "The seed to run");
 DEFINE_uint64(sync_every, 10, "How many operations between each sync op");
+DEFINE_string(durability,
+              "buffered",
+              "sync|interval|buffered: fsync every write, fsync from a "
+              "background flusher, or only on sync()");
+DEFINE_uint64(sync_interval_ms, 100, "--durability=interval: fsync period");
+DEFINE_uint64(sync_interval_bytes,
+              4 * 1024 * 1024,
+              "--durability=interval: fsync after this many bytes");
+DEFINE_uint64(segment_size,
+              64 * 1024 * 1024,
+              "Seal the active log segment once it grows past this");
+DEFINE_uint64(value_cache_mb, 0, "The budget of the value cache, 0 to disable");
+DEFINE_bool(verify_checksums, false, "Check the crc of every record read");
 DEFINE_int64(
     execute_batch,
     100,
@@ -37,12 +73,62 @@ void explain()
               << ", max_value_size: " << FLAGS_max_value_size
               << ", thread_nr: " << FLAGS_thread_nr
               << ", read_ratio[0-100]: " << FLAGS_read_ratio
+              << ", visit_ratio[0-100]: " << FLAGS_visit_ratio
+              << ", visit_range: " << FLAGS_visit_range
+              << ", visit_mode: " << FLAGS_visit_mode
+              << ", multi_get_batch: " << FLAGS_multi_get_batch
+              << ", multi_get_as_gets: " << FLAGS_multi_get_as_gets
+              << ", multi_get_prefetch: " << FLAGS_multi_get_prefetch
               << ", is_skew: " << FLAGS_is_skew
               << ", zip_para: " << FLAGS_zip_para
               << ", sync_every: " << FLAGS_sync_every
+              << ", durability: " << FLAGS_durability
+              << ", verify_checksums: " << FLAGS_verify_checksums
+              << ", value_cache_mb: " << FLAGS_value_cache_mb
               << ", overwrite_ratio: " << FLAGS_overwrite_ratio;
 }
 
+EngineOptions engine_options()
+{
+    EngineOptions options;
+    if (FLAGS_durability == "sync")
+    {
+        options.durability = Durability::kSyncEveryWrite;
+    }
+    else if (FLAGS_durability == "interval")
+    {
+        options.durability = Durability::kSyncInterval;
+    }
+    else
+    {
+        CHECK_EQ(FLAGS_durability, "buffered")
+            << "--durability should be one of sync|interval|buffered";
+        options.durability = Durability::kOsBuffered;
+    }
+    options.sync_interval_ms = FLAGS_sync_interval_ms;
+    options.sync_interval_bytes = FLAGS_sync_interval_bytes;
+    options.segment_size = FLAGS_segment_size;
+    options.value_cache_bytes = FLAGS_value_cache_mb * 1024 * 1024;
+    options.verify_checksums = FLAGS_verify_checksums;
+    options.multi_get_prefetch = FLAGS_multi_get_prefetch;
+    return options;
+}
+
+VisitMode visit_mode()
+{
+    if (FLAGS_visit_mode == "keys")
+    {
+        return VisitMode::kKeys;
+    }
+    if (FLAGS_visit_mode == "lazy")
+    {
+        return VisitMode::kLazy;
+    }
+    CHECK_EQ(FLAGS_visit_mode, "values")
+        << "--visit_mode should be one of values|keys|lazy";
+    return VisitMode::kValues;
+}
+
 IEngine::Key to_key(uint64_t k)
 {
     return IEngine::Key((char *) &k, sizeof(uint64_t));
@@ -70,6 +156,13 @@ void bench_kv(IEngine::Pointer engine)
     std::vector<std::shared_ptr<bench::IRandAllocator>> allocators;
     std::vector<std::vector<bench::TestCase>> test_cases;
 
+    // the visits start out over the keys of the warmup
+    std::vector<Key> warmup_keys;
+    for (size_t k = 0; FLAGS_visit_ratio > 0 && k < FLAGS_max_key; ++k)
+    {
+        warmup_keys.push_back(to_key(k));
+    }
+
     for (size_t i = 0; i < FLAGS_thread_nr; ++i)
     {
         if (FLAGS_is_skew)
@@ -86,27 +179,35 @@ void bench_kv(IEngine::Pointer engine)
                 << "When --is_skew=false, we ignore --zip_para";
         }
         double read_ratio = 1.0 * FLAGS_read_ratio / 100;
+        double visit_ratio = read_ratio * FLAGS_visit_ratio / 100;
         double ins_ratio = (1 - read_ratio) / 2;
         double del_ratio = ins_ratio;
-        bench::BenchGenerator g({{Op::kGet,
-                                  read_ratio,
-                                  sizeof(uint64_t),
-                                  FLAGS_max_value_size,
-                                  FLAGS_overwrite_ratio,
-                                  0},
-                                 {Op::kPut,
-                                  ins_ratio,
-                                  sizeof(uint64_t),
-                                  FLAGS_max_value_size,
-                                  FLAGS_overwrite_ratio,
-                                  0},
-                                 {Op::kDelete,
-                                  del_ratio,
-                                  sizeof(uint64_t),
-                                  FLAGS_max_value_size,
-                                  FLAGS_overwrite_ratio,
-                                  0}},
-                                allocators.back());
+        std::vector<bench::OpConfig> op_confs{{Op::kGet,
+                                               read_ratio - visit_ratio,
+                                               sizeof(uint64_t),
+                                               FLAGS_max_value_size,
+                                               FLAGS_overwrite_ratio,
+                                               0},
+                                              {Op::kPut,
+                                               ins_ratio,
+                                               sizeof(uint64_t),
+                                               FLAGS_max_value_size,
+                                               FLAGS_overwrite_ratio,
+                                               0},
+                                              {Op::kDelete,
+                                               del_ratio,
+                                               sizeof(uint64_t),
+                                               FLAGS_max_value_size,
+                                               FLAGS_overwrite_ratio,
+                                               0}};
+        if (visit_ratio > 0)
+        {
+            // not at a rate of 0: it would take the place of the last op
+            op_confs.push_back(
+                {Op::kVisit, visit_ratio, 0, 0, 0, FLAGS_visit_range});
+        }
+        bench::BenchGenerator g(op_confs, allocators.back());
+        g.add_inserted_keys(warmup_keys);
         test_cases.emplace_back(g.rand_tests(FLAGS_test_nr, FLAGS_sync_every));
     }
 
@@ -118,6 +219,7 @@ void bench_kv(IEngine::Pointer engine)
             [&task_nr, &test_case = test_cases[i], engine]()
             {
                 EngineValidator executor(engine);
+                executor.set_visit_mode(visit_mode(), FLAGS_lazy_fetch_every);
 
                 auto remain_task_nr = task_nr.load(std::memory_order_relaxed);
                 size_t cur_idx = 0;
@@ -154,6 +256,83 @@ void bench_kv(IEngine::Pointer engine)
               << ", avg_lat: " << avg_lat << " ns";
 }
 
+std::shared_ptr<bench::IRandAllocator> key_allocator()
+{
+    if (FLAGS_is_skew)
+    {
+        return std::make_shared<bench::ZipfianAllocator>(
+            FLAGS_rand_seed, FLAGS_max_key, FLAGS_zip_para);
+    }
+    return std::make_shared<bench::UniformAllocator>(FLAGS_max_key);
+}
+
+// FLAGS_test_nr keys read FLAGS_multi_get_batch at a time
+void bench_multi_get(IEngine::Pointer engine)
+{
+    LOG(INFO) << "bench_multi_get";
+    auto e = std::dynamic_pointer_cast<Engine>(engine);
+    size_t batch_nr = FLAGS_test_nr / FLAGS_multi_get_batch;
+
+    std::vector<std::vector<std::vector<Key>>> batches(FLAGS_thread_nr);
+    for (size_t t = 0; t < FLAGS_thread_nr; ++t)
+    {
+        auto allocator = key_allocator();
+        for (size_t b = t; b < batch_nr; b += FLAGS_thread_nr)
+        {
+            batches[t].emplace_back();
+            for (size_t i = 0; i < FLAGS_multi_get_batch; ++i)
+            {
+                batches[t].back().push_back(
+                    allocator->alloc_key(sizeof(uint64_t)));
+            }
+        }
+    }
+
+    LOG(INFO) << "Start benchmarking...";
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < FLAGS_thread_nr; ++t)
+    {
+        threads.emplace_back(
+            [&e, &batches = batches[t]]()
+            {
+                std::vector<Value> values;
+                std::vector<RetCode> statuses;
+                for (const auto &keys : batches)
+                {
+                    if (!FLAGS_multi_get_as_gets)
+                    {
+                        CHECK_EQ(e->multi_get(keys, values, statuses), kSucc);
+                        continue;
+                    }
+                    values.resize(keys.size());
+                    for (size_t i = 0; i < keys.size(); ++i)
+                    {
+                        auto ret = e->get(keys[i], values[i]);
+                        CHECK(ret == kSucc || ret == kNotFound);
+                    }
+                }
+            });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count();
+    size_t keys = batch_nr * FLAGS_multi_get_batch;
+    LOG(INFO) << "[summary] " << keys << " keys in batches of "
+              << FLAGS_multi_get_batch << " with "
+              << (FLAGS_multi_get_as_gets ? "get()" : "multi_get()") << ", "
+              << FLAGS_thread_nr << " threads, take " << ns << " ns";
+    LOG(INFO) << "[summary] keys/s: " << 1e9 * keys / ns
+              << ", batches/s: " << 1e9 * batch_nr / ns
+              << ", avg batch lat: " << 1.0 * ns * FLAGS_thread_nr / batch_nr
+              << " ns";
+}
+
 int main(int argc, char *argv[])
 {
     google::InitGoogleLogging(argv[0]);
@@ -163,6 +342,10 @@ int main(int argc, char *argv[])
 
     CHECK_GE(FLAGS_read_ratio, 0);
     CHECK_LE(FLAGS_read_ratio, 100);
+    CHECK_LE(FLAGS_visit_ratio, 100);
+    CHECK_GT(FLAGS_visit_range, 0.0);
+    CHECK_LT(FLAGS_visit_range, 1.0);
+    CHECK_GE(FLAGS_lazy_fetch_every, 1);
     CHECK_NE(FLAGS_kvdir, "");
     CHECK_GE(FLAGS_zip_para, 0.0);
     CHECK_LE(FLAGS_zip_para, 2.0) << "Never know this can be >= 2";
@@ -173,11 +356,32 @@ int main(int argc, char *argv[])
 
     LOG(INFO) << "constructing Engine...";
 
-    auto e = Engine::new_instance(FLAGS_kvdir, EngineOptions{});
+    auto e = Engine::new_instance(FLAGS_kvdir, engine_options());
+
+    if (FLAGS_warmup)
+    {
+        warmup(e);
+    }
 
-    warmup(e);
+    if (FLAGS_multi_get_batch > 0)
+    {
+        bench_multi_get(e);
+    }
+    else
+    {
+        bench_kv(e);
+    }
 
-    bench_kv(e);
+    if (FLAGS_value_cache_mb > 0)
+    {
+        auto stats = std::dynamic_pointer_cast<Engine>(e)->cache_stats();
+        LOG(INFO) << "[summary] cache hit rate: " << stats.hit_rate()
+                  << ", hits: " << stats.hits << ", misses: " << stats.misses
+                  << ", admitted: " << stats.admitted
+                  << ", rejected: " << stats.rejected
+                  << ", entries: " << stats.entries
+                  << ", bytes: " << stats.bytes;
+    }
 
     return 0;
 }
\ No newline at end of file
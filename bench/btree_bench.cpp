@@ -0,0 +1,187 @@
+#include <malloc.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "btree.h"
+#include "glog/logging.h"
+#include "key_prefix.h"
+#include "util/utils.h"
+
+using namespace kvs;
+
+/*
+ * Single-threaded insert and lookup cost of the index, for a few
+ * fan-outs, against the fan-out 5 the tree used to be hard-wired to, and
+ * the memory it takes per key.
+ * Then the search within a single node alone: over the key prefixes
+ * with each implementation, and over the keys themselves.
+ */
+DEFINE_string(key_nrs, "1000000,10000000", "Comma separated sizes of the trees to build");
+DEFINE_uint64(lookup_nr, 2000000, "The number of random lookups in each tree");
+DEFINE_uint64(node_nr, 100000, "The number of nodes to search in, each full");
+DEFINE_bool(huge_pages, false, "Map the nodes and keys of the trees on huge pages");
+
+std::string to_key(uint64_t k)
+{
+    return std::string((char *) &k, sizeof(uint64_t));
+}
+
+// a fixed permutation of the key space, so inserts hit random leaves
+uint64_t scramble(uint64_t i)
+{
+    return i * 0x9e3779b97f4a7c15ull;
+}
+
+// resident bytes of the process, with what was freed given back first
+size_t resident_bytes()
+{
+    EpochManager::global().reclaim();
+    malloc_trim(0);
+    size_t pages = 0, resident = 0;
+    std::ifstream("/proc/self/statm") >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+template <size_t Fanout>
+void bench_tree(size_t key_nr)
+{
+    std::vector<std::string> keys;
+    keys.reserve(key_nr);
+    for (size_t i = 0; i < key_nr; ++i)
+    {
+        keys.emplace_back(to_key(scramble(i)));
+    }
+
+    size_t resident = resident_bytes();
+    auto tree = std::make_unique<BTree<Fanout>>(FLAGS_huge_pages);
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < key_nr; ++i)
+    {
+        tree->insert(keys[i], i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto insert_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count();
+    resident = resident_bytes() - resident;
+
+    size_t found = 0;
+    now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < FLAGS_lookup_nr; ++i)
+    {
+        size_t k = bench::fast_pseudo_rand_int(key_nr - 1);
+        found += tree->search(keys[k]) == k;
+    }
+    end = std::chrono::steady_clock::now();
+    auto lookup_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count();
+    CHECK_EQ(found, FLAGS_lookup_nr);
+
+    LOG(INFO) << "[summary] fan-out: " << Fanout << ", keys: " << key_nr
+              << ", insert ns/op: " << 1.0 * insert_ns / key_nr
+              << ", lookup ns/op: " << 1.0 * lookup_ns / FLAGS_lookup_nr
+              << ", resident bytes/key: " << 1.0 * resident / key_nr
+              << ", mapped bytes/key: " << 1.0 * tree->memory_usage() / key_nr;
+}
+
+using CountFn = void (*)(const int64_t *, size_t, int64_t, size_t &, size_t &);
+
+template <size_t Fanout>
+void bench_node_search()
+{
+    constexpr size_t kKeys = Fanout - 1;
+    // node i holds the keys [i * kKeys, (i + 1) * kKeys) of a sorted set,
+    // each key a string of its own like in the tree
+    std::vector<uint64_t> ids(FLAGS_node_nr * kKeys);
+    for (auto &id : ids)
+    {
+        id = bench::fast_pseudo_rand_int();
+    }
+    std::sort(ids.begin(), ids.end());
+    std::vector<std::unique_ptr<std::string>> owner;
+    std::vector<const std::string *> keys;
+    std::vector<int64_t> prefixes;
+    for (uint64_t id : ids)
+    {
+        uint64_t be = __builtin_bswap64(id);  // memcmp order is id order
+        owner.emplace_back(new std::string(to_key(be)));
+        keys.push_back(owner.back().get());
+        prefixes.push_back(key_prefix(*owner.back()));
+    }
+
+    std::vector<std::pair<size_t, std::string>> probes;  // node, key
+    for (size_t i = 0; i < FLAGS_lookup_nr; ++i)
+    {
+        size_t k = bench::fast_pseudo_rand_int(ids.size() - 1);
+        probes.emplace_back(k / kKeys, *keys[k]);
+    }
+
+    auto report = [&](const char *name, size_t sum, std::chrono::steady_clock::time_point start) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+        LOG(INFO) << "[summary] node search, fan-out: " << Fanout << ", " << name
+                  << ", ns/search: " << 1.0 * ns / probes.size() << " (sum " << sum << ")";
+    };
+
+    size_t sum = 0;
+    auto now = std::chrono::steady_clock::now();
+    for (auto &probe : probes)
+    {
+        const std::string *const *node = keys.data() + probe.first * kKeys;
+        sum += std::upper_bound(node, node + kKeys, &probe.second,
+                                [](const std::string *a, const std::string *b) { return *a < *b; }) - node;
+    }
+    report("keys", sum, now);
+
+    std::vector<std::pair<const char *, CountFn>> fns = {{"prefixes portable", prefix::count_portable}};
+    if (prefix::has_sse42())
+    {
+        fns.emplace_back("prefixes sse4.2", prefix::count_sse42);
+    }
+    if (prefix::has_avx2())
+    {
+        fns.emplace_back("prefixes avx2", prefix::count_avx2);
+    }
+    for (auto &fn : fns)
+    {
+        sum = 0;
+        now = std::chrono::steady_clock::now();
+        for (auto &probe : probes)
+        {
+            size_t less, less_equal;
+            fn.second(prefixes.data() + probe.first * kKeys, kKeys, key_prefix(probe.second), less, less_equal);
+            sum += less_equal;
+        }
+        report(fn.first, sum, now);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::stringstream ss(FLAGS_key_nrs);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        size_t key_nr = std::stoull(item);
+        bench_tree<5>(key_nr);
+        bench_tree<16>(key_nr);
+        bench_tree<32>(key_nr);
+        bench_tree<64>(key_nr);
+        bench_tree<128>(key_nr);
+        bench_tree<256>(key_nr);
+    }
+
+    bench_node_search<16>();
+    bench_node_search<64>();
+    bench_node_search<256>();
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include <chrono>
+#include <iostream>
+
+#include "crc32c.h"
+#include "glog/logging.h"
+#include "util/utils.h"
+
+using namespace kvs;
+
+DEFINE_uint64(total_bytes,
+              1024ull * 1024 * 1024,
+              "How many bytes to checksum for each (implementation, size)");
+
+using ExtendFn = uint32_t (*)(uint32_t, const char *, size_t);
+
+void bench_crc(const char *name, ExtendFn fn, const std::string &data, size_t size)
+{
+    size_t rounds = std::max<size_t>(1, FLAGS_total_bytes / size);
+    size_t slots = data.size() / size;
+    uint32_t crc = 0;
+
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i)
+    {
+        crc ^= fn(crc, data.data() + (i % slots) * size, size);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count();
+    double gbps = 1.0 * rounds * size / ns;
+    LOG(INFO) << "[summary] " << name << ", size: " << size
+              << ", GB/s: " << gbps << ", ns/record: " << 1.0 * ns / rounds
+              << " (crc " << crc << ")";
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    LOG(INFO) << "sse4.2: " << crc32c::has_sse42()
+              << ", pclmul: " << crc32c::has_pclmul();
+
+    // larger than the L2, so the big sizes also pay for the memory
+    auto data = bench::gen_rand_value(8 * 1024 * 1024);
+
+    for (size_t size : {16, 64, 256, 1024, 4096, 16384, 1024 * 1024})
+    {
+        bench_crc("portable", crc32c::extend_portable, data, size);
+        if (crc32c::has_sse42())
+        {
+            bench_crc("sse4.2", crc32c::extend_sse42, data, size);
+        }
+        if (crc32c::has_pclmul())
+        {
+            bench_crc("sse4.2+pclmul", crc32c::extend_sse42_pclmul, data, size);
+        }
+    }
+
+    return 0;
+}
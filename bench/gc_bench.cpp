@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+#include "conf.h"
+#include "engine.h"
+#include "glog/logging.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+/*
+ * Fills the log with live records and garbage, then times puts from a
+ * writer thread while a gc compacts it, next to the same puts without a
+ * gc: the latency percentiles show how much the gc stalls the writers,
+ * the time of the second phase is the time of the gc.
+ */
+DEFINE_string(kvdir, kDefaultBenchDir, "The KV Store data directory");
+DEFINE_uint64(key_nr, 1000000, "The number of distinct keys");
+DEFINE_uint64(overwrite_nr, 2000000, "How many overwrites to load after the keys, the garbage");
+DEFINE_uint64(value_size, 256, "The value size");
+DEFINE_uint64(baseline_nr, 200000, "How many puts to time without a gc");
+DEFINE_bool(puts_during_gc, true, "Time puts during the gc, else the gc alone");
+DEFINE_bool(load, true, "Load the data, else go on with the store in kvdir (cold, after dropping the page cache)");
+DEFINE_bool(cluster_keys, true, "Have the gc write the live records in key order");
+DEFINE_bool(visit, false, "Time a visit over all the keys instead, no puts and no gc");
+DEFINE_uint64(visit_threads, 0, "--visit: with parallel_visit() in key order on this many threads, 0 for visit()");
+
+IEngine::Key to_key(uint64_t k)
+{
+    k *= 0x9e3779b97f4a7c15ull;  // keys in random order
+    return IEngine::Key((char *) &k, sizeof(uint64_t));
+}
+
+void report(const char *name, std::vector<uint64_t> &ns, uint64_t elapsed_ns)
+{
+    CHECK(!ns.empty());
+    std::sort(ns.begin(), ns.end());
+    auto at = [&ns](double q) { return ns[std::min(ns.size() - 1, (size_t)(q * ns.size()))] / 1000.0; };
+    LOG(INFO) << "[summary] " << name << ": " << ns.size() << " puts in " << elapsed_ns / 1000000
+              << " ms, latency us p50: " << at(0.5) << ", p99: " << at(0.99) << ", p99.9: " << at(0.999)
+              << ", max: " << ns.back() / 1000.0;
+}
+
+// puts from this thread until done, the latency of each in ns
+std::vector<uint64_t> timed_puts(Engine &engine, const std::function<bool(size_t)> &done)
+{
+    std::vector<uint64_t> ns;
+    std::string value = gen_rand_value(FLAGS_value_size);
+    for (size_t i = 0; !done(i); ++i)
+    {
+        auto now = std::chrono::steady_clock::now();
+        CHECK_EQ(engine.put(to_key(fast_pseudo_rand_int(FLAGS_key_nr - 1)), value), kSucc);
+        auto end = std::chrono::steady_clock::now();
+        ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count());
+    }
+    return ns;
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    CHECK_NE(FLAGS_kvdir, "");
+    LOG(INFO) << "[explain] key_nr: " << FLAGS_key_nr << ", overwrite_nr: " << FLAGS_overwrite_nr
+              << ", value_size: " << FLAGS_value_size;
+
+    EngineOptions options;
+    options.gc_space_amplification = 0;  // the one gc timed only
+    options.gc_cluster_keys = FLAGS_cluster_keys;
+    auto engine = std::make_shared<Engine>(FLAGS_kvdir, options);
+    std::string value = gen_rand_value(FLAGS_value_size);
+    for (size_t i = 0; FLAGS_load && i < FLAGS_key_nr + FLAGS_overwrite_nr; ++i)
+    {
+        uint64_t k = i < FLAGS_key_nr ? i : fast_pseudo_rand_int(FLAGS_key_nr - 1);
+        CHECK_EQ(engine->put(to_key(k), value), kSucc);
+    }
+    CHECK_EQ(engine->sync(), kSucc);
+
+    if (FLAGS_visit)
+    {
+        size_t visited = 0;
+        auto now = std::chrono::steady_clock::now();
+        auto count = [&visited](const Key &, const Value &) { visited++; };
+        if (FLAGS_visit_threads == 0)
+        {
+            engine->visit("", "", count);
+        }
+        else
+        {
+            engine->parallel_visit("", "", FLAGS_visit_threads, Engine::Visitor(count));
+        }
+        auto end = std::chrono::steady_clock::now();
+        LOG(INFO) << "[summary] visit over " << visited << " keys on " << FLAGS_visit_threads << " threads: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - now).count() << " ms";
+        return 0;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto ns = timed_puts(*engine, [](size_t i) { return i >= FLAGS_baseline_nr; });
+    auto end = std::chrono::steady_clock::now();
+    report("without gc", ns, std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count());
+
+    std::atomic<bool> gc_done{false};
+    now = std::chrono::steady_clock::now();
+    std::thread gc([&] {
+        CHECK_EQ(engine->garbage_collect(), kSucc);
+        engine->wait_gc();
+        gc_done = true;
+    });
+    if (!FLAGS_puts_during_gc)
+    {
+        gc.join();
+        end = std::chrono::steady_clock::now();
+        LOG(INFO) << "[summary] gc alone: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - now).count() << " ms";
+        return 0;
+    }
+    ns = timed_puts(*engine, [&gc_done](size_t) { return gc_done.load(); });
+    end = std::chrono::steady_clock::now();
+    gc.join();
+    report("during gc", ns, std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count());
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+#include "conf.h"
+#include "engine.h"
+#include "glog/logging.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+/*
+ * Loads more data than a 32-bit offset can address, then re-opens the
+ * engine and reads it back: the index must locate every value correctly
+ * past the 2GB/4GB marks.
+ */
+DEFINE_string(kvdir, kDefaultBenchDir, "The KV Store data directory");
+DEFINE_uint64(total_bytes,
+              5ull * 1024 * 1024 * 1024,
+              "How many value bytes to load");
+DEFINE_uint64(value_size, kMaxValueSize, "The value size");
+DEFINE_uint64(thread_nr, 4, "The number of loading threads");
+DEFINE_uint64(read_nr, 100000, "The number of random gets after re-opening");
+DEFINE_uint64(segment_size,
+              64 * 1024 * 1024,
+              "Seal the active log segment once it grows past this");
+
+IEngine::Key to_key(uint64_t k)
+{
+    return IEngine::Key((char *) &k, sizeof(uint64_t));
+}
+
+// every value is a window of one random block, chosen by its key
+std::string block;
+void value_of(uint64_t k, std::string &value)
+{
+    value.assign(block, k % (block.size() - FLAGS_value_size), FLAGS_value_size);
+    memcpy(&value[0], &k, sizeof(k));
+}
+
+EngineOptions engine_options()
+{
+    EngineOptions options;
+    options.segment_size = FLAGS_segment_size;
+    return options;
+}
+
+void load(size_t key_nr)
+{
+    auto engine = Engine::new_instance(FLAGS_kvdir, engine_options());
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < FLAGS_thread_nr; ++i)
+    {
+        threads.emplace_back(
+            [&]()
+            {
+                std::string value;
+                for (size_t k = next++; k < key_nr; k = next++)
+                {
+                    value_of(k, value);
+                    CHECK_EQ(engine->put(to_key(k), value), kSucc);
+                }
+            });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    CHECK_EQ(engine->sync(), kSucc);
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count();
+    LOG(INFO) << "[summary] load " << key_nr << " keys, "
+              << key_nr * FLAGS_value_size << " bytes, MB/s: "
+              << 1e3 * key_nr * FLAGS_value_size / ns
+              << ", ops: " << 1e9 * key_nr / ns;
+}
+
+void reopen_and_read(size_t key_nr)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto engine = Engine::new_instance(FLAGS_kvdir, engine_options());
+    auto end = std::chrono::steady_clock::now();
+    LOG(INFO) << "[summary] re-open: "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - now)
+                     .count()
+              << " ms";
+
+    std::string value, expect;
+    now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < FLAGS_read_nr; ++i)
+    {
+        uint64_t k = fast_pseudo_rand_int(key_nr - 1);
+        CHECK_EQ(engine->get(to_key(k), value), kSucc);
+        value_of(k, expect);
+        CHECK(value == expect) << "wrong value for key " << k;
+    }
+    end = std::chrono::steady_clock::now();
+
+    auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count();
+    LOG(INFO) << "[summary] random get: ops: " << 1e9 * FLAGS_read_nr / ns
+              << ", avg_lat: " << ns / FLAGS_read_nr << " ns";
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    CHECK_NE(FLAGS_kvdir, "");
+    CHECK_GE(FLAGS_value_size, sizeof(uint64_t));
+    CHECK_LE(FLAGS_value_size, kMaxValueSize);
+
+    block = gen_rand_value(1024 * 1024);
+    size_t key_nr = FLAGS_total_bytes / FLAGS_value_size;
+    LOG(INFO) << "[explain] total_bytes: " << FLAGS_total_bytes
+              << ", value_size: " << FLAGS_value_size
+              << ", keys: " << key_nr << ", thread_nr: " << FLAGS_thread_nr
+              << ", segment_size: " << FLAGS_segment_size;
+
+    load(key_nr);
+    reopen_and_read(key_nr);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <sys/stat.h>
+
+#include <iostream>
+
+#include "conf.h"
+#include "engine.h"
+#include "glog/logging.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+/*
+ * Writes a log of puts, overwrites and removes, then times re-opening the
+ * engine over it: the index is loaded from the checkpoint written at the
+ * close, or rebuilt from the whole log without checkpoints. Run it on an
+ * empty directory.
+ */
+DEFINE_string(kvdir, kDefaultBenchDir, "The KV Store data directory");
+DEFINE_uint64(key_nr, 5000000, "The number of distinct keys");
+DEFINE_uint64(record_nr, 10000000, "The number of records in the log");
+DEFINE_double(remove_ratio, 0.1, "The share of removes among the records");
+DEFINE_uint64(value_size, 64, "The value size");
+DEFINE_uint64(reopen_nr, 3, "How many times to re-open the engine");
+DEFINE_bool(checkpoint, true, "Checkpoint the index on close");
+DEFINE_uint64(recovery_threads, 0, "Threads replaying the log on open, 0 for one per core");
+
+IEngine::Key to_key(uint64_t k)
+{
+    k *= 0x9e3779b97f4a7c15ull;  // keys in random order
+    return IEngine::Key((char *) &k, sizeof(uint64_t));
+}
+
+EngineOptions engine_options()
+{
+    EngineOptions options;
+    options.index_checkpoint = FLAGS_checkpoint;
+    options.recovery_threads = FLAGS_recovery_threads;
+    options.gc_space_amplification = 0;  // no gc in the background of the re-opens
+    return options;
+}
+
+size_t log_bytes()
+{
+    size_t bytes = 0;
+    Manifest manifest(FLAGS_kvdir);
+    CHECK(manifest.load());
+    for (SegmentId id : manifest.segments())
+    {
+        struct stat st;
+        CHECK_EQ(stat((FLAGS_kvdir + "/" + Manifest::segment_name(id)).c_str(), &st), 0);
+        bytes += st.st_size;
+    }
+    return bytes;
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    CHECK_NE(FLAGS_kvdir, "");
+    LOG(INFO) << "[explain] key_nr: " << FLAGS_key_nr << ", record_nr: " << FLAGS_record_nr
+              << ", remove_ratio: " << FLAGS_remove_ratio << ", value_size: " << FLAGS_value_size
+              << ", checkpoint: " << FLAGS_checkpoint << ", recovery_threads: " << FLAGS_recovery_threads;
+
+    {
+        auto engine = Engine::new_instance(FLAGS_kvdir, engine_options());
+        std::string value = gen_rand_value(FLAGS_value_size);
+        for (size_t i = 0; i < FLAGS_record_nr; ++i)
+        {
+            // every key once first, then random ones again
+            uint64_t k = i < FLAGS_key_nr ? i : fast_pseudo_rand_int(FLAGS_key_nr - 1);
+            if (i >= FLAGS_key_nr && fast_pseudo_rand_int(0, 999) < FLAGS_remove_ratio * 1000)
+            {
+                engine->remove(to_key(k));
+            }
+            else
+            {
+                CHECK_EQ(engine->put(to_key(k), value), kSucc);
+            }
+        }
+        CHECK_EQ(engine->sync(), kSucc);
+    }
+    size_t bytes = log_bytes();
+
+    for (size_t i = 0; i < FLAGS_reopen_nr; ++i)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto engine = Engine::new_instance(FLAGS_kvdir, engine_options());
+        auto end = std::chrono::steady_clock::now();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - now).count();
+        LOG(INFO) << "[summary] re-open over " << FLAGS_record_nr << " records, " << bytes
+                  << " bytes of log: " << ns / 1000000 << " ms, records/s: " << 1e9 * FLAGS_record_nr / ns
+                  << ", MB/s: " << 1e3 * bytes / ns;
+    }
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef INCLUDE_ARENA_H
+#define INCLUDE_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace kvs
+{
+/*
+ * Blocks of one size, carved out of 2 MB chunks mapped for the slab.
+ *
+ * Only one thread at a time allocates (the writer of the structure owning
+ * the slab): it pops a private free list, bump-allocates in the last chunk
+ * when that runs dry, and maps a new chunk when that is full. A block may
+ * be released from any thread (the EpochManager frees on whichever thread
+ * reclaims): it is pushed on a shared lock-free list, which the allocator
+ * takes over as a whole once its private list is empty.
+ *
+ * Chunks are aligned to their size and start with the Slab they belong
+ * to, so release() needs nothing but the block. With huge_pages, chunks
+ * are madvise(MADV_HUGEPAGE)d: fewer TLB misses walking the blocks, but a
+ * chunk is then resident as soon as it is touched.
+ */
+class Slab
+{
+public:
+    static constexpr size_t kChunkSize = 2 << 20;
+
+    Slab(size_t block_size, bool huge_pages);
+    ~Slab();  // unmaps every chunk, blocks still out included
+    Slab(const Slab &) = delete;
+    Slab &operator=(const Slab &) = delete;
+
+    // block_size bytes, 64-byte aligned if block_size is a multiple of 64
+    void *allocate();
+    static void release(void *p);
+
+    size_t block_size() const { return _block_size; }
+    // the bytes mapped
+    size_t bytes() const { return _chunks.size() * kChunkSize; }
+
+private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+    struct Chunk {
+        Slab *owner;
+    };
+    static constexpr size_t kHeaderSize = 64;
+
+    void new_chunk();
+
+    const size_t _block_size;
+    const bool _huge_pages;
+    FreeBlock *_free{nullptr};             // the allocator's
+    std::atomic<FreeBlock *> _released{nullptr};  // anyone's
+    char *_bump{nullptr};
+    char *_end{nullptr};
+    std::vector<void *> _chunks;
+};
+
+/*
+ * An immutable key: its size, then its bytes.
+ */
+struct ArenaKey {
+    uint32_t size;
+
+    const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+    std::string_view view() const { return std::string_view(data(), size); }
+};
+
+/*
+ * ArenaKeys in slabs of size classes 8 bytes apart, up to kMaxSlabKey
+ * bytes of key; longer keys are malloc()ed, behind a pointer back to the
+ * arena. Allocates like a Slab: one thread at a time, releases from
+ * anywhere.
+ */
+class KeyArena
+{
+public:
+    static constexpr size_t kClassStep = 8;
+    static constexpr size_t kMaxSlabKey = 256 - sizeof(ArenaKey);
+
+    explicit KeyArena(bool huge_pages);
+
+    const ArenaKey *make(std::string_view key);
+    static void release(const ArenaKey *key);
+
+    // the bytes mapped, and malloc()ed for long keys
+    size_t bytes() const;
+
+private:
+    static size_t size_class(size_t key_size) { return (sizeof(ArenaKey) + key_size - 1) / kClassStep; }
+
+    const bool _huge_pages;
+    std::unique_ptr<Slab> _slabs[(sizeof(ArenaKey) + kMaxSlabKey) / kClassStep];  // made on first use
+    std::atomic<size_t> _long_bytes{0};
+};
+
+}  // namespace kvs
+
+#endif
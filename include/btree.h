@@ -1,163 +1,245 @@
+#pragma once
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #include <functional>
 
+#include "arena.h"
+#include "epoch.h"
+#include "key_prefix.h"
 #include "glog/logging.h"
 
 namespace kvs
 {
-/* 
- * (3.5)-Tree:
- * max key: M-1 = 4;
- * min key: ceil(M/2)-1 = 2;
- * max child: M = 5;
- * min child (except root): ceil(M/2) = 3
+// the fan-out of the engine's index
+constexpr size_t kDefaultFanout = 64;
+
+/*
+ * B+tree from key to data (a Locator), read without locks.
+ *
+ * Fanout is the max children of an inner node: a node holds up to
+ * Fanout - 1 keys and at least ceil(Fanout/2) - 1 (but the root). Nodes
+ * are contiguous and cache-line aligned, inner nodes and leaves being
+ * different types; the definitions are instantiated in btree.cpp for
+ * fan-outs 5, 8, 16, 32, 64, 128 and 256.
+ *
+ * Writers are serialized by the caller, readers run alongside them with
+ * optimistic lock coupling: every node carries a version word, which a
+ * writer locks while changing the node and bumps when done. A reader notes
+ * the version of a node, reads it, and checks the version did not move
+ * before it trusts what it read; otherwise it starts over from the root.
+ * A writer only locks the nodes it changes, so a put to one leaf does not
+ * disturb a get on another.
+ *
+ * Keys are immutable ArenaKeys owned by the node holding them (inner
+ * nodes have copies of their separators). Next to the keys, a node keeps
+ * their key_prefix()es: the search in a node compares those, several at a
+ * time, and only follows a key pointer on a tie. Nodes and keys a writer unlinks
+ * are retired to the EpochManager: readers hold an EpochGuard, so what
+ * they reach stays valid until they are done.
+ *
+ * Nodes come from a slab per node type and keys from a KeyArena, all
+ * allocated by the writer; with huge_pages, on 2 MB pages.
  */
-
-#define M 5
-
-
+template <size_t Fanout = kDefaultFanout>
 class BTree
 {
 public:
     using Key = std::string;
     using Value = std::string;
     using Visitor = std::function<void(const Key &, const Value &)>;
+    // called by scan() in key order, returns false to stop
+    using ScanVisitor = std::function<bool(std::string_view, size_t)>;
 
-    class BNode
-    {
-    public:
-        BNode(BNode* parent, bool is_leaf) : 
-            parent(parent), is_leaf(is_leaf), prev(nullptr), next(nullptr)
-        {
-            key.reserve(M - 1);
-            child.reserve(M);
-            if (is_leaf) data.reserve(M - 1);
-        }
-        BNode* parent;
-        bool is_leaf;
-
-        std::vector<Key> key;
-        std::vector<BNode*> child;
-        /* Leaf Node Only */
-        std::vector<int> data;
-        BNode* prev;
-        BNode* next;
-
-        bool is_full() { return key.size() == (M - 1); }
-
-        void delete_child() {
-            if (is_leaf) return;
-            for (size_t i = 0; i < child.size(); i++) {
-                child[i]->delete_child();
-                delete child[i];
-            }
-        }
-        void show_key(std::string &log_out) {
-            log_out.append("[");
-            for (size_t i = 0; i < key.size(); i++) {
-                log_out.append(key[i]);
-                if (is_leaf) {
-                    log_out.append("(");
-                    log_out.append(std::to_string(data[i]));
-                    log_out.append(")");
-                }
-                log_out.append(", ");
-            }
-            log_out.append("]");
-        }
-    };
+    static_assert(Fanout >= 3 && Fanout <= 256, "unsupported fan-out");
+    static constexpr size_t kMaxKeys = Fanout - 1;
+    static constexpr size_t kMinKeys = (Fanout + 1) / 2 - 1;
+    static constexpr size_t kNotFound = (size_t)-1;
 
-    BTree();
+    explicit BTree(bool huge_pages = false);
 
     ~BTree();
 
-    BNode* get_root() { return _root; }
-
-    size_t size() { return _size; }
+    size_t size() const { return _size.load(std::memory_order_relaxed); }
 
     /*
+     * lock-free, from any thread:
      * return data: find the key!
-     * return unsigned_int_max: key not found! 
+     * return kNotFound: key not found!
      */
-    size_t search(const Key& key, BNode*& _hot, std::vector<size_t>& _hot_idx);
+    size_t search(const Key& key) const;
+    /*
+     * lock-free, from any thread: search() of n keys in order into data[i].
+     * A key in the leaf of the one before it is found in the copy of that
+     * leaf, with no new descent from the root.
+     */
+    void search_sorted(const std::string_view* keys, size_t n, size_t* data) const;
 
-    size_t search(const Key& key);
+    /*
+     * lock-free, from any thread: f on the keys >= from (> from if
+     * exclusive) in order, until it returns false. A key inserted or
+     * removed meanwhile may be seen or not, any other key is seen once.
+     */
+    void scan(const Key& from, bool exclusive, const ScanVisitor& f) const;
+    // as scan(), down from the keys <= from (< from if exclusive); from "" stands for past the last key
+    void scan_reverse(const Key& from, bool exclusive, const ScanVisitor& f) const;
+    /*
+     * lock-free, from any thread: up to n - 1 separators of inner nodes, in
+     * order and strictly between lower and upper ("" for no bound), which
+     * cut the keys between them into n runs of about the same length:
+     * picked from the separators down to the highest level with a few
+     * times n of them in the range, fewer if the tree is too small for n
+     */
+    std::vector<Key> split_keys(const Key& lower, const Key& upper, size_t n) const;
 
     /*
+     * one writer at a time:
      * return 1: key not exist, insert success!
-     * return 0: key exist, modify success!
-     * return -1: error 
+     * return 0: key exist, modify success! (*old: the data it had)
+     * return -1: error
      */
-    int insert(const Key &key, const size_t data);
+    int insert(const Key &key, const size_t data, size_t *old = nullptr);
 
     /*
-     * return 1: key exist, remove success!
+     * one writer at a time:
+     * return 1: key exist, remove success! (*old: the data it had)
      * return 0: key not exist, remove failed!
-     * return -1: error 
+     * return -1: error
      */
-    int remove(const Key &key);
-
-    void show_tree() {
-        std::vector<BNode*> node_queue;
-        size_t i = 0;
-        int level = 0;
-        int child_n = 0;
-        BNode* first_node = _root;
-        BNode* cur_parent = nullptr;
-        node_queue.emplace_back(_root);
-
-        std::string log_out("_size = ");
-        log_out.append(std::to_string(_size));
-        while (i < node_queue.size()) {
-            BNode* v = node_queue[i];
-            i += 1;
-            if (v == first_node) {
-                level += 1;
-                cur_parent = first_node->parent;
-                child_n = 0;
-                first_node = first_node->child[0];
-                LOG(INFO) << log_out;
-                log_out.clear();
-                log_out.append("ch0: ");
-            }
-            else if (v->parent != cur_parent) {
-                child_n += 1;
-                // log_out.append("ch");
-                // log_out.append(std::to_string(child_n));
-                // log_out.append(": ");
-                log_out.append(" || ");
-                cur_parent = v->parent;
-            }
-            
-            v->show_key(log_out);
-            log_out.append(", ");
-
-            for (size_t j = 0; j < v->child.size(); j++) {
-                if (v->child[j] != nullptr) {
-                    node_queue.emplace_back(v->child[j]);
-                }
-            }            
-        }
-        LOG(INFO) << log_out;
+    int remove(const Key &key, size_t *old = nullptr);
+
+    // the writer only: every key in order, without validation
+    void for_each(const std::function<void(std::string_view, size_t)>& f) const;
+    // one writer at a time: set the data of key to data if it is expected, false otherwise
+    bool replace(const Key& key, size_t expected, size_t data);
+    /*
+     * the writer only, on an empty tree: build it bottom-up from count entries
+     * sorted by key, without duplicates, next() returning them in turn.
+     * Nodes are packed full but the last two of a level, which share what
+     * is left.
+     */
+    using Entry = std::pair<std::string_view, size_t>;
+    void bulk_load(size_t count, const std::function<Entry()>& next);
+    void bulk_load(const std::vector<std::pair<Key, size_t>>& entries)
+    {
+        auto it = entries.begin();
+        bulk_load(entries.size(), [&it] {
+            auto& e = *it++;
+            return Entry(e.first, e.second);
+        });
     }
 
+    // check the structure of the tree, false (and why in the log) if broken
+    bool check() const;
+
+    // the writer only: the bytes taken by nodes and keys
+    size_t memory_usage() const;
 
 protected:
-    size_t _size; // total key num
-    BNode* _root;
-    std::vector<size_t> _tmp_idx;
+    struct alignas(64) Node {
+        explicit Node(bool leaf) : version(0), is_leaf(leaf), count(0)
+        {
+            std::fill(prefix, prefix + kMaxKeys, INT64_MAX);
+            std::fill(key, key + kMaxKeys, nullptr);
+        }
+        std::atomic<uint64_t> version;  // | counter | obsolete | locked |
+        const bool is_leaf;
+        size_t count;
+        int64_t prefix[kMaxKeys];  // key_prefix(key[i]->view())
+        const ArenaKey* key[kMaxKeys];
+
+        void set_key(size_t i, const ArenaKey* k, int64_t p)
+        {
+            key[i] = k;
+            prefix[i] = p;
+        }
+        void set_key(size_t i, const ArenaKey* k) { set_key(i, k, k ? key_prefix(k->view()) : INT64_MAX); }
+        void move_key(size_t i, const Node* from, size_t j) { set_key(i, from->key[j], from->prefix[j]); }
+    };
+    struct Inner : Node {
+        Inner() : Node(false) { std::fill(child, child + Fanout, nullptr); }
+        Node* child[Fanout];
+    };
+    struct Leaf : Node {
+        Leaf() : Node(true), prev(nullptr), next(nullptr) { std::fill(data, data + kMaxKeys, 0); }
+        size_t data[kMaxKeys];
+        Leaf* prev;
+        Leaf* next;
+    };
+    // a consistent copy of a leaf, for the readers
+    struct LeafCopy {
+        size_t count;
+        const ArenaKey* key[kMaxKeys];
+        size_t data[kMaxKeys];
+        const Leaf* next;
+        const Leaf* prev;
+    };
+    // the way down to the leaf of the writer: path[i].node->child[path[i].idx]
+    struct PathEntry {
+        Inner* node;
+        size_t idx;
+    };
+    /*
+     * every node but the root has at least 2 children, so a tree of
+     * fewer than 2^64 keys is less than 64 levels deep
+     */
+    static constexpr size_t kMaxDepth = 64;
+    // the path of the writer, reused by every insert/remove
+    struct Cursor {
+        PathEntry path[kMaxDepth];
+        size_t depth = 0;
+
+        void push(Inner* node, size_t idx) { path[depth++] = {node, idx}; }
+        void pop() { depth--; }
+        const PathEntry& back() const { return path[depth - 1]; }
+    };
+
+    // retired with the tree: after whatever it retired before
+    struct Memory {
+        explicit Memory(bool huge_pages) :
+            inners(sizeof(Inner), huge_pages), leaves(sizeof(Leaf), huge_pages), keys(huge_pages)
+        { }
+        Slab inners;
+        Slab leaves;
+        KeyArena keys;
+    };
+
+    Memory* _memory;
+    std::atomic<Node*> _root;
+    std::atomic<size_t> _size; // total key num
+
+    /* the writer only */
+    Cursor _cursor;
+    // unlocked at the end of insert/remove; reserved once, an operation
+    // touches a few nodes per level at most
+    std::vector<Node*> _locked;
+    std::vector<Node*> _unlinked;  // retired once unlocked
+    std::vector<const ArenaKey*> _dropped_keys;
+
+    const Leaf* find_leaf(std::string_view key, uint64_t& version, bool last = false) const;
+    static bool copy_leaf(const Leaf* leaf, uint64_t version, LeafCopy& copy);
+
+    Leaf* find_leaf(std::string_view key);
+    Leaf* new_leaf();
+    Inner* new_inner();
+    const ArenaKey* new_key(std::string_view key) { return _memory->keys.make(key); }
+    void lock(Node* v);
+    void unlink(Node* v);
+    void unlock_all();
 
-    void solve_overflow_leaf(const Key& key, const size_t data, BNode*& _hot, std::vector<size_t>& _hot_idx);
+    void solve_overflow_leaf(Leaf* v, size_t idx, const Key& key, const size_t data);
 
-    void solve_overflow_innode(const Key& key, BNode* _c, BNode*& _hot, std::vector<size_t>& _hot_idx);
+    void solve_overflow_innode(size_t level, const ArenaKey* sep, Node* right);
 
-    void solve_underflow_leaf(BNode*& _hot, std::vector<size_t>& _hot_idx);
+    void solve_underflow_leaf(Leaf* v);
 
-    void solve_underflow_innode(BNode*& _hot, std::vector<size_t>& _hot_idx);
-    
+    void solve_underflow_innode(size_t level);
 
+    static void delete_node(Node* v);
+    static std::vector<size_t> pack(size_t n, size_t capacity, size_t min);
+    bool check_node(const Node* v, const ArenaKey* lower, const ArenaKey* upper, size_t depth,
+                    size_t& leaf_depth, const Leaf*& last_leaf, size_t& keys) const;
 };
 
 }
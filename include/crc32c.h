@@ -0,0 +1,39 @@
+#pragma once
+#ifndef INCLUDE_CRC32C_H
+#define INCLUDE_CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kvs
+{
+namespace crc32c
+{
+/*
+ * CRC-32C (Castagnoli), the one with a dedicated SSE4.2 instruction.
+ *
+ * extend() returns the crc of A + data[0, n), given init_crc, the crc of
+ * some string A. It picks the fastest implementation of the host once:
+ *   sse4.2 + pclmul: three interleaved crc32 streams, combined with clmul
+ *   sse4.2:          one crc32 instruction per 8 bytes
+ *   otherwise:       slicing-by-8 tables
+ */
+uint32_t extend(uint32_t init_crc, const char *data, size_t n);
+
+inline uint32_t value(const char *data, size_t n)
+{
+    return extend(0, data, n);
+}
+
+bool has_sse42();
+bool has_pclmul();
+
+// the implementations behind extend(), exposed for tests and benchmarks
+uint32_t extend_portable(uint32_t init_crc, const char *data, size_t n);
+uint32_t extend_sse42(uint32_t init_crc, const char *data, size_t n);
+uint32_t extend_sse42_pclmul(uint32_t init_crc, const char *data, size_t n);
+
+}  // namespace crc32c
+}  // namespace kvs
+
+#endif
@@ -14,10 +14,24 @@
 #include <shared_mutex>
 #include <thread>
 #include <future>
+#include <deque>
+#include <map>
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <sys/uio.h>
 
 #include "conf.h"
+#include "epoch.h"
+#include "index_checkpoint.h"
 #include "interfaces.h"
+#include "log_format.h"
+#include "manifest.h"
+#include "mapped_segment.h"
 #include "options.h"
+#include "persister.h"
+#include "value_cache.h"
 #include "glog/logging.h"
 
 #include "btree.h"
@@ -28,9 +42,12 @@ namespace kvs
  * The actual Engine you need to implement
  * TODO: your code
  */
-class Engine : public IEngine
+class Engine : public IEngine, public std::enable_shared_from_this<Engine>
 {
 public:
+    // the n-th record appended to the log since the engine was opened
+    using Sequence = uint64_t;
+
     Engine(const std::string &path, EngineOptions options);
 
     static Pointer new_instance(const std::string &path, EngineOptions options)
@@ -46,6 +63,31 @@ public:
     RetCode remove(const Key &key) override;
     RetCode get(const Key &key, Value &value) override;
 
+    /**
+     * @brief get without copying the value out of a sealed log segment:
+     * the view points into its mapping and keeps it alive
+     */
+    RetCode get(const Key &key, ValueView &view);
+
+    /**
+     * @brief get() of many keys at once, into values[i] and statuses[i].
+     * The keys are looked up in key order, in one pass over the index, and
+     * the records read in log order: records of the active segment close
+     * together come in with a single read, and with
+     * EngineOptions::multi_get_prefetch the kernel is asked for the pages
+     * of those of a sealed segment all at once, before any is copied.
+     * @return kSucc, or the first status of a key which is neither kSucc
+     * nor kNotFound
+     */
+    RetCode multi_get(const std::vector<Key> &keys, std::vector<Value> &values, std::vector<RetCode> &statuses);
+
+    /**
+     * @brief put/remove which also report the sequence of the write,
+     * to be passed to wait_durable()
+     */
+    RetCode put(const Key &key, const Value &value, Sequence &seq);
+    RetCode remove(const Key &key, Sequence &seq);
+
     /**
      * @brief syncing all the modifications to the disk/SSD
      * All the modification operations before calling sync() should be
@@ -53,9 +95,27 @@ public:
      */
     RetCode sync() override;
 
+    /**
+     * @brief block until the write of sequence seq is on disk, without
+     * forcing an fsync: it waits for the durability policy (or somebody's
+     * sync()) to get there.
+     * @return kSucc, or kTimedOut if it is not durable after timeout
+     */
+    RetCode wait_durable(Sequence seq,
+                         std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+    Sequence last_sequence() const { return _last_sequence.load(); }
+    Sequence durable_sequence() const { return _durable_sequence.load(); }
+
+    /**
+     * @brief hits, misses and size of the value cache,
+     * all zero if EngineOptions::value_cache_bytes is 0
+     */
+    ValueCache::Stats cache_stats() const;
+
     /**
      * @brief visit applies the visitor to all the KV pairs within
-     * the range of [lower, upper).
+     * the range of [lower, upper], upper included.
      * Note that lower == "" is treated as the one before all the keys
      * upper == "" is treated as the one after all the keys
      * So, visit("", "", visitor) will traverse the entire database.
@@ -73,53 +133,262 @@ public:
     RetCode visit(const Key &lower,
                   const Key &upper,
                   const Visitor &visitor) override;
+    // as visit(), from the index alone: the log is not read
+    RetCode visit_keys(const Key &lower,
+                       const Key &upper,
+                       const KeyVisitor &visitor) override;
+    // as visit(), a value is read from the log when the visitor asks for it
+    RetCode visit_lazy(const Key &lower,
+                       const Key &upper,
+                       const LazyVisitor &visitor) override;
     /**
-     * @brief generate snapshot, if you want to implement
+     * @brief as visit(), with n_threads workers reading the values at once,
+     * for the queue depth a large scan needs. The range is cut at
+     * separators of the index into partitions of about the same size, a few
+     * per worker, which read a batch of values at a time.
+     * @param visitor called by the workers with the number of the partition
+     * of the key, in key order within a partition, the partitions side by
+     * side
+     */
+    using PartitionVisitor = std::function<void(size_t partition, const Key &, const Value &)>;
+    RetCode parallel_visit(const Key &lower,
+                           const Key &upper,
+                           size_t n_threads,
+                           const PartitionVisitor &visitor);
+    /**
+     * @brief as above, but visitor is called on the calling thread in key
+     * order: the workers read ahead into a reorder buffer of
+     * n_threads * kParallelVisitBuffer bytes or so, and wait when it is full
+     */
+    static constexpr size_t kParallelVisitBuffer = 1 << 20;
+    RetCode parallel_visit(const Key &lower,
+                           const Key &upper,
+                           size_t n_threads,
+                           const Visitor &visitor);
+    // a cursor over the keys as they change, see class EngineIterator; it keeps the engine open
+    std::unique_ptr<Iterator> new_iterator() override;
+
+    /**
+     * @brief generate snapshot, a read-only view of the engine as it is
+     * now, which the writes after it do not change. Taking one is cheap,
+     * reading it takes no engine lock. It keeps the engine open.
      * @see class Snapshot
      */
     std::shared_ptr<IROEngine> snapshot() override;
 
     /**
      * @brief trigger garbage collection, if you want to implement
+     * It runs in the background and returns at once: see _gc.
      */
     RetCode garbage_collect() override;
 
+    // block until no garbage collection (or index checkpoint) is queued or running
+    void wait_gc();
+
+    // the bytes of the log, and how many of them are records still live
+    struct SpaceUsage {
+        size_t log_bytes;
+        size_t live_bytes;
+    };
+    SpaceUsage space_usage();
+
 private:
-    // std::ofstream log_ofstream;
-    // int log_app_fd;
-    // int log_r_fd;
-    std::string log_filename;
-    
-    BTree btree;
-    int log_offset;
-    FILE* log_fp;
-
-    mutable std::shared_mutex _mutex;
-    mutable std::shared_mutex _mutex2;
-    mutable std::mutex _mutex_gc;
+    std::string _path;
 
-    void rebuild_btree(const std::string& log_filename);
+    /*
+     * the log is a chain of segments listed by _manifest (see manifest.h).
+     * Appends go through _log_writer to the active segment, point reads
+     * are served from the mapping of a sealed segment, or are preadv()s on
+     * the long-lived read handle of the active one. A sealed segment keeps
+     * no descriptor: thousands of them stay under the limit of open files.
+     * Readers use the table in _segments under an EpochGuard, without a
+     * lock. The writer (holding _log_mutex) publishes a changed copy and
+     * retires the old one: a handle is closed along with the last table
+     * holding it, once no reader can see that table any more.
+     */
+    real_storage::FilePool _file_pool;
+    Manifest _manifest;  // guarded by _log_mutex
+    real_storage::File _log_writer;
+    struct Segment {
+        std::shared_ptr<real_storage::File> reader;  // the active segment, or a sealed one which could not be mapped
+        std::shared_ptr<MappedSegment> map;  // sealed segments only
+    };
+    using SegmentTable = std::map<SegmentId, Segment>;
+    std::atomic<const SegmentTable*> _segments;
 
-    void log_line(FILE*& fp, const std::string& line);
-    void read_line(FILE*& fp, std::string& line);
-    int read_key_value(FILE*& fp, Key& key, Value& value);  // return 1 if insert, 0 if remove, -1 if failed
-    bool read_num(FILE*&fp, size_t num, std::string& line);
+    EngineOptions _options;
 
-    void _gc();
+    using Index = BTree<>;
+    Index btree;  // read lock-free, written by the leader (and gc) only
+    /*
+     * get fills the cache after reading the log, if the key is still at
+     * the locator it read, checked under the lock of the cache shard: a
+     * write which raced with it cannot end up shadowed by the older value,
+     * see ValueCache::insert().
+     */
+    std::unique_ptr<ValueCache> _cache;
+    size_t log_offset;  // in the active segment, guarded by _log_mutex
+    size_t _checkpoint_bytes;  // logged since the last index checkpoint, guarded by _log_mutex
 
-    struct NodeIdxPair {
-        BTree::BNode* v;
-        size_t idx;
-        NodeIdxPair(BTree::BNode* _v, size_t _idx) :
-            v(_v), idx(_idx)
+    /*
+     * gc and the index checkpoints run on _gc_thread, started by the
+     * first request for either: a checkpoint never sees the index point
+     * into new segments of a gc before the manifest lists them.
+     * _gc_requested, _gc_full, _checkpoint_requested, _gc_running (either
+     * of them is) and _gc_closing are guarded by _mutex_gc.
+     */
+    mutable std::mutex _mutex_gc;
+    std::condition_variable _gc_cv;
+    std::thread _gc_thread;
+    bool _gc_requested;
+    bool _gc_full;  // asked for by garbage_collect(), not by the scheduler
+    bool _gc_running;
+    bool _gc_closing;
+    bool _checkpoint_requested;
+
+    /*
+     * space accounting, guarded by _log_mutex: the bytes of each segment
+     * of the manifest, and how many are records the index points to (or
+     * tombstones gc had to keep). The rest is garbage: overwritten and
+     * removed records, tombstones. The gc scheduler goes by it, see
+     * pick_victims().
+     */
+    struct SegmentUsage {
+        size_t bytes{0};
+        size_t live{0};
+    };
+    std::map<SegmentId, SegmentUsage> _usage;
+
+    /*
+     * snapshots, see class Snapshot: the writes after a snapshot go on in
+     * the index, which the snapshot reads through the undo logs of the
+     * generations from its own on. A generation starts with a snapshot;
+     * the first write of a key in it logs where the key was (kAbsent if
+     * nowhere), before it changes the index. Only the writer adds to an
+     * undo log, readers go through it without a lock.
+     * A generation lives while a snapshot of it or of an older one does,
+     * and is dropped under _log_mutex.
+     */
+    struct Generation : std::enable_shared_from_this<Generation> {
+        explicit Generation(Engine* e) : engine(e), next(nullptr) { }
+        ~Generation();
+        Engine* engine;
+        Index undo;
+        std::shared_ptr<Generation> newer;  // owns next
+        std::atomic<Generation*> next;
+    };
+    static constexpr Locator kAbsent = Index::kNotFound - 1;  // no segment has this id
+    Generation* _generation;  // the newest one, nullptr if no snapshot is left, guarded by _log_mutex
+    /*
+     * guarded by _log_mutex: how many records of each segment an undo log
+     * points to. gc leaves such a segment alone, and one which is pinned
+     * while gc copies it leaves the manifest but stays readable (in
+     * _retained) until the last pin goes.
+     */
+    std::map<SegmentId, size_t> _pins;
+    std::set<SegmentId> _retained;
+
+    /*
+     * group commit:
+     * every put/remove/sync queues a Writer in _writers. The writer at the
+     * front becomes the leader: it appends the records of the whole queue
+     * with one writev(), issues a single fdatasync() if anyone in the group
+     * asked for it, applies the group to the btree in log order and wakes
+     * the followers up with their results.
+     */
+    struct Writer {
+        Writer(const Key* _key, const Value* _value, bool _sync) :
+            key(_key), value(_value), sync(_sync), done(false), ret(kSucc), loc(0), seq(0)
         { }
+        const Key* key;      // nullptr for a bare sync()
+        const Value* value;  // nullptr for remove
+        bool sync;
+        bool done;
+        RetCode ret;
+        Locator loc;         // where the leader put the record
+        Sequence seq;
+        RecordHeader header;  // encoded by the writer itself, crc included
+        std::condition_variable cv;
     };
-    std::vector<NodeIdxPair> _pair_vector;
-    std::vector<size_t> _pair_addr;
-    bool pair_comp(size_t i1, size_t i2) {
-        return (_pair_vector[i1].v->data[_pair_vector[i1].idx] < 
-            _pair_vector[i2].v->data[_pair_vector[i2].idx]);
-    }
+    std::mutex _writer_mutex;
+    std::deque<Writer*> _writers;
+    std::mutex _log_mutex;           // held by the leader (and gc) while touching the log
+    std::vector<Writer*> _group;     // leader only
+    std::vector<struct iovec> _iov;  // leader only
+
+    /*
+     * durability:
+     * _last_sequence is bumped by the leader for every record it logs,
+     * _durable_sequence follows it after each successful fdatasync().
+     * With Durability::kSyncInterval a flusher thread issues those syncs.
+     */
+    std::atomic<Sequence> _last_sequence;
+    std::atomic<Sequence> _durable_sequence;
+    std::atomic<size_t> _unsynced_bytes;
+    std::mutex _durable_mutex;
+    std::condition_variable _durable_cv;
+
+    std::thread _flusher;
+    std::mutex _flush_mutex;
+    std::condition_variable _flush_cv;
+    bool _closing;
+
+    void flush_loop();
+
+    void rebuild_btree();
+    void rebuild_btree_from_log();
+    void replay_log(size_t from, size_t offset, std::vector<std::pair<Key, Locator>>& records);
+    size_t scan_segment(SegmentId id, size_t offset, std::vector<std::pair<Key, Locator>>& records,
+                        size_t& file_size);
+    size_t recovery_threads() const;
+    void write_checkpoint();
+    Segment open_segment(SegmentId id, bool active);
+    void rotate_segment();
+    void publish_segments(const SegmentTable* table);
+    const Segment* find_segment(SegmentId id) const;  // caller holds an EpochGuard
+
+    RetCode commit(Writer& w);
+    void write_group();
+    bool exists_before(size_t group_idx, const Key& key);
+    bool check_record(const RecordHeader& header, Locator loc, const Key& key,
+                      const char* stored_key, const char* value);
+    const char* find_mapped(const MappedSegment& map, Locator loc, const Key& key, bool scan);
+    bool read_value(Locator loc, const Key& key, Value& value, bool scan = false);
+    bool read_view(Locator loc, const Key& key, ValueView& view);
+    /*
+     * multi_get: the records of reads, of one segment in offset order, into
+     * values[i] for the key i of each; the ones it cannot read go to retry
+     */
+    using Read = std::pair<Locator, size_t>;
+    void read_segment(const Read* reads, size_t n, const std::vector<Key>& keys,
+                      std::vector<Value>& values, std::vector<RetCode>& statuses, std::vector<size_t>& retry);
+    void scan_index(const Key& lower, const std::function<bool(const Key&, Locator)>& f);
+    // caller holds an EpochGuard: the value of key found at loc, which a gc may have moved since
+    RetCode read_current(const Key& key, Locator loc, Value& value);
+    /*
+     * the key-value pairs of [from, to), up to upper (included) if to is "",
+     * read a batch at a time under an EpochGuard and handed to sink out of
+     * it; sink returns false to stop
+     */
+    using KVBatch = std::vector<std::pair<Key, Value>>;
+    RetCode read_range(const Key& from, const Key& to, const Key& upper,
+                       const std::function<bool(KVBatch&)>& sink);
+
+
+    void log_undo(const Key& key);
+    void unpin(Locator loc);
+
+    void account_segments();
+    void mark_dead(Locator loc, size_t key_size);
+    void request_gc(bool full);
+    void request_checkpoint();
+    void maybe_schedule_gc();
+    std::vector<SegmentId> pick_victims(bool full);
+    void gc_loop();
+    bool _gc(bool full);  // false if there was nothing to compact
+
+    friend class Snapshot;
+    friend class EngineIterator;
 };
 
 }  // namespace kvs
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef INCLUDE_EPOCH_H
+#define INCLUDE_EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace kvs
+{
+/*
+ * Epoch-based reclamation, for structures read without locks.
+ *
+ * A reader holds an EpochGuard while it may touch shared memory; a writer
+ * which unlinks a node hands it to retire() instead of freeing it. The
+ * node is freed once every reader which was active when it was retired
+ * has left: a reader entering later cannot reach it any more.
+ *
+ * Guards nest, only the outermost one announces the thread.
+ */
+class EpochManager
+{
+public:
+    using Deleter = void (*)(void *);
+
+    // the process-wide manager
+    static EpochManager &global();
+
+    ~EpochManager();
+
+    void enter();
+    void leave();
+
+    void retire(void *p, Deleter deleter);
+    template <typename T>
+    void retire(T *p)
+    {
+        retire(p, [](void *q) { delete static_cast<T *>(q); });
+    }
+
+    // free what no reader can see any more, returns how much was freed
+    size_t reclaim();
+
+private:
+    static constexpr uint64_t kInactive = UINT64_MAX;
+    static constexpr size_t kReclaimEvery = 64;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{kInactive};
+        std::atomic<bool> in_use{false};
+        size_t depth{0};  // only touched by the owner
+    };
+    struct Retired {
+        uint64_t epoch;
+        void *p;
+        Deleter deleter;
+    };
+
+    Slot *slot();
+    friend struct SlotOwner;
+    size_t reclaim_locked();
+
+    std::atomic<uint64_t> _epoch{1};
+
+    std::mutex _slots_mutex;
+    std::vector<Slot *> _slots;  // never shrinks, a slot is reused by the next thread
+
+    std::mutex _retired_mutex;
+    std::vector<Retired> _retired;
+};
+
+class EpochGuard
+{
+public:
+    EpochGuard() : _manager(EpochManager::global()) { _manager.enter(); }
+    ~EpochGuard() { _manager.leave(); }
+    EpochGuard(const EpochGuard &) = delete;
+    EpochGuard &operator=(const EpochGuard &) = delete;
+
+private:
+    EpochManager &_manager;
+};
+
+}  // namespace kvs
+
+#endif
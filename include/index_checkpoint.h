@@ -0,0 +1,79 @@
+#pragma once
+#ifndef INCLUDE_INDEX_CHECKPOINT_H
+#define INCLUDE_INDEX_CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "log_format.h"
+#include "manifest.h"
+
+namespace kvs
+{
+/*
+ * The index on disk, "INDEX": every live key with its locator, in key
+ * order, and the log position the index was at. That position is the
+ * segments of the manifest then, in log order, up to an offset in the
+ * last of them. On open, the checkpoint is bulk-loaded and only the log
+ * past that position is replayed; the checkpoint is of no use unless
+ * the manifest still starts with those segments.
+ *
+ * Like the manifest, it is written to INDEX.tmp, synced and renamed
+ * over INDEX. The log up to the position has to be on disk before.
+ *
+ * Layout, little-endian:
+ *   magic u64, version u32, segment count u32, offset u64,
+ *   the segment ids u32 each,
+ *   per key: key size u32, the key, locator u64,
+ *   key count u64, crc32c of all of the above u32
+ * It is read through a read-only mapping, the keys in place.
+ */
+class IndexCheckpoint
+{
+public:
+    explicit IndexCheckpoint(const std::string &dir);
+    ~IndexCheckpoint();
+    IndexCheckpoint(const IndexCheckpoint &) = delete;
+    IndexCheckpoint &operator=(const IndexCheckpoint &) = delete;
+
+    // writing: begin(), add() the keys in order, commit()
+    void begin(const std::vector<SegmentId> &segments, size_t offset);
+    void add(std::string_view key, Locator loc);
+    void commit();
+
+    // false if there is no checkpoint, or a damaged one (with a warning)
+    bool load();
+    const std::vector<SegmentId> &segments() const { return _segments; }
+    size_t offset() const { return _offset; }
+    size_t size() const { return _count; }
+    // after load(): the next key of the checkpoint, size() times
+    std::pair<std::string_view, Locator> next();
+    // unmap what load() mapped
+    void close();
+
+    // remove the checkpoint, before the log it covers goes away
+    void remove();
+
+private:
+    void write(const void *p, size_t n);
+
+    std::string _dir;
+    std::vector<SegmentId> _segments;
+    size_t _offset{0};
+    size_t _count{0};
+
+    FILE *_fp{nullptr};  // writing
+    uint32_t _crc{0};
+
+    const char *_map{nullptr};  // reading
+    size_t _map_size{0};
+    const char *_cursor{nullptr};
+};
+
+}  // namespace kvs
+
+#endif
@@ -40,6 +40,58 @@ public:
     virtual RetCode visit(const Key &lower,
                           const Key &upper,
                           const Visitor &visitor) = 0;
+
+    // as visit(), the keys only: no value is read
+    using KeyVisitor = std::function<void(const Key &)>;
+    virtual RetCode visit_keys(const Key &lower,
+                               const Key &upper,
+                               const KeyVisitor &visitor) = 0;
+
+    /**
+     * The value of the key a visit_lazy() is at, read by get() only, so
+     * the visitor pays for the values it wants. It lives as long as the
+     * call of the visitor.
+     */
+    class LazyValue
+    {
+    public:
+        using Value = IROEngine::Value;
+        // kNotFound if the key was removed since the visit got to it
+        virtual RetCode get(Value &value) = 0;
+
+    protected:
+        ~LazyValue() = default;
+    };
+    using LazyVisitor = std::function<void(const Key &, LazyValue &)>;
+    virtual RetCode visit_lazy(const Key &lower,
+                               const Key &upper,
+                               const LazyVisitor &visitor) = 0;
+
+    /**
+     * A cursor over the keys in order, moved by the caller: it holds no
+     * lock between calls, so it can be kept around to read a page at a
+     * time while writes go on. The value is only read by value().
+     */
+    class Iterator
+    {
+    public:
+        using Key = IROEngine::Key;
+        using Value = IROEngine::Value;
+        virtual ~Iterator() = default;
+        // false once the cursor went past either end
+        virtual bool valid() const = 0;
+        // to the first key >= key, seek("") to the first key
+        virtual void seek(const Key &key) = 0;
+        virtual void seek_to_last() = 0;
+        // valid() only
+        virtual void next() = 0;
+        virtual void prev() = 0;
+        virtual const Key &key() const = 0;
+        // read now: kNotFound if the key was removed since the cursor got to it
+        virtual RetCode value(Value &value) = 0;
+    };
+    virtual std::unique_ptr<Iterator> new_iterator() = 0;
+
     virtual ~IROEngine() = default;
 };
 
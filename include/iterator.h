@@ -0,0 +1,102 @@
+#pragma once
+#ifndef INCLUDE_ITERATOR_H
+#define INCLUDE_ITERATOR_H
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "engine.h"
+#include "interfaces.h"
+#include "snapshot.h"
+
+namespace kvs
+{
+/*
+ * The cursor of IROEngine::new_iterator(), over the index of an engine or
+ * a snapshot.
+ *
+ * Between calls it holds neither a lock nor an EpochGuard: it keeps a
+ * copy of the keys around the cursor, a leaf or so of them, with their
+ * locators. Moving off either end of the copy seeks the index again from
+ * the key there and takes the next batch in that direction, so a change
+ * of the tree since shows up then. As with visit(), a key written or
+ * removed meanwhile may be seen or not, any other key is seen once.
+ *
+ * The value is read from the log by value() only: the one the key has
+ * by then for an engine, a record gc moved being looked up again by key.
+ */
+// the LazyValue of a visit_lazy(), which reads by read(value)
+template <typename Read>
+class LazyRead : public IROEngine::LazyValue
+{
+public:
+    explicit LazyRead(Read read) : _read(std::move(read)) { }
+    RetCode get(Value &value) override { return _read(value); }
+
+private:
+    Read _read;
+};
+
+class IndexIterator : public IROEngine::Iterator
+{
+public:
+    IndexIterator() : _idx(0) { }
+
+    bool valid() const override { return _idx < _entries.size(); }
+    void seek(const Key &key) override;
+    void seek_to_last() override;
+    void next() override;
+    void prev() override;
+    const Key &key() const override { return _entries[_idx].first; }
+    RetCode value(Value &value) override { return read(_entries[_idx].first, _entries[_idx].second, value); }
+
+protected:
+    using Entry = std::pair<Key, Locator>;
+    /*
+     * a batch of the keys >= from (> from if exclusive) in order, or, if
+     * reverse, <= from (< from) in descending order, from "" standing for
+     * past the last key; none at the end
+     */
+    virtual void fill(const Key &from, bool exclusive, bool reverse, std::vector<Entry> &entries) = 0;
+    virtual RetCode read(const Key &key, Locator loc, Value &value) = 0;
+
+private:
+    std::vector<Entry> _entries;  // in key order
+    size_t _idx;
+
+    void load(const Key &from, bool exclusive, bool reverse);
+};
+
+// over the index of the engine as it goes, it keeps the engine open
+class EngineIterator : public IndexIterator
+{
+public:
+    explicit EngineIterator(std::shared_ptr<Engine> engine) : _engine(std::move(engine)) { }
+
+protected:
+    void fill(const Key &from, bool exclusive, bool reverse, std::vector<Entry> &entries) override;
+    RetCode read(const Key &key, Locator loc, Value &value) override;
+
+private:
+    std::shared_ptr<Engine> _engine;
+};
+
+// over the keys of a snapshot, it keeps the snapshot
+class SnapshotIterator : public IndexIterator
+{
+public:
+    explicit SnapshotIterator(std::shared_ptr<const Snapshot> snapshot) : _snapshot(std::move(snapshot)) { }
+
+protected:
+    void fill(const Key &from, bool exclusive, bool reverse, std::vector<Entry> &entries) override;
+    RetCode read(const Key &key, Locator loc, Value &value) override;
+
+private:
+    std::shared_ptr<const Snapshot> _snapshot;
+};
+
+}  // namespace kvs
+
+#endif  // INCLUDE_ITERATOR_H
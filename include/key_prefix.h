@@ -0,0 +1,49 @@
+#pragma once
+#ifndef INCLUDE_KEY_PREFIX_H
+#define INCLUDE_KEY_PREFIX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace kvs
+{
+/*
+ * The first 8 bytes of key, big-endian and zero padded, with the sign bit
+ * flipped: comparing two prefixes as signed integers orders them like
+ * memcmp() orders the keys, but for keys which agree on 8 bytes (or only
+ * differ in trailing zero padding), where the full keys decide.
+ */
+inline int64_t key_prefix(std::string_view key)
+{
+    uint64_t v = 0;
+    memcpy(&v, key.data(), key.size() < 8 ? key.size() : 8);
+    return (int64_t)(__builtin_bswap64(v) ^ (1ull << 63));
+}
+
+namespace prefix
+{
+/*
+ * how many of the n prefixes in a are < p, and how many are <= p.
+ * count() picks the widest implementation of the host once:
+ *   avx2:      4 prefixes per compare
+ *   sse4.2:    2 prefixes per compare
+ *   otherwise: one at a time
+ * a may be changing under a lock-free reader: the counts are then garbage,
+ * but less <= less_equal <= n still holds.
+ */
+void count(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal);
+
+bool has_sse42();
+bool has_avx2();
+
+// the implementations behind count(), exposed for tests and benchmarks
+void count_portable(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal);
+void count_sse42(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal);
+void count_avx2(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal);
+
+}  // namespace prefix
+}  // namespace kvs
+
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+#ifndef INCLUDE_LOG_FORMAT_H
+#define INCLUDE_LOG_FORMAT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "conf.h"
+#include "crc32c.h"
+
+namespace kvs
+{
+/*
+ * A log record:
+ * | crc (4) | version (1) | type (1) | reserved (2) | key size (4) | value size (4) | key | value |
+ * crc is the crc32c of everything behind it, from version to the end of
+ * value, so a torn or garbage record is told apart from a real one.
+ */
+enum RecordType : uint8_t
+{
+    kTypeDeletion = 0,
+    kTypeValue = 1,
+};
+
+static constexpr uint8_t kRecordVersion = 1;
+
+struct RecordHeader
+{
+    uint32_t crc;
+    uint8_t version;
+    uint8_t type;
+    uint16_t reserved;
+    uint32_t key_size;
+    uint32_t value_size;
+
+    // value == nullptr for a deletion
+    void encode(const std::string &key, const std::string *value)
+    {
+        version = kRecordVersion;
+        type = value ? kTypeValue : kTypeDeletion;
+        reserved = 0;
+        key_size = key.size();
+        value_size = value ? value->size() : 0;
+        crc = compute_crc(key.data(), value ? value->data() : nullptr);
+    }
+
+    // sanity of the fields, before trusting the sizes for a read
+    bool plausible() const
+    {
+        return version == kRecordVersion && type <= kTypeValue &&
+               key_size <= kMaxKeySize && value_size <= kMaxValueSize &&
+               (type == kTypeValue || value_size == 0);
+    }
+
+    uint32_t compute_crc(const char *key, const char *value) const
+    {
+        uint32_t c = crc32c::value((const char *) this + sizeof(crc),
+                                   sizeof(RecordHeader) - sizeof(crc));
+        c = crc32c::extend(c, key, key_size);
+        return crc32c::extend(c, value, value_size);
+    }
+
+    size_t record_size() const
+    {
+        return sizeof(RecordHeader) + key_size + value_size;
+    }
+};
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader must be packed");
+
+/*
+ * Where a record lives, as kept in the index:
+ * | segment id (20) | offset in the segment (28) | value size (16) |
+ * With the value size at hand a get reads the whole record, whose key it
+ * already knows, with a single pread.
+ */
+using Locator = uint64_t;
+
+static constexpr int kLocatorOffsetBits = 28;
+static constexpr int kLocatorSizeBits = 16;
+// all ones is the "not found" of the btree, so the last id stays unused
+static constexpr uint32_t kMaxSegmentId = (1u << (64 - kLocatorOffsetBits - kLocatorSizeBits)) - 2;
+static constexpr size_t kMaxSegmentOffset = (1ull << kLocatorOffsetBits) - 1;
+static_assert(kMaxValueSize < (1ull << kLocatorSizeBits), "value size does not fit a Locator");
+
+inline Locator make_locator(uint32_t segment, uint64_t offset, uint32_t value_size)
+{
+    return (Locator) segment << (kLocatorOffsetBits + kLocatorSizeBits) |
+           offset << kLocatorSizeBits | value_size;
+}
+inline uint32_t locator_segment(Locator loc)
+{
+    return loc >> (kLocatorOffsetBits + kLocatorSizeBits);
+}
+inline uint64_t locator_offset(Locator loc)
+{
+    return (loc >> kLocatorSizeBits) & kMaxSegmentOffset;
+}
+inline uint32_t locator_value_size(Locator loc)
+{
+    return loc & ((1u << kLocatorSizeBits) - 1);
+}
+// the size of the whole record at loc, of a key key_size long
+inline size_t locator_record_size(Locator loc, size_t key_size)
+{
+    return sizeof(RecordHeader) + key_size + locator_value_size(loc);
+}
+
+}  // namespace kvs
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#ifndef INCLUDE_MANIFEST_H
+#define INCLUDE_MANIFEST_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "log_format.h"
+
+namespace kvs
+{
+using SegmentId = uint32_t;
+
+/*
+ * The log is a chain of numbered segment files, "log.000001", ...
+ * The manifest lists the live ones in log order: replaying them front to
+ * back rebuilds the index. The last one is the active segment taking the
+ * appends, all the others are sealed and never written again.
+ *
+ * The manifest is small and replaced as a whole: it is written to
+ * MANIFEST.tmp, synced and renamed over MANIFEST, so a crash leaves either
+ * the old or the new list. Segment files not in the list are leftovers of
+ * an interrupted rotation or gc, and are removed by the next open.
+ */
+class Manifest
+{
+public:
+    explicit Manifest(const std::string &dir);
+
+    // false if the directory has no manifest yet
+    bool load();
+    void save();
+
+    const std::vector<SegmentId> &segments() const { return _segments; }
+    void set_segments(const std::vector<SegmentId> &segments) { _segments = segments; }
+    void add_segment(SegmentId id) { _segments.push_back(id); }
+    SegmentId active_segment() const { return _segments.back(); }
+
+    /*
+     * ids count up to kMaxSegmentId and wrap around, skipping the live
+     * segments and any segment file still on disk
+     */
+    SegmentId allocate_id();
+
+    static std::string segment_name(SegmentId id);
+    // true and the id if name is the one of a segment file
+    static bool parse_segment_name(const std::string &name, SegmentId &id);
+
+    // unlink the segment files of dir which are not in the manifest
+    void remove_orphans() const;
+
+private:
+    std::string _dir;
+    std::vector<SegmentId> _segments;
+    SegmentId _next_id;
+};
+
+}  // namespace kvs
+
+#endif
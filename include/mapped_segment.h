@@ -0,0 +1,75 @@
+#pragma once
+#ifndef INCLUDE_MAPPED_SEGMENT_H
+#define INCLUDE_MAPPED_SEGMENT_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace kvs
+{
+/*
+ * A sealed log segment mapped read-only, so a record is decoded in place
+ * with no syscall. The mapping is MADV_RANDOM, so a point read faults in
+ * single pages; a reader which knows what it needs next (a scan, a batch
+ * of gets) asks for it with will_need().
+ *
+ * Only sealed segments are mapped: they never change size or content.
+ */
+class MappedSegment
+{
+public:
+    // nullptr (and a warning) if the file cannot be mapped
+    static std::shared_ptr<MappedSegment> map(const std::string &filename);
+
+    ~MappedSegment();
+    MappedSegment(const MappedSegment &) = delete;
+    MappedSegment &operator=(const MappedSegment &) = delete;
+
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+    // have the kernel read [offset, offset + length) in, without waiting for it
+    void will_need(size_t offset, size_t length) const;
+
+private:
+    MappedSegment(char *data, size_t size) : _data(data), _size(size) { }
+
+    char *_data;
+    size_t _size;
+};
+
+/*
+ * A value handed out without copying it: it points into the mapping of
+ * a sealed segment and keeps that mapping alive, even if gc drops the
+ * segment in the meantime. A value from the active segment, which is not
+ * mapped, is read into the view's own buffer instead.
+ */
+class ValueView
+{
+public:
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+    std::string_view view() const { return std::string_view(_data, _size); }
+    std::string to_string() const { return std::string(_data, _size); }
+
+    void clear()
+    {
+        _pin.reset();
+        _buf.clear();
+        _data = nullptr;
+        _size = 0;
+    }
+
+private:
+    friend class Engine;
+
+    std::shared_ptr<const MappedSegment> _pin;
+    std::string _buf;
+    const char *_data{nullptr};
+    size_t _size{0};
+};
+
+}  // namespace kvs
+
+#endif
@@ -4,6 +4,7 @@
 
 #include <fcntl.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <array>
@@ -121,6 +122,20 @@ public:
             return ret;
         }
     }
+    ssize_t writev(const struct iovec *iov, int iovcnt)
+    {
+        ssize_t total = 0;
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            auto ret = write(iov[i].iov_base, iov[i].iov_len);
+            if (ret < 0)
+            {
+                return total > 0 ? total : ret;
+            }
+            total += ret;
+        }
+        return total;
+    }
     ssize_t read(void *buf, size_t count)
     {
         std::lock_guard<std::mutex> lk(*mu_);
@@ -143,6 +158,50 @@ public:
             return ret;
         }
     }
+    ssize_t pread(void *buf, size_t count, off_t offset) const
+    {
+        std::lock_guard<std::mutex> lk(*mu_);
+
+        if (fd_ <= 0 || closed_)
+        {
+            errno = EBADF;
+            return -1;
+        }
+        return file_storage_->read(offset, (char *) buf, count);
+    }
+    ssize_t preadv(const struct iovec *iov, int iovcnt, off_t offset) const
+    {
+        ssize_t total = 0;
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            auto ret = pread(iov[i].iov_base, iov[i].iov_len, offset + total);
+            if (ret < 0)
+            {
+                return total > 0 ? total : ret;
+            }
+            total += ret;
+            if ((size_t) ret < iov[i].iov_len)
+            {
+                break;
+            }
+        }
+        return total;
+    }
+    int fsync()
+    {
+        std::lock_guard<std::mutex> lk(*mu_);
+
+        if (fd_ <= 0 || closed_)
+        {
+            errno = EBADF;
+            return -1;
+        }
+        return file_storage_->fsync();
+    }
+    int fdatasync()
+    {
+        return fsync();
+    }
     // TODO: what is the behavor of lseek to o_append file?
     off_t lseek(off_t offset, int whence)
     {
@@ -2,10 +2,80 @@
 #ifndef INCLUDE_OPTIONS_H
 #define INCLUDE_OPTIONS_H
 
+#include <cstddef>
+
 namespace kvs
 {
+/**
+ * When does a put/remove become durable?
+ */
+enum class Durability
+{
+    // put/remove return only after their record is fdatasync()ed
+    kSyncEveryWrite,
+    // a background flusher fdatasync()s the log every sync_interval_ms,
+    // or as soon as sync_interval_bytes have been written since the last one
+    kSyncInterval,
+    // the records sit in the OS page cache until someone calls sync()
+    kOsBuffered,
+};
+
 struct EngineOptions
 {
+    Durability durability{Durability::kOsBuffered};
+    size_t sync_interval_ms{100};
+    size_t sync_interval_bytes{4 * 1024 * 1024};
+
+    // the active log segment is sealed and a new one started once it
+    // grows past this; sealed segments are immutable
+    size_t segment_size{64 * 1024 * 1024};
+
+    // budget of the cache of hot values in front of the log, 0 to disable;
+    // values over value_cache_bypass_size are never cached
+    size_t value_cache_bytes{0};
+    size_t value_cache_bypass_size{8 * 1024};
+
+    // map the nodes and keys of the index on 2 MB huge pages (see Slab):
+    // fewer TLB misses on lookups, but every chunk touched is resident
+    bool index_huge_pages{false};
+
+    // write a checkpoint of the index (see IndexCheckpoint) on close,
+    // after gc, and in the background once a sync() finds
+    // checkpoint_interval_bytes were logged since the last one (0: never
+    // for a sync()). A restart then loads it and replays the log past it
+    // only.
+    bool index_checkpoint{true};
+    size_t checkpoint_interval_bytes{1024 * 1024 * 1024};
+
+    // automatic gc: once the log takes more than gc_space_amplification
+    // times the bytes of its live records (and holds a segment's worth of
+    // garbage), the sealed segments with at least gc_garbage_ratio of
+    // garbage are compacted, and more, most garbage first, until the log
+    // is back under the limit. 0 to gc on garbage_collect() only.
+    double gc_space_amplification{2.0};
+    double gc_garbage_ratio{0.5};
+
+    // a full gc (garbage_collect()) writes the live records in key order:
+    // the log starts with a sorted, key-clustered base, and the writes
+    // since make an unsorted tail. A visit() over the base reads long runs
+    // with readahead instead of a record here and there. Otherwise (and
+    // always for the automatic gc) the records keep their log order.
+    bool gc_cluster_keys{true};
+
+    // multi_get() asks the kernel for the pages of all the records it
+    // reads from sealed segments (madvise WILLNEED) before it copies the
+    // first: the reads reach the device together rather than one fault at
+    // a time. A win when they are mostly not in the page cache, a syscall
+    // per run of records for nothing when they are.
+    bool multi_get_prefetch{false};
+
+    // threads decoding log segments and sorting the index on open,
+    // 0 for one per core
+    size_t recovery_threads{0};
+
+    // check the crc32c of every record read by get/visit;
+    // recovery always checks them
+    bool verify_checksums{false};
 };
 }  // namespace kvs
-#endif
\ No newline at end of file
+#endif
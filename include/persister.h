@@ -3,6 +3,7 @@
 #define INCLUDE_PERSISTER_H
 
 #include <fcntl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <iostream>
@@ -26,10 +27,30 @@ public:
     {
         return ::write(fd_, buf, count);
     }
+    ssize_t writev(const struct iovec *iov, int iovcnt)
+    {
+        return ::writev(fd_, iov, iovcnt);
+    }
     ssize_t read(void *buf, size_t count)
     {
         return ::read(fd_, buf, count);
     }
+    ssize_t pread(void *buf, size_t count, off_t offset) const
+    {
+        return ::pread(fd_, buf, count, offset);
+    }
+    ssize_t preadv(const struct iovec *iov, int iovcnt, off_t offset) const
+    {
+        return ::preadv(fd_, iov, iovcnt, offset);
+    }
+    int fsync()
+    {
+        return ::fsync(fd_);
+    }
+    int fdatasync()
+    {
+        return ::fdatasync(fd_);
+    }
     off_t lseek(off_t offset, int whence)
     {
         return ::lseek(fd_, offset, whence);
@@ -71,7 +92,7 @@ public:
         int flag = O_RDWR;
         if (o_append)
         {
-            flag |= O_CREAT;
+            flag |= O_CREAT | O_APPEND;
         }
         if (o_trunc)
         {
@@ -0,0 +1,66 @@
+#pragma once
+#ifndef INCLUDE_SNAPSHOT_H
+#define INCLUDE_SNAPSHOT_H
+
+#include <memory>
+#include <string>
+
+#include "engine.h"
+#include "interfaces.h"
+
+namespace kvs
+{
+/*
+ * A point-in-time view of an Engine, from Engine::snapshot().
+ *
+ * It shares the index with the engine: a key is looked up there, then in
+ * the undo logs of the generations from the snapshot's own on, the first
+ * of which to know the key tells where it was when the snapshot was
+ * taken. The index is read first: a write logs the old place before it
+ * changes the index, so whatever the index showed is either still true
+ * or logged by then.
+ *
+ * Reads take no engine lock, only an EpochGuard. The records the undo
+ * logs point to stay on disk while the snapshot lives, see Engine::_pins.
+ */
+class Snapshot : public IROEngine, public std::enable_shared_from_this<Snapshot>
+{
+public:
+    Snapshot(std::shared_ptr<Engine> engine, std::shared_ptr<Engine::Generation> generation) :
+        _engine(std::move(engine)), _generation(std::move(generation))
+    { }
+    ~Snapshot() override;
+
+    RetCode get(const Key &key, Value &value) override;
+
+    // as Engine's, a batch of collect() at a time
+    RetCode visit(const Key &lower, const Key &upper, const Visitor &visitor) override;
+    RetCode visit_keys(const Key &lower, const Key &upper, const KeyVisitor &visitor) override;
+    RetCode visit_lazy(const Key &lower, const Key &upper, const LazyVisitor &visitor) override;
+
+    std::unique_ptr<Iterator> new_iterator() override;
+
+private:
+    std::shared_ptr<Engine> _engine;
+    std::shared_ptr<Engine::Generation> _generation;
+
+    // where key was, Index::kNotFound if nowhere; caller holds an EpochGuard
+    Locator find(const Key &key) const;
+    /*
+     * caller holds an EpochGuard: the keys from from on, as IndexIterator::fill,
+     * with where they were: a batch of keys of the index merged with the
+     * undo logs over the same range, and more until there is one at least.
+     */
+    void collect(const Key &from, bool exclusive, bool reverse, std::vector<std::pair<Key, Locator>> &entries) const;
+    // each key of [lower, upper] with where it was, until f fails; f runs under an EpochGuard
+    using EntryVisitor = std::function<RetCode(const Key &, Locator)>;
+    RetCode scan(const Key &lower, const Key &upper, const EntryVisitor &f) const;
+    // the value at loc of key as found by find(), which may have moved since; caller holds an EpochGuard
+    RetCode read(const Key &key, Locator loc, Value &value, bool scan) const;
+
+    friend class SnapshotIterator;
+};
+
+}  // namespace kvs
+
+#endif  // INCLUDE_SNAPSHOT_H
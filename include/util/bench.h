@@ -300,6 +300,12 @@ public:
         return ret;
     }
 
+    // keys put by someone else, e.g. a warmup, for the ops to hit
+    void add_inserted_keys(const std::vector<Key> &keys)
+    {
+        inserted_keys_.insert(keys.begin(), keys.end());
+    }
+
     // clone and inherit the inserted_keys
     BenchGenerator clone(const std::vector<OpConfig> &op_conf)
     {
@@ -158,6 +158,14 @@ private:
     kvs::IROEngine::Pointer engine_;
 };
 
+// what a kVisit reads in EngineValidator::execute
+enum class VisitMode
+{
+    kValues,  // visit(): every value
+    kKeys,    // visit_keys(): none
+    kLazy,    // visit_lazy(): one value in lazy_fetch_every
+};
+
 class EngineValidator
 {
 public:
@@ -169,6 +177,12 @@ public:
         : engine_(engine), kv_(kv)
     {
     }
+    void set_visit_mode(VisitMode mode, size_t lazy_fetch_every = 1)
+    {
+        CHECK_GE(lazy_fetch_every, 1);
+        visit_mode_ = mode;
+        lazy_fetch_every_ = lazy_fetch_every;
+    }
     void execute(const std::vector<TestCase> &bench,
                  size_t from_idx = 0,
                  size_t limit = std::numeric_limits<size_t>::max())
@@ -217,8 +231,7 @@ public:
             }
             case Op::kVisit:
             {
-                engine_->visit(
-                    c.lower, c.upper, [](const Key &, const Value &) {});
+                execute_visit(c);
                 break;
             }
             case Op::kNoOp:
@@ -296,9 +309,50 @@ public:
     }
 
 private:
+    void execute_visit(const TestCase &c)
+    {
+        switch (visit_mode_)
+        {
+        case VisitMode::kValues:
+        {
+            auto ret = engine_->visit(
+                c.lower, c.upper, [](const Key &, const Value &) {});
+            CHECK_EQ(ret, kvs::kSucc);
+            break;
+        }
+        case VisitMode::kKeys:
+        {
+            auto ret = engine_->visit_keys(c.lower, c.upper, [](const Key &) {});
+            CHECK_EQ(ret, kvs::kSucc);
+            break;
+        }
+        case VisitMode::kLazy:
+        {
+            size_t i = 0;
+            std::string value;
+            auto ret = engine_->visit_lazy(
+                c.lower,
+                c.upper,
+                [this, &i, &value](const Key &, kvs::IROEngine::LazyValue &v)
+                {
+                    if (i++ % lazy_fetch_every_ != 0)
+                    {
+                        return;
+                    }
+                    auto r = v.get(value);
+                    CHECK(r == kvs::kSucc || r == kvs::kNotFound);
+                });
+            CHECK_EQ(ret, kvs::kSucc);
+            break;
+        }
+        }
+    }
+
     kvs::IEngine::Pointer engine_;
 
     std::map<Key, Value> kv_;
+    VisitMode visit_mode_{VisitMode::kValues};
+    size_t lazy_fetch_every_{1};
 };
 
 }  // namespace bench
\ No newline at end of file
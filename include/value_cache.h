@@ -0,0 +1,74 @@
+#pragma once
+#ifndef INCLUDE_VALUE_CACHE_H
+#define INCLUDE_VALUE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kvs
+{
+/*
+ * A byte-budgeted cache of values in front of the log, for the hot keys of
+ * a skewed workload.
+ *
+ * It is split into shards by key hash, each with its own lock. A shard
+ * evicts with CLOCK, and admits with TinyLFU: a count-min sketch tracks how
+ * often each key was asked for recently, and a new value only displaces the
+ * CLOCK victim if its key is asked for more often. A scan of cold keys
+ * therefore leaves the hot ones alone. Values larger than bypass_size are
+ * never cached.
+ */
+class ValueCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits{0};
+        uint64_t misses{0};
+        uint64_t admitted{0};
+        uint64_t rejected{0};  // by the admission filter
+        size_t bytes{0};
+        size_t entries{0};
+
+        double hit_rate() const
+        {
+            return hits + misses == 0 ? 0 : 1.0 * hits / (hits + misses);
+        }
+    };
+
+    ValueCache(size_t capacity, size_t bypass_size, size_t shard_nr = 16);
+    ~ValueCache();
+
+    // true and a copy of the value if key is cached
+    bool lookup(const std::string &key, std::string &value);
+    /*
+     * offer a value read from the log, subject to admission: it goes in
+     * only if current() still holds under the lock of the shard. A writer
+     * changes the index before it calls update() or erase(), which take
+     * that lock: a value which lost to a write either is refused here, or
+     * is overwritten by the write's own update().
+     */
+    void insert(const std::string &key, const std::string &value, const std::function<bool()> &current);
+    // a write of key: refresh its value if it is cached
+    void update(const std::string &key, const std::string &value);
+    void erase(const std::string &key);
+
+    Stats stats() const;
+
+private:
+    class Shard;
+    Shard &shard(uint64_t hash) { return *_shards[hash & (_shards.size() - 1)]; }
+
+    std::vector<std::unique_ptr<Shard>> _shards;
+    size_t _bypass_size;
+};
+
+}  // namespace kvs
+
+#endif
@@ -0,0 +1,120 @@
+#include "arena.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace kvs
+{
+Slab::Slab(size_t block_size, bool huge_pages) :
+    _block_size((std::max(block_size, sizeof(FreeBlock)) + 7) & ~(size_t)7),
+    _huge_pages(huge_pages)
+{
+    CHECK_LE(_block_size, kChunkSize - kHeaderSize);
+}
+
+Slab::~Slab()
+{
+    for (void *chunk : _chunks) munmap(chunk, kChunkSize);
+}
+
+void Slab::new_chunk()
+{
+    // twice the size, to cut an aligned chunk out of it
+    char *p = (char *)mmap(nullptr, 2 * kChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) LOG(FATAL) << "cannot map a slab chunk, errno: " << errno;
+    char *chunk = (char *)(((uintptr_t)p + kChunkSize - 1) & ~(uintptr_t)(kChunkSize - 1));
+    if (chunk > p) munmap(p, chunk - p);
+    if (chunk + kChunkSize < p + 2 * kChunkSize) munmap(chunk + kChunkSize, p + 2 * kChunkSize - chunk - kChunkSize);
+#ifdef MADV_HUGEPAGE
+    if (_huge_pages && madvise(chunk, kChunkSize, MADV_HUGEPAGE) != 0) {
+        LOG(WARNING) << "no huge pages for the slab, errno: " << errno;
+    }
+#endif
+
+    reinterpret_cast<Chunk *>(chunk)->owner = this;
+    _chunks.push_back(chunk);
+    _bump = chunk + kHeaderSize;
+    _end = chunk + kChunkSize;
+}
+
+void *Slab::allocate()
+{
+    if (_free == nullptr) _free = _released.exchange(nullptr, std::memory_order_acquire);
+    if (_free != nullptr) {
+        FreeBlock *b = _free;
+        _free = b->next;
+        return b;
+    }
+    if (_bump == nullptr || _bump + _block_size > _end) new_chunk();
+    void *p = _bump;
+    _bump += _block_size;
+    return p;
+}
+
+void Slab::release(void *p)
+{
+    Chunk *chunk = reinterpret_cast<Chunk *>((uintptr_t)p & ~(uintptr_t)(kChunkSize - 1));
+    Slab *slab = chunk->owner;
+    FreeBlock *b = static_cast<FreeBlock *>(p);
+    // no ABA: blocks only leave the list all together
+    b->next = slab->_released.load(std::memory_order_relaxed);
+    while (!slab->_released.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+KeyArena::KeyArena(bool huge_pages) : _huge_pages(huge_pages) { }
+
+// a long key: the arena, then the ArenaKey
+struct LongKey {
+    KeyArena *arena;
+    size_t bytes;
+};
+
+const ArenaKey *KeyArena::make(std::string_view key)
+{
+    ArenaKey *k;
+    if (key.size() <= kMaxSlabKey) {
+        std::unique_ptr<Slab> &slab = _slabs[size_class(key.size())];
+        if (!slab) slab.reset(new Slab((size_class(key.size()) + 1) * kClassStep, _huge_pages));
+        k = static_cast<ArenaKey *>(slab->allocate());
+    }
+    else {
+        size_t bytes = sizeof(LongKey) + sizeof(ArenaKey) + key.size();
+        LongKey *l = static_cast<LongKey *>(malloc(bytes));
+        if (l == nullptr) LOG(FATAL) << "cannot allocate a key of " << key.size() << " bytes";
+        l->arena = this;
+        l->bytes = bytes;
+        _long_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        k = reinterpret_cast<ArenaKey *>(l + 1);
+    }
+    k->size = key.size();
+    memcpy(k + 1, key.data(), key.size());
+    return k;
+}
+
+void KeyArena::release(const ArenaKey *key)
+{
+    if (key->size <= kMaxSlabKey) {
+        Slab::release(const_cast<ArenaKey *>(key));
+        return;
+    }
+    LongKey *l = reinterpret_cast<LongKey *>(const_cast<ArenaKey *>(key)) - 1;
+    l->arena->_long_bytes.fetch_sub(l->bytes, std::memory_order_relaxed);
+    free(l);
+}
+
+size_t KeyArena::bytes() const
+{
+    size_t bytes = _long_bytes.load(std::memory_order_relaxed);
+    for (auto &slab : _slabs) {
+        if (slab) bytes += slab->bytes();
+    }
+    return bytes;
+}
+
+}  // namespace kvs
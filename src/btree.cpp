@@ -2,609 +2,904 @@
 
 namespace kvs
 {
-BTree::BTree() :
-    _size(0), _root(new BNode(nullptr, true))
+// the version word of a node
+static constexpr uint64_t kLocked = 1;
+static constexpr uint64_t kObsolete = 2;
+static constexpr uint64_t kVersionStep = 4;
+
+// a field the writer may be changing while a reader looks at it
+template <typename T>
+static inline T racy(const T& x)
 {
-    _root->child.emplace_back(nullptr);
-    _tmp_idx.resize(M);
+    return __atomic_load_n(&x, __ATOMIC_RELAXED);
 }
 
-BTree::~BTree()
+static inline bool read_lock(const std::atomic<uint64_t>& version, uint64_t& v)
 {
-    _root->delete_child();
-    delete _root;
+    v = version.load(std::memory_order_acquire);
+    return (v & (kLocked | kObsolete)) == 0;
 }
 
-size_t BTree::search(const Key& key, BNode*& _hot, std::vector<size_t>& _hot_idx) 
+// nothing changed since read_lock() returned v
+static inline bool validate(const std::atomic<uint64_t>& version, uint64_t v)
 {
-    // LOG(INFO) << "===== search key: " << key;
-    BNode* v = _root;
-    _hot_idx.reserve(1024);
-    while (v) {
-        auto _v_beg = v->key.begin();
-        auto _v_end = v->key.end();
-        auto _hot_iter = upper_bound(_v_beg, _v_end, key);  // return the first el > key
-        size_t tmp_idx = _hot_iter - _v_beg;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == v;
+}
 
-        _hot = v;
-        v = v->child[tmp_idx];
-        
-        _hot_idx.emplace_back(tmp_idx);
+/*
+ * the index of the first of the count keys which is > key (>= key unless
+ * upper), p being key_prefix(key). Only keys with the same prefix as key
+ * are looked at, so mostly none. Read racily: false if an empty slot shows
+ * up, the node is changing.
+ */
+static bool bound(const int64_t* prefixes, const ArenaKey* const* keys, size_t count,
+                  std::string_view key, int64_t p, bool upper, size_t& idx)
+{
+    size_t lo, hi;
+    prefix::count(prefixes, count, p, lo, hi);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const ArenaKey* k = racy(keys[mid]);
+        if (k == nullptr) return false;
+        int c = k->view().compare(key);
+        if (upper ? c > 0 : c >= 0) hi = mid;
+        else lo = mid + 1;
     }
+    idx = lo;
+    return true;
+}
 
-    if (_hot_idx.back() > 0 && _hot->key[_hot_idx.back() - 1] == key) {
-        _hot_idx.back() -= 1;  // for leaf idx, return the first el == key.
-        size_t index = _hot->data[_hot_idx.back()];
-        // LOG(INFO) << "find (key, data): " << key << ", " << index;
-        return index;  // find the key
-    }
-    else {
-        // LOG(INFO) << "not found";
-        return (size_t)-1;
-    }
+template <size_t Fanout>
+BTree<Fanout>::BTree(bool huge_pages) :
+    _memory(new Memory(huge_pages)), _root(nullptr), _size(0)
+{
+    _root.store(new_leaf());
+    _locked.reserve(4 * kMaxDepth);
+    _unlinked.reserve(2 * kMaxDepth);
+    _dropped_keys.reserve(2 * kMaxDepth);
 }
 
-size_t BTree::search(const Key& key) {
-    BNode* _hot = nullptr;
-    std::vector<size_t> _hot_idx;
-    return search(key, _hot, _hot_idx);
+template <size_t Fanout>
+BTree<Fanout>::~BTree()
+{
+    delete_node(_root.load());
+    EpochManager::global().retire(_memory);
 }
 
-/*
- * return 1: key not exist, insert success!
- * return 0: key exist, modify success!
- * return -1: error 
- */
-int BTree::insert(const Key &key, const size_t data)
-{
-    BNode* _hot = nullptr;
-    std::vector<size_t> _hot_idx;
-    size_t _find = search(key, _hot, _hot_idx);
-    if (_hot == nullptr) {  // 
-        LOG(FATAL) << "b+tree's root is nullptr";
-    }
-    
-    // std::string log_out("===== [");
-    // for (auto iter = _hot->key.begin(); iter != _hot->key.end(); iter++) {
-    //     log_out.append(iter->data());
-    //     log_out.append(", ");
-    // }
-    // log_out.append("] begin to insert: ");
-    // LOG(INFO) << log_out << key << ", " << data;
-    if (_find == (size_t)-1) {
-        if (!_hot->is_full()) {
-            size_t lf_idx = _hot_idx.back();
-            _hot->key.emplace(_hot->key.begin() + lf_idx, key);
-            _hot->data.emplace(_hot->data.begin() + lf_idx, data);
-            _hot->child.emplace_back(nullptr);
-        }
-        else {
-            solve_overflow_leaf(key, data, _hot, _hot_idx);
-        }
-        _size += 1;
-        // show_tree();
-        return 1;
-    }
-    else {
-        // modify
-        _hot->data[_hot_idx.back()] = data;
-        // show_tree();
-        return 0;
+template <size_t Fanout>
+typename BTree<Fanout>::Leaf* BTree<Fanout>::new_leaf()
+{
+    return new (_memory->leaves.allocate()) Leaf();
+}
+
+template <size_t Fanout>
+typename BTree<Fanout>::Inner* BTree<Fanout>::new_inner()
+{
+    return new (_memory->inners.allocate()) Inner();
+}
+
+template <size_t Fanout>
+void BTree<Fanout>::delete_node(Node* v)
+{
+    for (size_t i = 0; i < v->count; i++) KeyArena::release(v->key[i]);
+    if (!v->is_leaf) {
+        Inner* in = static_cast<Inner*>(v);
+        for (size_t i = 0; i <= in->count; i++) delete_node(in->child[i]);
     }
+    // nodes are trivially destructible
+    Slab::release(v);
 }
 
 /*
- * return 1: key exist, remove success!
- * return 0: key not found, remove failed!
- * return -1: error 
+ * the leaf where key belongs (the last leaf if last), read-locked at
+ * version; nullptr if the way down changed under us
  */
-int BTree::remove(const Key &key)
+template <size_t Fanout>
+const typename BTree<Fanout>::Leaf* BTree<Fanout>::find_leaf(std::string_view key, uint64_t& version,
+                                                             bool last) const
 {
-    BNode* _hot = nullptr;
-    std::vector<size_t> _hot_idx;
-    size_t _find = search(key, _hot, _hot_idx);
-    if (_find == (size_t)-1) {
-        return 0;
-    }
-    else {
-        // remove the key
-        // std::string log_out("===== [");
-        // for (auto iter = _hot->key.begin(); iter != _hot->key.end(); iter++) {
-        //     log_out.append(iter->data());
-        //     log_out.append(", ");
-        // }
-        // log_out.append("] begin to remove: ");
-        // LOG(INFO) << log_out << key;
-        size_t lf_idx = _hot_idx.back();
-        if (_hot != _root && _hot->key.size() <= ((M + 1) / 2) - 1) {
-            solve_underflow_leaf(_hot, _hot_idx);
-        }
-        else {
-            _hot->key.erase(_hot->key.begin() + lf_idx);
-            _hot->data.erase(_hot->data.begin() + lf_idx);
-            _hot->child.pop_back();
-            // update parent (not neccesary)
-            if (_hot != _root && lf_idx == 0) {
-                size_t pa_idx = _hot_idx[_hot_idx.size() - 2];
-                if (pa_idx > 0)
-                    _hot->parent->key[pa_idx - 1] = _hot->key.front();
-            }
-        }
-        _size -= 1;
-        // show_tree();
-        return 1;
+    int64_t p = key_prefix(key);
+    const Node* v = _root.load(std::memory_order_acquire);
+    uint64_t ver;
+    if (!read_lock(v->version, ver) || v != _root.load(std::memory_order_acquire)) return nullptr;
+
+    while (!v->is_leaf) {
+        const Inner* in = static_cast<const Inner*>(v);
+        size_t idx = std::min(racy(in->count), kMaxKeys);
+        if (!last && !bound(in->prefix, in->key, idx, key, p, true, idx)) return nullptr;
+        const Node* c = racy(in->child[idx]);
+        if (!validate(in->version, ver) || c == nullptr) return nullptr;
+
+        uint64_t child_ver;
+        if (!read_lock(c->version, child_ver)) return nullptr;
+        // in did not change before c was locked: c is still the right child
+        if (!validate(in->version, ver)) return nullptr;
+        v = c;
+        ver = child_ver;
     }
+    version = ver;
+    return static_cast<const Leaf*>(v);
 }
 
+template <size_t Fanout>
+bool BTree<Fanout>::copy_leaf(const Leaf* leaf, uint64_t version, LeafCopy& copy)
+{
+    copy.count = std::min(racy(leaf->count), kMaxKeys);
+    for (size_t i = 0; i < copy.count; i++) {
+        copy.key[i] = racy(leaf->key[i]);
+        copy.data[i] = racy(leaf->data[i]);
+    }
+    copy.next = racy(leaf->next);
+    copy.prev = racy(leaf->prev);
+    return validate(leaf->version, version);
+}
 
-void BTree::solve_overflow_leaf(const Key& key, const size_t data, BNode*& _hot, std::vector<size_t>& _hot_idx)
+template <size_t Fanout>
+size_t BTree<Fanout>::search(const Key& key) const
 {
-    // LOG(INFO) << "=============== begin solve_overflow_leaf";
-    size_t lf_idx = _hot_idx[_hot_idx.size() - 1];
-    if (_hot->prev && _hot->parent == _hot->prev->parent && !_hot->prev->is_full()) {  // not root, not leftmost node, must be leaf
-        // LOG(INFO) << "rotate 1";
-        // give out a child from _hot to _hot->prev
-        _hot->prev->key.emplace_back(_hot->key.front().c_str());
-        _hot->prev->data.emplace_back(_hot->data.front());
-        _hot->prev->child.emplace_back(nullptr);
+    EpochGuard guard;
+    for (;;) {
+        uint64_t ver;
+        const Leaf* v = find_leaf(key, ver);
+        if (v == nullptr) continue;
+
+        size_t count = std::min(racy(v->count), kMaxKeys);
+        size_t idx;
+        if (!bound(v->prefix, v->key, count, key, key_prefix(key), false, idx)) continue;
+        size_t data = kNotFound;
+        if (idx < count) {
+            const ArenaKey* k = racy(v->key[idx]);
+            if (k == nullptr) continue;
+            if (k->view() == key) data = racy(v->data[idx]);
+        }
+        if (validate(v->version, ver)) return data;
+    }
+}
 
-        // insert the key and data into _hot
-        for (size_t i = 0; i < lf_idx - 1; i++) {
-            _hot->key[i] = _hot->key[i + 1];
-            _hot->data[i] = _hot->data[i + 1];
-        }
-        _hot->key[lf_idx - 1] = key;
-        _hot->data[lf_idx - 1] = data;
-
-        // update parent's key
-        size_t pa_idx = _hot_idx[_hot_idx.size() - 2];
-        _hot->parent->key[pa_idx - 1] = _hot->key.front();
-
-        // show_tree();
-    }
-    else if (_hot->next && _hot->parent == _hot->next->parent && !_hot->next->is_full()) {  // not root, not rightmost node, must be leaf
-        // LOG(INFO) << "rotate 2";
-        size_t pa_idx = _hot_idx[_hot_idx.size() - 2];
-        if (lf_idx == _hot->key.size()) {
-            // directly insert to _hot->next
-            _hot->next->key.emplace(_hot->next->key.begin(), key.c_str());
-            _hot->next->data.emplace(_hot->next->data.begin(), data);
-            _hot->next->child.emplace_back(nullptr);
-
-            // update parent's key
-            _hot->parent->key[pa_idx] = key;
-        }
-        else {
-            // give out a child from _hot to _hot->next
-            _hot->next->key.emplace(_hot->next->key.begin(), _hot->key.back().c_str());
-            _hot->next->data.emplace(_hot->next->data.begin(), _hot->data.back());
-            _hot->next->child.emplace_back(nullptr);
-
-            // update parent's key
-            _hot->parent->key[pa_idx] = _hot->key.back();
-
-            // insert the key and data into _hot
-            for (size_t i = _hot->key.size() - 1; i > lf_idx; i--) {
-                _hot->key[i] = _hot->key[i - 1];
-                _hot->data[i] = _hot->data[i - 1];
+template <size_t Fanout>
+void BTree<Fanout>::search_sorted(const std::string_view* keys, size_t n, size_t* data) const
+{
+    EpochGuard guard;
+    const Leaf* v = nullptr;  // the leaf of the key before, as of version ver
+    uint64_t ver = 0;
+    for (size_t i = 0; i < n;) {
+        std::string_view key = keys[i];
+        if (v != nullptr) {
+            // key is past the one before: up to the last key of that leaf, unchanged, it is in there too
+            size_t count = std::min(racy(v->count), kMaxKeys);
+            const ArenaKey* last = count > 0 ? racy(v->key[count - 1]) : nullptr;
+            if (last == nullptr || key > last->view() || !validate(v->version, ver)) v = nullptr;
+        }
+        if (v == nullptr && (v = find_leaf(key, ver)) == nullptr) continue;
+
+        size_t count = std::min(racy(v->count), kMaxKeys);
+        size_t idx;
+        if (!bound(v->prefix, v->key, count, key, key_prefix(key), false, idx)) {
+            v = nullptr;
+            continue;
+        }
+        size_t d = kNotFound;
+        if (idx < count) {
+            const ArenaKey* k = racy(v->key[idx]);
+            if (k == nullptr) {
+                v = nullptr;
+                continue;
             }
-            _hot->key[lf_idx] = key;
-            _hot->data[lf_idx] = data;
+            if (k->view() == key) d = racy(v->data[idx]);
+        }
+        if (!validate(v->version, ver)) {
+            v = nullptr;
+            continue;
         }
-        // show_tree();
+        data[i++] = d;
     }
-    else {
-        // LOG(INFO) << "split";
-        // prepare for the idx
-        for (size_t i = 0; i < lf_idx; i++) _tmp_idx[i] = i;
-        _tmp_idx[lf_idx] = (size_t)-1;
-        for (size_t i = lf_idx + 1; i < M; i++) _tmp_idx[i] = i - 1;
-        
-        // create new node
-        BNode* u = new BNode(_hot->parent, true);
-        u->prev = _hot; u->next = _hot->next;
-        if (_hot->next) _hot->next->prev = u;
-        _hot->next = u;
-
-        u->child.resize(M - (M / 2) + 1, nullptr);
-        for (size_t i = M / 2; i < M; i++) {
-            size_t ti = _tmp_idx[i];
-            if (ti == (size_t)-1) {
-                u->key.emplace_back(key.c_str());
-                u->data.emplace_back(data);
-            }
-            else {
-                u->key.emplace_back(_hot->key[ti].c_str());
-                u->data.emplace_back(_hot->data[ti]);
+}
+
+template <size_t Fanout>
+void BTree<Fanout>::scan(const Key& from, bool exclusive, const ScanVisitor& f) const
+{
+    EpochGuard guard;
+    const ArenaKey* last = nullptr;  // the last key passed to f, alive thanks to the guard
+    LeafCopy copy, next_copy;
+    for (;;) {
+        // (re)start from the leaf of from, or of the last key seen
+        std::string_view seek = last ? last->view() : std::string_view(from);
+        bool skip_equal = last ? true : exclusive;
+        uint64_t ver;
+        const Leaf* v = find_leaf(seek, ver);
+        if (v == nullptr || !copy_leaf(v, ver, copy)) continue;
+
+        size_t idx = 0;
+        while (idx < copy.count) {
+            int c = copy.key[idx]->view().compare(seek);
+            if (c > 0 || (c == 0 && !skip_equal)) break;
+            idx++;
+        }
+        for (;;) {
+            for (; idx < copy.count; idx++) {
+                last = copy.key[idx];
+                if (!f(last->view(), copy.data[idx])) return;
             }
+            if (copy.next == nullptr) return;
+
+            const Leaf* next = copy.next;
+            uint64_t next_ver;
+            if (!read_lock(next->version, next_ver) || !copy_leaf(next, next_ver, next_copy)) break;
+            // v did not change either: nothing moved between it and next
+            if (!validate(v->version, ver)) break;
+            v = next;
+            ver = next_ver;
+            copy = next_copy;
+            idx = 0;
         }
+    }
+}
 
-        // update _hot
-        for (size_t i = (M / 2) - 1; i != (size_t)-1; i--) {
-            size_t ti = _tmp_idx[i];
-            if (ti == i) break;
-            else if (ti == (size_t)-1) {
-                _hot->key[i] = key;
-                _hot->data[i] = data;
-                break;
-            }
-            else{
-                _hot->key[i] = _hot->key[ti];
-                _hot->data[i] = _hot->data[ti];
+template <size_t Fanout>
+void BTree<Fanout>::scan_reverse(const Key& from, bool exclusive, const ScanVisitor& f) const
+{
+    EpochGuard guard;
+    const ArenaKey* last = nullptr;  // the last key passed to f, alive thanks to the guard
+    LeafCopy copy, prev_copy;
+    if (from.empty() && exclusive) return;  // nothing is before ""
+    for (;;) {
+        if (last && last->view().empty()) return;
+        // (re)start from the leaf of from (the last leaf for ""), or of the last key seen
+        std::string_view seek = last ? last->view() : std::string_view(from);
+        bool skip_equal = last ? true : exclusive;
+        uint64_t ver;
+        const Leaf* v = find_leaf(seek, ver, seek.empty());
+        if (v == nullptr || !copy_leaf(v, ver, copy)) continue;
+
+        size_t idx = copy.count;  // the keys before idx are to be seen
+        while (!seek.empty() && idx > 0) {
+            int c = copy.key[idx - 1]->view().compare(seek);
+            if (c < 0 || (c == 0 && !skip_equal)) break;
+            idx--;
+        }
+        for (;;) {
+            for (; idx > 0; idx--) {
+                last = copy.key[idx - 1];
+                if (!f(last->view(), copy.data[idx - 1])) return;
             }
+            if (copy.prev == nullptr) return;
+
+            const Leaf* prev = copy.prev;
+            uint64_t prev_ver;
+            if (!read_lock(prev->version, prev_ver) || !copy_leaf(prev, prev_ver, prev_copy)) break;
+            // v did not change either: nothing moved between prev and it
+            if (!validate(v->version, ver)) break;
+            v = prev;
+            ver = prev_ver;
+            copy = prev_copy;
+            idx = copy.count;
         }
-        _hot->key.resize(M / 2);  // delete the rest elements
-        _hot->data.resize(M / 2);
-        _hot->child.resize((M / 2) + 1);
-
-        // update parents
-        if (_hot->parent == nullptr) { // must be root
-            BNode* p = new BNode(nullptr, false);
-            p->key.emplace_back(u->key.front().c_str());
-            p->child.emplace_back(_hot);
-            p->child.emplace_back(u);
-            _hot->parent = p;
-            u->parent = p;
-            this->_root = p;
-        }
-        else {
-            BNode* p = _hot->parent;
-            if (!p->is_full()) {
-                size_t pa_idx = _hot_idx[_hot_idx.size() - 2];
-                p->key.emplace(p->key.begin() + pa_idx, u->key.front().c_str());
-                p->child.emplace(p->child.begin() + pa_idx + 1, u);
-            }
-            else {
-                _hot_idx.pop_back();
-                solve_overflow_innode(u->key.front(), u, p, _hot_idx);
+    }
+}
+
+// split_keys() picks from kSplitGrain times the keys it needs, so that a run is within a subtree or so of the others
+static constexpr size_t kSplitGrain = 4;
+
+template <size_t Fanout>
+std::vector<std::string> BTree<Fanout>::split_keys(const Key& lower, const Key& upper, size_t n) const
+{
+    EpochGuard guard;
+    std::vector<std::string> keys;
+    auto in_range = [&](std::string_view k) { return k > lower && (upper.empty() || k < upper); };
+    for (;;) {
+        // (re)start from the root, a level at a time: the nodes of the level over the range
+        keys.clear();
+        std::vector<std::pair<const Node*, uint64_t>> level(1), below;
+        level[0].first = _root.load(std::memory_order_acquire);
+        if (!read_lock(level[0].first->version, level[0].second)) continue;
+        bool changed = false;
+        while (!changed && !level.empty() && !level[0].first->is_leaf && keys.size() + 1 < kSplitGrain * n) {
+            below.clear();
+            for (auto& [node, ver] : level) {
+                const Inner* in = static_cast<const Inner*>(node);
+                size_t count = std::min(racy(in->count), kMaxKeys);
+                for (size_t i = 0; i <= count && !changed; i++) {
+                    // child i holds the keys in [key[i - 1], key[i])
+                    const ArenaKey* lo = i > 0 ? racy(in->key[i - 1]) : nullptr;
+                    const ArenaKey* hi = i < count ? racy(in->key[i]) : nullptr;
+                    const Node* c = racy(in->child[i]);
+                    if ((i > 0 && lo == nullptr) || (i < count && hi == nullptr) || c == nullptr) {
+                        changed = true;
+                        break;
+                    }
+                    if (hi && hi->view() <= lower) continue;
+                    if (lo && !upper.empty() && lo->view() > upper) break;
+                    if (hi && in_range(hi->view())) keys.emplace_back(hi->view());
+                    uint64_t child_ver;
+                    if (!read_lock(c->version, child_ver)) changed = true;
+                    below.emplace_back(c, child_ver);
+                }
+                // in did not change before its children were locked: they are still its children
+                if (changed || !validate(in->version, ver)) changed = true;
             }
+            level.swap(below);
         }
-        // show_tree();
+        if (changed) continue;
+
+        // the separators down to a level bound its subtrees: the keys cut the range into runs of them
+        std::sort(keys.begin(), keys.end());
+        if (keys.size() + 1 <= n) return keys;
+        std::vector<std::string> picked;
+        for (size_t i = 1; i < n; i++) picked.push_back(std::move(keys[i * (keys.size() + 1) / n - 1]));
+        return picked;
+    }
+}
+
+template <size_t Fanout>
+typename BTree<Fanout>::Leaf* BTree<Fanout>::find_leaf(std::string_view key)
+{
+    _cursor.depth = 0;
+    int64_t p = key_prefix(key);
+    Node* v = _root.load(std::memory_order_relaxed);
+    while (!v->is_leaf) {
+        Inner* in = static_cast<Inner*>(v);
+        size_t idx;
+        bound(in->prefix, in->key, in->count, key, p, true, idx);
+        _cursor.push(in, idx);
+        v = in->child[idx];
     }
+    return static_cast<Leaf*>(v);
+}
+
+template <size_t Fanout>
+void BTree<Fanout>::lock(Node* v)
+{
+    uint64_t ver = v->version.load(std::memory_order_relaxed);
+    if (ver & kLocked) return;  // already ours
+    v->version.store(ver | kLocked, std::memory_order_relaxed);
+    // readers see the lock before any change to the node
+    std::atomic_thread_fence(std::memory_order_release);
+    _locked.push_back(v);
 }
 
+// v (locked) is out of the tree: readers landing on it start over
+template <size_t Fanout>
+void BTree<Fanout>::unlink(Node* v)
+{
+    v->version.store(v->version.load(std::memory_order_relaxed) | kObsolete, std::memory_order_relaxed);
+    _unlinked.push_back(v);
+}
 
-void BTree::solve_overflow_innode(const Key& key, BNode* _c, BNode*& _hot, std::vector<size_t>& _hot_idx)
+template <size_t Fanout>
+void BTree<Fanout>::unlock_all()
 {
-    // LOG(INFO) << "=============== begin solve_overflow_innode";
-    size_t lf_idx = _hot_idx[_hot_idx.size() - 1];
-    // prepare for the idx
-    for (size_t i = 0; i < lf_idx; i++) _tmp_idx[i] = i;
-    _tmp_idx[lf_idx] = (size_t)-1;
-    for (size_t i = lf_idx + 1; i < M; i++) _tmp_idx[i] = i - 1;
-    
-    // create new node
-    BNode* u = new BNode(_hot->parent, false);
-    size_t mi = _tmp_idx[(M / 2)];
-    Key mi_key;
-    if (mi == (size_t)-1) {
-        u->child.emplace_back(_c);
-        _c->parent = u;
-        mi_key = key;
+    for (Node* v : _locked) {
+        uint64_t ver = v->version.load(std::memory_order_relaxed);
+        v->version.store((ver & ~kLocked) + kVersionStep, std::memory_order_release);
     }
-    else {
-        u->child.emplace_back(_hot->child[mi + 1]);
-        u->child.back()->parent = u;
-        mi_key = _hot->key[mi];
-    }
-    for (size_t i = (M / 2) + 1; i < M; i++) {
-        size_t ki = _tmp_idx[i];
-        if (ki == (size_t)-1) {
-            u->key.emplace_back(key.c_str());
-            u->child.emplace_back(_c);
-            _c->parent = u;
-        }
-        else {
-            u->key.emplace_back(_hot->key[ki].c_str());
-            u->child.emplace_back(_hot->child[ki + 1]);
-            u->child.back()->parent = u;
+    _locked.clear();
+
+    // only now: the writer is done touching them
+    EpochManager& epoch = EpochManager::global();
+    for (Node* v : _unlinked) {
+        epoch.retire(v, Slab::release);
+    }
+    _unlinked.clear();
+    for (const ArenaKey* k : _dropped_keys) {
+        epoch.retire(const_cast<ArenaKey*>(k), [](void* p) { KeyArena::release(static_cast<ArenaKey*>(p)); });
+    }
+    _dropped_keys.clear();
+}
+
+/*
+ * return 1: key not exist, insert success!
+ * return 0: key exist, modify success!
+ * return -1: error
+ */
+template <size_t Fanout>
+int BTree<Fanout>::insert(const Key &key, const size_t data, size_t *old)
+{
+    Leaf* v = find_leaf(key);
+    size_t idx;
+    bound(v->prefix, v->key, v->count, key, key_prefix(key), false, idx);
+    if (idx < v->count && v->key[idx]->view() == key) {
+        if (old) *old = v->data[idx];
+        lock(v);
+        v->data[idx] = data;
+        unlock_all();
+        return 0;
+    }
+
+    if (v->count < kMaxKeys) {
+        lock(v);
+        for (size_t i = v->count; i > idx; i--) {
+            v->move_key(i, v, i - 1);
+            v->data[i] = v->data[i - 1];
         }
+        v->set_key(idx, new_key(key));
+        v->data[idx] = data;
+        v->count++;
+    }
+    else {
+        solve_overflow_leaf(v, idx, key, data);
     }
+    unlock_all();
+    _size.fetch_add(1, std::memory_order_relaxed);
+    return 1;
+}
 
-    // update _hot
-    for (size_t i = (M / 2) - 1; i != (size_t)-1; i--) {
-        size_t ti = _tmp_idx[i];
-        if (ti == i) break;
-        else if (ti == (size_t)-1) {
-            _hot->key[i] = key;
-            _hot->child[i + 1] = _c;
-            break;
+/*
+ * v is full: split it in two, the new right half goes after it in the
+ * leaf chain and into the parent
+ */
+template <size_t Fanout>
+void BTree<Fanout>::solve_overflow_leaf(Leaf* v, size_t idx, const Key& key, const size_t data)
+{
+    const ArenaKey* keys[kMaxKeys + 1];
+    int64_t prefixes[kMaxKeys + 1];
+    size_t datas[kMaxKeys + 1];
+    for (size_t i = 0, j = 0; i <= kMaxKeys; i++) {
+        if (i == idx) {
+            keys[i] = new_key(key);
+            prefixes[i] = key_prefix(key);
+            datas[i] = data;
         }
         else {
-            _hot->key[i] = _hot->key[ti];
-            _hot->child[i + 1] = _hot->child[ti + 1];
+            keys[i] = v->key[j];
+            prefixes[i] = v->prefix[j];
+            datas[i] = v->data[j];
+            j++;
         }
     }
-    _hot->key.resize(M / 2);  // delete the rest elements
-    _hot->child.resize((M / 2) + 1);
 
-    // update parents
-    if (_hot->parent == nullptr) { // must be root
-        BNode* p = new BNode(nullptr, false);
-        p->key.emplace_back(mi_key.c_str());
-        p->child.emplace_back(_hot);
-        p->child.emplace_back(u);
-        _hot->parent = p;
-        u->parent = p;
-        this->_root = p;
+    size_t left_n = (kMaxKeys + 2) / 2;
+    Leaf* right = new_leaf();
+    right->count = kMaxKeys + 1 - left_n;
+    for (size_t i = 0; i < right->count; i++) {
+        right->set_key(i, keys[left_n + i], prefixes[left_n + i]);
+        right->data[i] = datas[left_n + i];
     }
-    else {
-        size_t pa_idx = _hot_idx[_hot_idx.size() - 2];
-        BNode* p = _hot->parent;
-        if (!p->is_full()) {
-            p->key.emplace(p->key.begin() + pa_idx, mi_key.c_str());
-            p->child.emplace(p->child.begin() + pa_idx + 1, u);
+    right->prev = v;
+    right->next = v->next;
+
+    lock(v);
+    if (v->next) {
+        lock(v->next);
+        v->next->prev = right;
+    }
+    for (size_t i = 0; i < left_n; i++) {
+        v->set_key(i, keys[i], prefixes[i]);
+        v->data[i] = datas[i];
+    }
+    for (size_t i = left_n; i < kMaxKeys; i++) v->set_key(i, nullptr);
+    v->count = left_n;
+    v->next = right;
+
+    solve_overflow_innode(_cursor.depth, new_key(right->key[0]->view()), right);
+}
+
+/*
+ * the node at depth level (locked) was split, right being its new right
+ * half: add sep and right to its parent, splitting that too if full
+ */
+template <size_t Fanout>
+void BTree<Fanout>::solve_overflow_innode(size_t level, const ArenaKey* sep, Node* right)
+{
+    if (level == 0) {  // the root was split: grow a level
+        Inner* root = new_inner();
+        root->set_key(0, sep);
+        root->child[0] = _root.load(std::memory_order_relaxed);
+        root->child[1] = right;
+        root->count = 1;
+        _root.store(root, std::memory_order_release);
+        return;
+    }
+
+    Inner* p = _cursor.path[level - 1].node;
+    size_t idx = _cursor.path[level - 1].idx;  // sep goes to key[idx], right to child[idx + 1]
+    lock(p);
+    if (p->count < kMaxKeys) {
+        for (size_t i = p->count; i > idx; i--) {
+            p->move_key(i, p, i - 1);
+            p->child[i + 1] = p->child[i];
+        }
+        p->set_key(idx, sep);
+        p->child[idx + 1] = right;
+        p->count++;
+        return;
+    }
+
+    const ArenaKey* keys[kMaxKeys + 1];
+    int64_t prefixes[kMaxKeys + 1];
+    Node* children[Fanout + 1];
+    for (size_t i = 0, j = 0; i <= kMaxKeys; i++) {
+        if (i == idx) {
+            keys[i] = sep;
+            prefixes[i] = key_prefix(sep->view());
         }
         else {
-            _hot_idx.pop_back();
-            solve_overflow_innode(mi_key, u, p, _hot_idx);
+            keys[i] = p->key[j];
+            prefixes[i] = p->prefix[j];
+            j++;
         }
     }
+    for (size_t i = 0, j = 0; i <= Fanout; i++) children[i] = i == idx + 1 ? right : p->child[j++];
+
+    // keys[left_n] moves up
+    size_t left_n = (kMaxKeys + 1) / 2;
+    Inner* r = new_inner();
+    r->count = kMaxKeys - left_n;
+    for (size_t i = 0; i < r->count; i++) r->set_key(i, keys[left_n + 1 + i], prefixes[left_n + 1 + i]);
+    for (size_t i = 0; i <= r->count; i++) r->child[i] = children[left_n + 1 + i];
+
+    for (size_t i = 0; i < left_n; i++) p->set_key(i, keys[i], prefixes[i]);
+    for (size_t i = 0; i <= left_n; i++) p->child[i] = children[i];
+    for (size_t i = left_n; i < kMaxKeys; i++) p->set_key(i, nullptr);
+    for (size_t i = left_n + 1; i < Fanout; i++) p->child[i] = nullptr;
+    p->count = left_n;
+
+    solve_overflow_innode(level - 1, keys[left_n], r);
 }
 
+/*
+ * return 1: key exist, remove success!
+ * return 0: key not exist, remove failed!
+ * return -1: error
+ */
+template <size_t Fanout>
+int BTree<Fanout>::remove(const Key &key, size_t *old)
+{
+    Leaf* v = find_leaf(key);
+    size_t idx;
+    bound(v->prefix, v->key, v->count, key, key_prefix(key), false, idx);
+    if (idx == v->count || v->key[idx]->view() != key) return 0;
+    if (old) *old = v->data[idx];
+
+    lock(v);
+    _dropped_keys.push_back(v->key[idx]);
+    for (size_t i = idx; i + 1 < v->count; i++) {
+        v->move_key(i, v, i + 1);
+        v->data[i] = v->data[i + 1];
+    }
+    v->count--;
+    v->set_key(v->count, nullptr);
+    if (v->count < kMinKeys && _cursor.depth > 0) solve_underflow_leaf(v);
+    unlock_all();
+    _size.fetch_sub(1, std::memory_order_relaxed);
+    return 1;
+}
 
-void BTree::solve_underflow_leaf(BNode*& _hot, std::vector<size_t>& _hot_idx)  // _hot must not root
+/*
+ * v (locked) has too few keys: borrow one from a sibling, or merge with it
+ */
+template <size_t Fanout>
+void BTree<Fanout>::solve_underflow_leaf(Leaf* v)
 {
-    // LOG(INFO) << "=============== begin solve_underflow_leaf";
-    size_t rm_idx = _hot_idx.back();
-    size_t pa_idx = _hot_idx[_hot_idx.size() - 2];
-    BNode* p = _hot->parent;
-    BNode* prev = _hot->prev;
-    BNode* next = _hot->next;
-    if (pa_idx > 0 && prev->key.size() >= ((M + 1) / 2)) {
-        // _hot remove and borrow a smallest key from _hot->prev
-        // LOG(INFO) << "rotate 1";
-        for (size_t i = rm_idx; i >= 1; i--) {
-            _hot->key[i] = _hot->key[i - 1];
-            _hot->data[i] = _hot->data[i - 1];
-        }
-        _hot->key[0] = prev->key.back();
-        _hot->data[0] = prev->data.back();
-
-        // update _hot->prev
-        prev->key.pop_back();
-        prev->data.pop_back();
-        prev->child.pop_back();
-
-        // update parent
-        p->key[pa_idx - 1] = _hot->key.front();
-    }
-    else if (pa_idx < p->child.size() - 1 && next->key.size() >= ((M + 1) / 2)) {
-        // _hot remove and borrow a biggest key from _hot->next
-        // LOG(INFO) << "rotate 2";
-        for (size_t i = rm_idx; i < _hot->key.size() - 1; i++) {
-            _hot->key[i] = _hot->key[i + 1];
-            _hot->data[i] = _hot->data[i + 1];
-        }
-        _hot->key[_hot->key.size() - 1] = next->key.front();
-        _hot->data[_hot->data.size() - 1] = next->data.front();
-
-        // update _hot->next
-        next->key.erase(_hot->next->key.begin());
-        next->data.erase(_hot->next->data.begin());
-        next->child.pop_back();
-
-        // update parent (not neccesary)
-        size_t pa_idx = _hot_idx[_hot_idx.size() - 2];
-        p->key[pa_idx] = next->key.front();
-        if (pa_idx > 0 && rm_idx == 0) {
-            p->key[pa_idx - 1] = _hot->key.front();
-        }
+    Inner* p = _cursor.back().node;
+    size_t idx = _cursor.back().idx;
+    Leaf* ls = idx > 0 ? static_cast<Leaf*>(p->child[idx - 1]) : nullptr;
+    Leaf* rs = idx < p->count ? static_cast<Leaf*>(p->child[idx + 1]) : nullptr;
+    lock(p);
+
+    if (ls && ls->count > kMinKeys) {  // the last key of the left sibling
+        lock(ls);
+        for (size_t i = v->count; i > 0; i--) {
+            v->move_key(i, v, i - 1);
+            v->data[i] = v->data[i - 1];
+        }
+        v->move_key(0, ls, ls->count - 1);
+        v->data[0] = ls->data[ls->count - 1];
+        v->count++;
+        ls->count--;
+        ls->set_key(ls->count, nullptr);
+        _dropped_keys.push_back(p->key[idx - 1]);
+        p->set_key(idx - 1, new_key(v->key[0]->view()));
+        return;
     }
-    else if (pa_idx > 0) {
-        // _hot remove and merge with _hot->prev
-        // LOG(INFO) << "merge 1";
-        for (size_t i = 0; i < _hot->key.size(); i++) {
-            if (i == rm_idx) continue;
-            prev->key.emplace_back(_hot->key[i].c_str());
-            prev->data.emplace_back(_hot->data[i]);
-            prev->child.emplace_back(nullptr);
-        }
-        prev->next = _hot->next;
-        if (_hot->next) _hot->next->prev = prev;
-
-        // delete _hot
-        delete _hot;
-        
-        // update parent
-        if (p != _root && p->key.size() <= ((M + 1) / 2) - 1)
-        {
-            _hot_idx.pop_back();
-            _hot_idx.back() -= 1;
-            solve_underflow_innode(p, _hot_idx);
-        }
-        else if (p == _root && p->key.size() <= 1) {
-            prev->parent = nullptr;
-            _root = prev;
-            delete p;
-        }
-        else {
-            p->key.erase(p->key.begin() + pa_idx - 1);
-            p->child.erase(p->child.begin() + pa_idx);
-        }
+    if (rs && rs->count > kMinKeys) {  // the first key of the right sibling
+        lock(rs);
+        v->move_key(v->count, rs, 0);
+        v->data[v->count] = rs->data[0];
+        v->count++;
+        for (size_t i = 0; i + 1 < rs->count; i++) {
+            rs->move_key(i, rs, i + 1);
+            rs->data[i] = rs->data[i + 1];
+        }
+        rs->count--;
+        rs->set_key(rs->count, nullptr);
+        _dropped_keys.push_back(p->key[idx]);
+        p->set_key(idx, new_key(rs->key[0]->view()));
+        return;
     }
-    else if (pa_idx < p->child.size() - 1) {
-        // _hot merge with _hot->next
-        // LOG(INFO) << "merge 2";
-        for (size_t i = rm_idx; i < _hot->key.size() - 1; i++) {
-            _hot->key[i] = _hot->key[i + 1];
-            _hot->data[i] = _hot->data[i + 1];
-        }
-        _hot->key[_hot->key.size() - 1] = next->key.front();
-        _hot->data[_hot->data.size() - 1] = next->data.front();
-        for (size_t i = 1; i < next->key.size(); i++) {
-            _hot->key.emplace_back(next->key[i].c_str());
-            _hot->data.emplace_back(next->data[i]);
-            _hot->child.emplace_back(nullptr);
-        }
-        _hot->next = next->next;
-        if (next->next) next->next->prev = _hot;
 
-        // delete next
-        delete next;
+    // merge the right one of the pair into the left one
+    Leaf* left = ls ? ls : v;
+    Leaf* right = ls ? v : rs;
+    size_t sep = ls ? idx - 1 : idx;
+    lock(left);
+    lock(right);
+    for (size_t i = 0; i < right->count; i++) {
+        left->move_key(left->count + i, right, i);
+        left->data[left->count + i] = right->data[i];
+    }
+    left->count += right->count;
+    left->next = right->next;
+    if (right->next) {
+        lock(right->next);
+        right->next->prev = left;
+    }
+    unlink(right);
 
-        // update parent
-        if (p != _root && p->key.size() <= ((M + 1) / 2) - 1)
-        {
-            _hot_idx.pop_back();
-            solve_underflow_innode(p, _hot_idx);
-        }
-        else if (p == _root && p->key.size() <= 1) {
-            _hot->parent = nullptr;
-            _root = _hot;
-            delete p;
-        }
-        else {
-            p->key.erase(p->key.begin() + pa_idx);
-            p->child.erase(p->child.begin() + pa_idx + 1);
+    _dropped_keys.push_back(p->key[sep]);
+    for (size_t i = sep; i + 1 < p->count; i++) {
+        p->move_key(i, p, i + 1);
+        p->child[i + 1] = p->child[i + 2];
+    }
+    p->count--;
+    p->set_key(p->count, nullptr);
+    p->child[p->count + 1] = nullptr;
+
+    _cursor.pop();
+    solve_underflow_innode(_cursor.depth);
+}
+
+/*
+ * the inner node at depth level (locked) lost a key: fix it up like a
+ * leaf, the separators in the parent rotating through it
+ */
+template <size_t Fanout>
+void BTree<Fanout>::solve_underflow_innode(size_t level)
+{
+    if (level == 0) {
+        Inner* root = static_cast<Inner*>(_root.load(std::memory_order_relaxed));
+        if (root->count == 0) {  // a single child left: shrink a level
+            _root.store(root->child[0], std::memory_order_release);
+            unlink(root);
         }
+        return;
     }
-    else {
-        LOG(FATAL) << "undefined case in solve_underflow_leaf";
+
+    Inner* p = _cursor.path[level - 1].node;
+    size_t idx = _cursor.path[level - 1].idx;
+    Inner* u = static_cast<Inner*>(p->child[idx]);
+    if (u->count >= kMinKeys) return;
+    Inner* ls = idx > 0 ? static_cast<Inner*>(p->child[idx - 1]) : nullptr;
+    Inner* rs = idx < p->count ? static_cast<Inner*>(p->child[idx + 1]) : nullptr;
+    lock(p);
+
+    if (ls && ls->count > kMinKeys) {
+        lock(ls);
+        for (size_t i = u->count; i > 0; i--) u->move_key(i, u, i - 1);
+        for (size_t i = u->count + 1; i > 0; i--) u->child[i] = u->child[i - 1];
+        u->move_key(0, p, idx - 1);
+        u->child[0] = ls->child[ls->count];
+        u->count++;
+        p->move_key(idx - 1, ls, ls->count - 1);
+        ls->set_key(ls->count - 1, nullptr);
+        ls->child[ls->count] = nullptr;
+        ls->count--;
+        return;
+    }
+    if (rs && rs->count > kMinKeys) {
+        lock(rs);
+        u->move_key(u->count, p, idx);
+        u->child[u->count + 1] = rs->child[0];
+        u->count++;
+        p->move_key(idx, rs, 0);
+        for (size_t i = 0; i + 1 < rs->count; i++) rs->move_key(i, rs, i + 1);
+        for (size_t i = 0; i < rs->count; i++) rs->child[i] = rs->child[i + 1];
+        rs->count--;
+        rs->set_key(rs->count, nullptr);
+        rs->child[rs->count + 1] = nullptr;
+        return;
     }
+
+    // merge, the separator coming down between the two
+    Inner* left = ls ? ls : u;
+    Inner* right = ls ? u : rs;
+    size_t sep = ls ? idx - 1 : idx;
+    lock(left);
+    lock(right);
+    left->move_key(left->count, p, sep);
+    for (size_t i = 0; i < right->count; i++) left->move_key(left->count + 1 + i, right, i);
+    for (size_t i = 0; i <= right->count; i++) left->child[left->count + 1 + i] = right->child[i];
+    left->count += 1 + right->count;
+    unlink(right);
+
+    for (size_t i = sep; i + 1 < p->count; i++) {
+        p->move_key(i, p, i + 1);
+        p->child[i + 1] = p->child[i + 2];
+    }
+    p->count--;
+    p->set_key(p->count, nullptr);
+    p->child[p->count + 1] = nullptr;
+
+    solve_underflow_innode(level - 1);
 }
 
+template <size_t Fanout>
+void BTree<Fanout>::for_each(const std::function<void(std::string_view, size_t)>& f) const
+{
+    const Node* v = _root.load(std::memory_order_relaxed);
+    while (!v->is_leaf) v = static_cast<const Inner*>(v)->child[0];
+    for (const Leaf* l = static_cast<const Leaf*>(v); l != nullptr; l = l->next) {
+        for (size_t i = 0; i < l->count; i++) f(l->key[i]->view(), l->data[i]);
+    }
+}
 
-void BTree::solve_underflow_innode(BNode*& _hot, std::vector<size_t>& _hot_idx)  // _hot must not root
+template <size_t Fanout>
+bool BTree<Fanout>::replace(const Key& key, size_t expected, size_t data)
 {
-    // LOG(INFO) << "=============== begin solve_underflow_innode";
-    size_t rm_idx = _hot_idx.back();
-    size_t pa_idx = _hot_idx[_hot_idx.size() - 2];
-    BNode* p = _hot->parent;
-    if (pa_idx > 0 && p->child[pa_idx - 1]->key.size() >= ((M + 1) / 2)) {
-        // LOG(INFO) << "rotate 11";
-        BNode* prev = p->child[pa_idx - 1];
-        // _hot remove and borrow a smallest key from prev
-        for (size_t i = rm_idx; i >= 1; i--) {
-            _hot->key[i] = _hot->key[i - 1];
-            _hot->child[i + 1] = _hot->child[i];
-        }
-        _hot->child[1] = _hot->child[0];
-        _hot->child[0] = prev->child.back();
-        _hot->child.front()->parent = _hot;
-        if (_hot->child.front()->is_leaf)
-            _hot->key[0] = _hot->child[1]->key.front();
-        else {
-            _hot->key[0] = p->key[pa_idx - 1];
-        }
+    Leaf* v = find_leaf(key);
+    size_t idx;
+    bound(v->prefix, v->key, v->count, key, key_prefix(key), false, idx);
+    if (idx == v->count || v->key[idx]->view() != key || v->data[idx] != expected) return false;
+    lock(v);
+    v->data[idx] = data;
+    unlock_all();
+    return true;
+}
 
-        // update p
-        p->key[pa_idx - 1] = prev->key.back();
+/*
+ * how many of n entries go to each node of a level: capacity each, the
+ * last two evening out if the last one would be under min
+ */
+template <size_t Fanout>
+std::vector<size_t> BTree<Fanout>::pack(size_t n, size_t capacity, size_t min)
+{
+    std::vector<size_t> sizes(n / capacity, capacity);
+    if (n % capacity) sizes.push_back(n % capacity);
+    if (sizes.size() > 1 && sizes.back() < min) {
+        size_t two = sizes[sizes.size() - 2] + sizes.back();
+        sizes[sizes.size() - 2] = two - two / 2;
+        sizes.back() = two / 2;
+    }
+    return sizes;
+}
 
-        // update prev
-        prev->key.pop_back();
-        prev->child.pop_back();
+template <size_t Fanout>
+void BTree<Fanout>::bulk_load(size_t count, const std::function<Entry()>& next)
+{
+    CHECK_EQ(size(), 0u) << "bulk_load() into a tree in use";
+    if (count == 0) return;
+
+    // the nodes of the level being built, with the first key under each
+    std::vector<Node*> level;
+    std::vector<const ArenaKey*> lowest;
+    Leaf* prev = nullptr;
+    const ArenaKey* last = nullptr;
+    for (size_t n : pack(count, kMaxKeys, kMinKeys)) {
+        Leaf* l = new_leaf();
+        for (size_t j = 0; j < n; j++) {
+            Entry e = next();
+            if (last) CHECK_LT(last->view(), e.first) << "bulk_load() of unsorted keys";
+            last = new_key(e.first);
+            l->set_key(j, last);
+            l->data[j] = e.second;
+        }
+        l->count = n;
+        l->prev = prev;
+        if (prev) prev->next = l;
+        prev = l;
+        level.push_back(l);
+        lowest.push_back(l->key[0]);
     }
-    else if (pa_idx < p->child.size() - 1 && p->child[pa_idx + 1]->key.size() >= ((M + 1) / 2)) {
-        // LOG(INFO) << "rotate 12";
-        BNode* next = p->child[pa_idx + 1];
-        // _hot remove and borrow a biggest key from _hot->next
-        for (size_t i = rm_idx; i < _hot->key.size() - 1; i++) {
-            _hot->key[i] = _hot->key[i + 1];
-            _hot->child[i + 1] = _hot->child[i + 2];
-        }
-        _hot->child[_hot->child.size() - 1] = next->child.front();
-        _hot->child.back()->parent = _hot;
-        if (_hot->child.back()->is_leaf) {
-            _hot->key[_hot->key.size() - 1] = _hot->child.back()->key.front();
-        }
-        else {
-            _hot->key[_hot->key.size() - 1] = p->key[pa_idx];
-        }
 
-        // update p
-        p->key[pa_idx] = next->key.front();
-
-        // update next
-        next->key.erase(next->key.begin());
-        next->child.erase(next->child.begin());
-    }
-    else if (pa_idx > 0) {
-        // LOG(INFO) << "merge 11";
-        BNode* prev = p->child[pa_idx - 1];
-        // _hot remove and merge with _hot->prev
-        prev->child.emplace_back(_hot->child.front());
-        prev->child.back()->parent = prev;
-        if (prev->child.back()->is_leaf) {
-            prev->key.emplace_back(prev->child.back()->key.front().c_str());
-        }
-        else {
-            prev->key.emplace_back(p->key[pa_idx - 1]);
-        }
-        
-        for (size_t i = 0; i < _hot->key.size(); i++) {
-            if (i == rm_idx) continue;
-            prev->key.emplace_back(_hot->key[i].c_str());
-            prev->child.emplace_back(_hot->child[i + 1]);
-            prev->child.back()->parent = prev;
+    while (level.size() > 1) {
+        std::vector<Node*> parents;
+        std::vector<const ArenaKey*> parent_lowest;
+        size_t c = 0;
+        for (size_t n : pack(level.size(), Fanout, kMinKeys + 1)) {
+            Inner* in = new_inner();
+            for (size_t j = 0; j < n; j++, c++) {
+                in->child[j] = level[c];
+                if (j > 0) in->set_key(j - 1, new_key(lowest[c]->view()));
+            }
+            in->count = n - 1;
+            parents.push_back(in);
+            parent_lowest.push_back(lowest[c - n]);
         }
+        level.swap(parents);
+        lowest.swap(parent_lowest);
+    }
 
-        // delete _hot
-        delete _hot;
+    Node* empty = _root.exchange(level[0], std::memory_order_acq_rel);
+    lock(empty);
+    unlink(empty);
+    unlock_all();
+    _size.store(count, std::memory_order_relaxed);
+}
 
-        // update parent
-        if (p != _root && p->key.size() <= ((M + 1) / 2) - 1)
-        {
-            _hot_idx.pop_back();
-            _hot_idx.back() -= 1;
-            solve_underflow_innode(p, _hot_idx);
-        }
-        else if (p == _root && p->key.size() <= 1) {
-            prev->parent = nullptr;
-            _root = prev;
-            delete p;
-        }
-        else {
-            p->key.erase(p->key.begin() + pa_idx - 1);
-            p->child.erase(p->child.begin() + pa_idx);
-        }
+template <size_t Fanout>
+bool BTree<Fanout>::check() const
+{
+    size_t leaf_depth = 0, keys = 0;
+    const Leaf* last_leaf = nullptr;
+    if (!check_node(_root.load(), nullptr, nullptr, 1, leaf_depth, last_leaf, keys)) return false;
+    if (last_leaf->next != nullptr) {
+        LOG(ERROR) << "the last leaf has a next";
+        return false;
+    }
+    if (keys != size()) {
+        LOG(ERROR) << "size() is " << size() << " but the leaves hold " << keys << " keys";
+        return false;
+    }
+    return true;
+}
 
+/*
+ * v and its subtree: keys in order and within [lower, upper), sizes within
+ * bounds, leaves all at the same depth and chained in order
+ */
+template <size_t Fanout>
+bool BTree<Fanout>::check_node(const Node* v, const ArenaKey* lower, const ArenaKey* upper, size_t depth,
+                       size_t& leaf_depth, const Leaf*& last_leaf, size_t& keys) const
+{
+    if (v->version.load() & (kLocked | kObsolete)) {
+        LOG(ERROR) << "node locked or obsolete at depth " << depth;
+        return false;
     }
-    else if (pa_idx < p->child.size() - 1) {
-        // LOG(INFO) << "merge 12";
-        BNode* next = p->child[pa_idx + 1];
-        // _hot merge with _hot->next
-        for (size_t i = rm_idx; i < _hot->key.size() - 1; i++) {
-            _hot->key[i] = _hot->key[i + 1];
-            _hot->child[i + 1] = _hot->child[i + 2];
-        }
-        _hot->child[_hot->child.size() - 1] = next->child.front();
-        _hot->child.back()->parent = _hot;
-        if (_hot->child.back()->is_leaf) {
-            _hot->key[_hot->key.size() - 1] = _hot->child.back()->key.front();
-        }
-        else {
-            _hot->key[_hot->key.size() - 1] = p->key[pa_idx];
-        }
-        
-        for (size_t i = 0; i < next->key.size(); i++) {
-            _hot->key.emplace_back(next->key[i].c_str());
-            _hot->child.emplace_back(next->child[i + 1]);
-            _hot->child.back()->parent = _hot;
+    bool is_root = v == _root.load();
+    if (v->count > kMaxKeys || (!is_root && v->count < kMinKeys) || (is_root && !v->is_leaf && v->count == 0)) {
+        LOG(ERROR) << "node with " << v->count << " keys at depth " << depth;
+        return false;
+    }
+    for (size_t i = 0; i < kMaxKeys; i++) {
+        if ((i < v->count) != (v->key[i] != nullptr)) {
+            LOG(ERROR) << "key slot " << i << " of a node with " << v->count << " keys";
+            return false;
+        }
+        if (i >= v->count) continue;
+        std::string_view key = v->key[i]->view();
+        if (v->prefix[i] != key_prefix(key)) {
+            LOG(ERROR) << "stale prefix at depth " << depth << ": " << key;
+            return false;
+        }
+        if ((i > 0 && v->key[i - 1]->view() >= key) || (lower && key < lower->view()) ||
+            (upper && key >= upper->view())) {
+            LOG(ERROR) << "key out of order at depth " << depth << ": " << key;
+            return false;
         }
+    }
 
-        // delete next
-        delete next; 
-
-        // update parent
-        if (p != _root && p->key.size() <= ((M + 1) / 2) - 1)
-        {
-            _hot_idx.pop_back();
-            solve_underflow_innode(p, _hot_idx);
-        }
-        else if (p == _root && p->key.size() <= 1) {
-            _hot->parent = nullptr;
-            _root = _hot;
-            delete p;
+    if (v->is_leaf) {
+        const Leaf* l = static_cast<const Leaf*>(v);
+        if (leaf_depth == 0) leaf_depth = depth;
+        if (depth != leaf_depth) {
+            LOG(ERROR) << "leaves at depth " << leaf_depth << " and " << depth;
+            return false;
         }
-        else {
-            p->key.erase(p->key.begin() + pa_idx);
-            p->child.erase(p->child.begin() + pa_idx + 1);
+        if (l->prev != last_leaf || (last_leaf && last_leaf->next != l)) {
+            LOG(ERROR) << "broken leaf chain at depth " << depth;
+            return false;
         }
+        last_leaf = l;
+        keys += l->count;
+        return true;
     }
-    else {
-        LOG(FATAL) << "undefined case in solve_underflow_leaf";
+
+    const Inner* in = static_cast<const Inner*>(v);
+    for (size_t i = 0; i < Fanout; i++) {
+        if ((i <= in->count) != (in->child[i] != nullptr)) {
+            LOG(ERROR) << "child slot " << i << " of a node with " << in->count << " keys";
+            return false;
+        }
+        if (i > in->count) continue;
+        const ArenaKey* lo = i == 0 ? lower : in->key[i - 1];
+        const ArenaKey* hi = i == in->count ? upper : in->key[i];
+        if (!check_node(in->child[i], lo, hi, depth + 1, leaf_depth, last_leaf, keys)) return false;
     }
+    return true;
+}
+
+template <size_t Fanout>
+size_t BTree<Fanout>::memory_usage() const
+{
+    return _memory->inners.bytes() + _memory->leaves.bytes() + _memory->keys.bytes();
 }
 
-}
\ No newline at end of file
+template class BTree<5>;
+template class BTree<8>;
+template class BTree<16>;
+template class BTree<32>;
+template class BTree<64>;
+template class BTree<128>;
+template class BTree<256>;
+
+}
@@ -0,0 +1,197 @@
+#include "crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+namespace kvs
+{
+namespace crc32c
+{
+static constexpr uint32_t kPoly = 0x82f63b78;  // reflected Castagnoli
+
+static inline uint64_t load64(const char *p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/*
+ * portable: slicing-by-8
+ */
+struct Tables {
+    uint32_t t[8][256];
+    Tables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ kPoly : c >> 1;
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+    }
+};
+static const Tables kTables;
+
+uint32_t extend_portable(uint32_t init_crc, const char *data, size_t n)
+{
+    const auto& t = kTables.t;
+    const unsigned char* p = (const unsigned char*)data;
+    uint32_t l = ~init_crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t w = load64((const char*)p);
+        uint32_t lo = l ^ (uint32_t)w;
+        uint32_t hi = (uint32_t)(w >> 32);
+        l = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for (; n > 0; p++, n--) l = t[0][(l ^ *p) & 0xff] ^ (l >> 8);
+    return ~l;
+}
+
+/*
+ * a * b mod P, both in the reflected representation (bit 31 is x^0).
+ * Used to shift a crc state over a run of bytes: state * x^(8n).
+ */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ kPoly : b >> 1;
+    }
+    return p;
+}
+
+static uint32_t x8nmodp(size_t n)  // x^(8n) mod P
+{
+    uint32_t x2k = (uint32_t)1 << 30;  // x^1
+    for (int k = 0; k < 3; k++) x2k = multmodp(x2k, x2k);
+    uint32_t p = (uint32_t)1 << 31;    // x^0
+    for (; n > 0; n >>= 1) {
+        if (n & 1) p = multmodp(x2k, p);
+        x2k = multmodp(x2k, x2k);
+    }
+    return p;
+}
+
+#if defined(__x86_64__)
+
+bool has_sse42()
+{
+    static const bool has = __builtin_cpu_supports("sse4.2");
+    return has;
+}
+
+bool has_pclmul()
+{
+    static const bool has = has_sse42() && __builtin_cpu_supports("pclmul");
+    return has;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t l, const char *p, size_t n)
+{
+    for (; n >= 8; p += 8, n -= 8) l = (uint32_t)_mm_crc32_u64(l, load64(p));
+    for (; n > 0; p++, n--) l = _mm_crc32_u8(l, (unsigned char)*p);
+    return l;
+}
+
+uint32_t extend_sse42(uint32_t init_crc, const char *data, size_t n)
+{
+    return ~crc_sse42(~init_crc, data, n);
+}
+
+/*
+ * a * b mod P with one carry-less multiply; the 64-bit product is folded
+ * back to 32 bits by the crc32 instruction itself.
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t multiply_clmul(uint32_t a, uint32_t b)
+{
+    __m128i r = _mm_clmulepi64_si128(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b), 0);
+    uint64_t v = (uint64_t)_mm_cvtsi128_si64(r) << 1;
+    return _mm_crc32_u32(0, (uint32_t)v) ^ (uint32_t)(v >> 32);
+}
+
+/*
+ * crc32 has a latency of 3 cycles but a throughput of 1, so one serial
+ * stream leaves 2/3 of the unit idle. Run three streams over adjacent
+ * stripes and merge: crc(ABC) = crc(A) * x^(16S) ^ crc(B) * x^(8S) ^ crc(C).
+ */
+template <size_t S>
+struct Stripe {
+    uint32_t shift1 = x8nmodp(S);      // over one stripe
+    uint32_t shift2 = x8nmodp(2 * S);  // over two stripes
+};
+static const Stripe<1024> kLongStripe;
+static const Stripe<128> kShortStripe;
+
+template <size_t S>
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crc_3way(uint32_t l, const char *&p, size_t &n, const Stripe<S> &k)
+{
+    for (; n >= 3 * S; p += 3 * S, n -= 3 * S) {
+        uint64_t a = l, b = 0, c = 0;
+        for (size_t i = 0; i < S; i += 8) {
+            a = _mm_crc32_u64(a, load64(p + i));
+            b = _mm_crc32_u64(b, load64(p + S + i));
+            c = _mm_crc32_u64(c, load64(p + 2 * S + i));
+        }
+        l = multiply_clmul((uint32_t)a, k.shift2) ^ multiply_clmul((uint32_t)b, k.shift1) ^ (uint32_t)c;
+    }
+    return l;
+}
+
+uint32_t extend_sse42_pclmul(uint32_t init_crc, const char *data, size_t n)
+{
+    if (n < 3 * 128) return extend_sse42(init_crc, data, n);  // typical small record
+    uint32_t l = ~init_crc;
+    l = crc_3way(l, data, n, kLongStripe);
+    l = crc_3way(l, data, n, kShortStripe);
+    return ~crc_sse42(l, data, n);
+}
+
+#else
+
+bool has_sse42() { return false; }
+bool has_pclmul() { return false; }
+
+uint32_t extend_sse42(uint32_t init_crc, const char *data, size_t n)
+{
+    return extend_portable(init_crc, data, n);
+}
+
+uint32_t extend_sse42_pclmul(uint32_t init_crc, const char *data, size_t n)
+{
+    return extend_portable(init_crc, data, n);
+}
+
+#endif
+
+using ExtendFn = uint32_t (*)(uint32_t, const char *, size_t);
+
+static ExtendFn pick()
+{
+    if (has_pclmul()) return extend_sse42_pclmul;
+    if (has_sse42()) return extend_sse42;
+    return extend_portable;
+}
+
+uint32_t extend(uint32_t init_crc, const char *data, size_t n)
+{
+    static const ExtendFn fn = pick();
+    return fn(init_crc, data, n);
+}
+
+}  // namespace crc32c
+}  // namespace kvs
@@ -1,220 +1,965 @@
 #include "engine.h"
 
+#include "iterator.h"
+#include "snapshot.h"
+
 namespace kvs
 {
+static constexpr size_t kMaxGroupBytes = 1 << 20;  // 1MB per writev
+static constexpr size_t kMaxIov = 1024;  // IOV_MAX on linux
+static constexpr size_t kGcScanBatch = 4096;  // keys gc looks at per scan of the index
+static constexpr size_t kMultiGetGap = 16 * 1024;     // multi_get reads over holes up to this long
+static constexpr size_t kMultiGetSpan = 1024 * 1024;  // and no more than this at a time
+static constexpr size_t kGcMoveBatch = 256;   // keys gc moves per hold of _log_mutex
+static constexpr size_t kGcReadBytes = 4 << 20;  // gc reads the live records of a segment this much at a time
+static constexpr size_t kGcReadGap = 64 << 10;   // skipping less garbage than this in one read
+static constexpr size_t kScanReadahead = 1 << 20;  // a scan in log order reads ahead this much
+static constexpr size_t kScanReadGap = 64 << 10;   // over this little garbage between two records
+static constexpr size_t kScanStreams = 8;          // segments a thread's scans are followed in at once
+static constexpr size_t kScanBatch = 256;          // keys a visit reads per EpochGuard
+// the record offsets of a segment fit a Locator, even once it overflows segment_size by a group
+static constexpr size_t kMaxSegmentSize = kMaxSegmentOffset + 1 - 2 * kMaxGroupBytes;
+
 Engine::Engine(const std::string &path, EngineOptions options) :
-    log_offset(0)
+    _path(path),
+    _file_pool(path),
+    _manifest(path),
+    _log_writer(-1, ""),
+    _segments(nullptr),
+    _options(options),
+    btree(options.index_huge_pages),
+    log_offset(0),
+    _checkpoint_bytes(0),
+    _gc_requested(false),
+    _gc_full(false),
+    _gc_running(false),
+    _gc_closing(false),
+    _checkpoint_requested(false),
+    _generation(nullptr),
+    _last_sequence(0),
+    _durable_sequence(0),
+    _unsynced_bytes(0),
+    _closing(false)
 {
     // TODO: your code here
-    log_filename = std::string(path + "/log");
-    if (access(log_filename.c_str(), F_OK) == 0) {  // log file exist, after crash
+    if (_path.empty() || _path.back() != '/') _path.push_back('/');
+    if (_options.segment_size > kMaxSegmentSize) {
+        LOG(FATAL) << "segment_size " << _options.segment_size << " over the limit " << kMaxSegmentSize;
+    }
+
+    if (_options.value_cache_bytes > 0) {
+        _cache.reset(new ValueCache(_options.value_cache_bytes, _options.value_cache_bypass_size));
+    }
+
+    SegmentTable* table = new SegmentTable();
+    if (_manifest.load()) {  // an existing store, maybe after a crash
+        _manifest.remove_orphans();
         // rebuild the B+tree indexing
-        rebuild_btree(log_filename);
+        rebuild_btree();
+        for (SegmentId id : _manifest.segments()) {
+            table->emplace(id, open_segment(id, id == _manifest.active_segment()));
+        }
+    }
+    else {
+        SegmentId id = _manifest.allocate_id();
+        table->emplace(id, open_segment(id, true));
+        _manifest.add_segment(id);
+        _manifest.save();
     }
+    publish_segments(table);
+    account_segments();
+    maybe_schedule_gc();
 
-    std::ignore = options;
+    if (_options.durability == Durability::kSyncInterval) {
+        _flusher = std::thread(&Engine::flush_loop, this);
+    }
 }
 
 Engine::~Engine()
 {
     // TODO: your code here
     // LOG(INFO) << "~Engine";
+    {
+        std::lock_guard<std::mutex> lk(_mutex_gc);
+        _gc_closing = true;  // nor is it started by the sync() below
+    }
+    _gc_cv.notify_all();
+    if (_gc_thread.joinable()) _gc_thread.join();
+    if (_flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(_flush_mutex);
+            _closing = true;
+        }
+        _flush_cv.notify_one();
+        _flusher.join();
+        sync();  // the tail written since the last interval
+    }
+    if (_options.index_checkpoint && _log_writer.valid()) write_checkpoint();
+    if (_log_writer.valid()) _log_writer.close();
+    delete _segments.load();
+    EpochManager::global().reclaim();  // the handles of the tables retired so far, if unused
 }
 
-void Engine::rebuild_btree(const std::string& log_filename)
+void Engine::flush_loop()
 {
-    // LOG(INFO) << "rebuild_btree(" << log_filename << ")";
-    {
-        std::lock_guard<std::shared_mutex> w_lock(_mutex);
-        FILE* crash_fp = fopen(log_filename.c_str(), "r");
-        if (!crash_fp) LOG(FATAL) << "cannot open log file to rebuild indexing" << log_filename;
-        fseek(crash_fp, 0, SEEK_SET);
-
-        std::string key, value;
-        int ret = read_key_value(crash_fp, key, value);
-        while (ret != -1) {
-            if (ret == 0) {
-                btree.remove(key);
-                log_offset += (sizeof(size_t) * 2 + key.size());
+    auto interval = std::chrono::milliseconds(_options.sync_interval_ms);
+    std::unique_lock<std::mutex> lk(_flush_mutex);
+    while (!_closing) {
+        _flush_cv.wait_for(lk, interval, [this] {
+            return _closing || _unsynced_bytes.load() >= _options.sync_interval_bytes;
+        });
+        if (_closing) break;
+        if (_durable_sequence.load() == _last_sequence.load()) continue;
+
+        lk.unlock();
+        sync();
+        lk.lock();
+    }
+}
+
+/*
+ * map segment id if sealed; if active, make it the target of the appends
+ * (creating it if needed) and open its read handle. A sealed segment keeps
+ * no descriptor open, but one which cannot be mapped.
+ */
+Engine::Segment Engine::open_segment(SegmentId id, bool active)
+{
+    std::string name = Manifest::segment_name(id);
+    if (active) {
+        _log_writer = _file_pool.open(name.c_str(), false, true, true);
+        if (!_log_writer.valid()) LOG(FATAL) << "cannot open log segment for append: " << _path << name;
+    }
+    else if (auto map = MappedSegment::map(_path + name)) {
+        return Segment{nullptr, map};
+    }
+    real_storage::File reader = _file_pool.open(name.c_str(), false, false, false);
+    if (!reader.valid()) LOG(FATAL) << "cannot open log segment for read: " << _path << name;
+    std::shared_ptr<real_storage::File> handle(new real_storage::File(reader), [](real_storage::File* f) {
+        f->close();
+        delete f;
+    });
+    return Segment{handle, nullptr};
+}
+
+/*
+ * make table the one readers see, caller holds _log_mutex (or is the
+ * constructor). The old table is freed once no reader can use it.
+ */
+void Engine::publish_segments(const SegmentTable* table)
+{
+    const SegmentTable* old = _segments.exchange(table, std::memory_order_acq_rel);
+    if (old) EpochManager::global().retire(const_cast<SegmentTable*>(old));
+}
+
+const Engine::Segment* Engine::find_segment(SegmentId id) const
+{
+    const SegmentTable* table = _segments.load(std::memory_order_acquire);
+    auto it = table->find(id);
+    return it == table->end() ? nullptr : &it->second;
+}
+
+/*
+ * seal the active segment and start a new one, caller holds _log_mutex
+ */
+void Engine::rotate_segment()
+{
+    // a later sync() only syncs the new active segment: the sealed one
+    // has to be on disk by itself
+    if (_log_writer.fdatasync() != 0) LOG(FATAL) << "cannot sync log segment: " << _log_writer.pathname();
+    _log_writer.close();
+    SegmentId sealed = _manifest.active_segment();
+    auto map = MappedSegment::map(_path + Manifest::segment_name(sealed));
+
+    SegmentId id = _manifest.allocate_id();
+    SegmentTable* table = new SegmentTable(*_segments.load());
+    if (map) table->at(sealed) = Segment{nullptr, map};  // its read handle closes with the old table
+    table->emplace(id, open_segment(id, true));
+    publish_segments(table);
+    _manifest.add_segment(id);
+    _manifest.save();
+    log_offset = 0;
+}
+
+/*
+ * sort with up to threads threads: runs sorted side by side, then merged
+ * pairwise, the merges of a round side by side too
+ */
+template <typename T, typename Less>
+static void parallel_sort(std::vector<T>& v, Less less, size_t threads)
+{
+    size_t runs = std::max<size_t>(1, std::min(threads, v.size() / 65536));
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= runs; i++) bounds.push_back(v.size() * i / runs);
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < runs; i++) {
+        workers.emplace_back([&v, &bounds, &less, i] {
+            std::sort(v.begin() + bounds[i], v.begin() + bounds[i + 1], less);
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    for (size_t width = 1; width < runs; width *= 2) {
+        workers.clear();
+        for (size_t i = 0; i + width < runs; i += 2 * width) {
+            size_t lo = bounds[i], mid = bounds[i + width], hi = bounds[std::min(i + 2 * width, runs)];
+            workers.emplace_back([&v, &less, lo, mid, hi] {
+                std::inplace_merge(v.begin() + lo, v.begin() + mid, v.begin() + hi, less);
+            });
+        }
+        for (auto& w : workers) w.join();
+    }
+}
+
+/*
+ * from the checkpoint of the index if there is a usable one, replaying
+ * the log past it; from the whole log otherwise
+ */
+void Engine::rebuild_btree()
+{
+    // LOG(INFO) << "rebuild_btree(" << _path << ")";
+    IndexCheckpoint checkpoint(_path);
+    if (!checkpoint.load()) {
+        rebuild_btree_from_log();
+        return;
+    }
+    const std::vector<SegmentId>& covered = checkpoint.segments();
+    const std::vector<SegmentId>& segments = _manifest.segments();
+    size_t last = covered.size() - 1;
+    struct stat st;
+    if (covered.size() > segments.size() || !std::equal(covered.begin(), covered.end(), segments.begin()) ||
+        stat((_path + Manifest::segment_name(covered[last])).c_str(), &st) != 0 ||
+        (size_t)st.st_size < checkpoint.offset()) {
+        LOG(WARNING) << "the index checkpoint does not match the log, replaying all of it";
+        checkpoint.close();
+        rebuild_btree_from_log();
+        return;
+    }
+
+    btree.bulk_load(checkpoint.size(), [&checkpoint] {
+        auto e = checkpoint.next();
+        return Index::Entry(e.first, e.second);
+    });
+    checkpoint.close();
+    std::vector<std::pair<Key, Locator>> records;
+    replay_log(last, checkpoint.offset(), records);
+    for (auto& r : records) {
+        if (r.second == Index::kNotFound) btree.remove(r.first);
+        else btree.insert(r.first, r.second);
+    }
+}
+
+/*
+ * one sequential pass over the log lists every record, which are then
+ * sorted by key and log order, and the tree is built bottom-up from the
+ * last locator of every key: recovery is about the time to read the log,
+ * instead of an insert per record. The sort moves the key_prefix() and
+ * the position of the records only, full keys are compared on ties.
+ * (A hash map of the latest locators, filled while reading, cost 7x the
+ * read of the log with 5M keys.)
+ */
+void Engine::rebuild_btree_from_log()
+{
+    std::vector<std::pair<Key, Locator>> records;
+    replay_log(0, 0, records);
+
+    struct Position {
+        int64_t prefix;
+        size_t record;
+    };
+    std::vector<Position> order;
+    order.reserve(records.size());
+    for (size_t i = 0; i < records.size(); i++) order.push_back({key_prefix(records[i].first), i});
+    parallel_sort(order, [&records](const Position& a, const Position& b) {
+        if (a.prefix != b.prefix) return a.prefix < b.prefix;
+        int c = records[a.record].first.compare(records[b.record].first);
+        return c != 0 ? c < 0 : a.record < b.record;
+    }, recovery_threads());
+
+    std::vector<std::pair<Key, size_t>> entries;
+    for (size_t i = 0; i < order.size(); i++) {
+        auto& r = records[order[i].record];
+        bool last = i + 1 == order.size() || order[i + 1].prefix != order[i].prefix ||
+                    records[order[i + 1].record].first != r.first;
+        if (last && r.second != Index::kNotFound) entries.emplace_back(std::move(r));
+    }
+    std::vector<std::pair<Key, Locator>>().swap(records);
+    btree.bulk_load(entries);
+}
+
+/*
+ * the records of the log in order, from offset in the segment at index
+ * from of the manifest, appended to records: key and locator, kNotFound
+ * for a remove. Segments are decoded side by side, then checked in order:
+ * sets log_offset, and cuts a torn tail off the active segment.
+ */
+void Engine::replay_log(size_t from, size_t offset, std::vector<std::pair<Key, Locator>>& records)
+{
+    const std::vector<SegmentId>& segments = _manifest.segments();
+    size_t n = segments.size() - from;
+    std::vector<std::vector<std::pair<Key, Locator>>> decoded(n);
+    std::vector<size_t> ends(n), file_sizes(n);
+    std::atomic<size_t> next(0);
+    auto worker = [&] {
+        for (size_t i = next++; i < n; i = next++) {
+            ends[i] = scan_segment(segments[from + i], i == 0 ? offset : 0, decoded[i], file_sizes[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < std::min(recovery_threads(), n); t++) workers.emplace_back(worker);
+    worker();
+    for (auto& w : workers) w.join();
+
+    for (size_t i = 0; i < n; i++) {
+        SegmentId id = segments[from + i];
+        bool active = id == _manifest.active_segment();
+        std::string filename = _path + Manifest::segment_name(id);
+        if (file_sizes[i] > ends[i] && active) {
+            // a torn or corrupted tail: drop it, so new records go right after
+            // the last good one instead of after the garbage
+            LOG(WARNING) << "truncating " << file_sizes[i] - ends[i] << " bytes of bad log tail at offset "
+                         << ends[i] << ": " << filename;
+            if (truncate(filename.c_str(), ends[i]) != 0) {
+                LOG(FATAL) << "cannot truncate the log: " << filename << ", errno: " << errno;
             }
-            else {
-                btree.insert(key, log_offset);
-                log_offset += (sizeof(size_t) * 2 + key.size() + value.size());
+        }
+        else if (file_sizes[i] > ends[i]) {
+            // sealed segments were synced as a whole: this is media corruption
+            LOG(ERROR) << "bad record at offset " << ends[i] << " of sealed segment " << filename
+                       << ", skipping its last " << file_sizes[i] - ends[i] << " bytes";
+        }
+        if (active) log_offset = ends[i];
+
+        if (records.empty()) records.swap(decoded[i]);
+        else std::move(decoded[i].begin(), decoded[i].end(), std::back_inserter(records));
+        std::vector<std::pair<Key, Locator>>().swap(decoded[i]);
+    }
+}
+
+/*
+ * decode the records of segment id from offset on, into records; returns
+ * the offset past the last good one, and the size of the file
+ */
+size_t Engine::scan_segment(SegmentId id, size_t offset, std::vector<std::pair<Key, Locator>>& records,
+                            size_t& file_size)
+{
+    std::string filename = _path + Manifest::segment_name(id);
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) LOG(FATAL) << "cannot open log segment to rebuild indexing: " << filename;
+    file_size = st.st_size;
+    posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+
+    // buf[begin, end) is read and not decoded yet, it starts at offset in the file
+    std::vector<char> buf(kMaxGroupBytes + sizeof(RecordHeader) + kMaxKeySize + kMaxValueSize);
+    size_t begin = 0, end = 0;
+    for (bool eof = false;;) {
+        while (end - begin >= sizeof(RecordHeader)) {
+            RecordHeader header;
+            memcpy(&header, &buf[begin], sizeof(header));
+            if (!header.plausible()) eof = true;
+            if (eof || end - begin < header.record_size()) break;
+            const char* key = &buf[begin + sizeof(header)];
+            if (header.crc != header.compute_crc(key, key + header.key_size)) {
+                eof = true;
+                break;
             }
-            key.clear();
-            value.clear();
-            ret = read_key_value(crash_fp, key, value);
+            Locator loc = header.type == kTypeValue ? make_locator(id, offset, header.value_size) : Index::kNotFound;
+            records.emplace_back(Key(key, header.key_size), loc);
+            begin += header.record_size();
+            offset += header.record_size();
         }
-        fclose(crash_fp);
+        if (eof) break;
+
+        memmove(&buf[0], &buf[begin], end - begin);
+        end -= begin;
+        begin = 0;
+        ssize_t n = ::pread(fd, &buf[end], buf.size() - end, offset + end);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) LOG(FATAL) << "cannot read log segment: " << filename << ", errno: " << errno;
+        if (n == 0) eof = true;
+        end += n;
+    }
+    ::close(fd);
+    return offset;
+}
+
+size_t Engine::recovery_threads() const
+{
+    if (_options.recovery_threads > 0) return _options.recovery_threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*
+ * write the checkpoint of the index, on _gc_thread (so never while gc
+ * moves records) or on close. It covers the log up to where it is at the
+ * start, and takes _log_mutex for that only: the index is scanned
+ * kGcScanBatch keys per EpochGuard while the writes go on. A key written
+ * since may show up old or new, the log past that point is replayed over
+ * it anyway. The log is synced before the checkpoint is committed: it
+ * must not point into a tail lost in a crash.
+ */
+void Engine::write_checkpoint()
+{
+    std::vector<SegmentId> segments;
+    size_t offset;
+    {
+        std::lock_guard<std::mutex> log_lock(_log_mutex);
+        segments = _manifest.segments();
+        offset = log_offset;
+        _checkpoint_bytes = 0;
     }
+    IndexCheckpoint checkpoint(_path);
+    checkpoint.begin(segments, offset);
+    Key from;
+    bool exclusive = false, done = false;
+    while (!done) {
+        done = true;
+        size_t seen = 0;
+        EpochGuard guard;
+        btree.scan(from, exclusive, [&](std::string_view key, size_t loc) {
+            checkpoint.add(key, loc);
+            if (++seen < kGcScanBatch) return true;
+            from.assign(key);
+            done = false;
+            return false;
+        });
+        exclusive = true;
+    }
+    Writer w(nullptr, nullptr, true);
+    commit(w);
+    checkpoint.commit();
 }
 
-void Engine::log_line(FILE*& fp, const std::string& line)
+static bool pread_full(const real_storage::File& f, char* buf, size_t count, size_t offset)
 {
     size_t s = 0;
-    while (s < line.size()) {
-        size_t len = 8092;
-        if (line.size() - s < 8092) len = line.size() - s;
-        size_t n = fwrite(line.c_str() + s, 1, len, fp);
+    while (s < count) {
+        ssize_t n = f.pread(buf + s, count - s, offset + s);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
         s += n;
     }
-    if (s > line.size()) {
-        LOG(FATAL) << "s != line.size(), s = " << s << ", line.size() = " << line.size();
+    return true;
+}
+
+static bool preadv_full(const real_storage::File& f, struct iovec* iov, int cnt, size_t offset)
+{
+    while (cnt > 0) {
+        ssize_t n = f.preadv(iov, cnt, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        offset += n;
+        for (; cnt > 0 && (size_t)n >= iov->iov_len; iov++, cnt--) n -= iov->iov_len;
+        if (n > 0) {  // short read, go on from the middle of *iov
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
     }
+    return true;
 }
 
-void Engine::read_line(FILE*& fp, std::string& line)
+RetCode Engine::commit(Writer& w)
 {
-    char buf[16];
-    size_t k_size, v_size, n;
+    std::unique_lock<std::mutex> lk(_writer_mutex);
+    _writers.push_back(&w);
+    while (!w.done && &w != _writers.front()) {
+        w.cv.wait(lk);
+    }
+    if (w.done) return w.ret;
 
-    n = fread(buf, 1, sizeof(size_t), fp);
-    if (n != sizeof(size_t)) return;
-    k_size = *(size_t *)(buf);
-    line.append(buf, sizeof(size_t));
+    // w is the leader now: take the writers queued so far as its group
+    size_t bytes = 0;
+    _group.clear();
+    for (Writer* u : _writers) {
+        if (!_group.empty() && bytes >= kMaxGroupBytes) break;
+        _group.emplace_back(u);
+        if (u->key) bytes += u->header.record_size();
+    }
+    lk.unlock();
 
-    n = fread(buf, 1, sizeof(size_t), fp);
-    if (n != sizeof(size_t)) return;
-    v_size = *(size_t *)(buf);
-    line.append(buf, sizeof(size_t));
+    write_group();
 
-    size_t total = k_size;
-    if (v_size != (size_t)-1) total += v_size;
-    read_num(fp, total, line);
+    lk.lock();
+    for (Writer* u : _group) {
+        _writers.pop_front();
+        if (u != &w) {
+            u->done = true;
+            u->cv.notify_one();
+        }
+    }
+    if (!_writers.empty()) _writers.front()->cv.notify_one();  // the next leader
+    return w.ret;
+}
+
+void Engine::write_group()
+{
+    std::lock_guard<std::mutex> log_lock(_log_mutex);
+    size_t offset = log_offset;
+    SegmentId active = _manifest.active_segment();
+    bool need_sync = false;
 
-    // while (fgets(buf, sizeof(buf), fp)) {
-    //     line.append(buf);
-    //     if (line.back() == '\n') {
-    //         line.pop_back();
-    //         break;
-    //     }
-    // }
+    _iov.clear();
+    for (size_t i = 0; i < _group.size(); i++) {
+        Writer* u = _group[i];
+        need_sync |= u->sync;
+        if (u->key == nullptr) continue;
+        if (u->value == nullptr && !exists_before(i, *u->key)) {
+            u->ret = kNotFound;  // nothing to log
+            continue;
+        }
+        u->seq = ++_last_sequence;
+        u->loc = make_locator(active, offset, u->value ? u->value->size() : 0);
+        _iov.push_back({&u->header, sizeof(u->header)});
+        _iov.push_back({const_cast<char*>(u->key->data()), u->key->size()});
+        offset += sizeof(u->header) + u->key->size();
+        if (u->value) {
+            _iov.push_back({const_cast<char*>(u->value->data()), u->value->size()});
+            offset += u->value->size();
+        }
+    }
+
+    struct iovec* iov = _iov.data();
+    size_t cnt = _iov.size();
+    while (cnt > 0) {
+        ssize_t n = _log_writer.writev(iov, std::min(cnt, kMaxIov));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) LOG(FATAL) << "cannot append to the log: " << _log_writer.pathname() << ", errno: " << errno;
+        for (; cnt > 0 && (size_t)n >= iov->iov_len; iov++, cnt--) n -= iov->iov_len;
+        if (n > 0) {  // short write, go on from the middle of *iov
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    Sequence last = _last_sequence.load();
+    for (Writer* u : _group) {
+        if (u->seq == 0) u->seq = last;  // sync() or a remove that logged nothing
+    }
+    size_t unsynced = _unsynced_bytes.fetch_add(offset - log_offset) + (offset - log_offset);
+    _checkpoint_bytes += offset - log_offset;
+    SegmentUsage& usage = _usage[active];
+    usage.bytes += offset - log_offset;
+    if (need_sync) {
+        // the records are in the log, and replay would bring them back: a
+        // write failed here would not stay failed, so as a failed append
+        if (_log_writer.fdatasync() != 0) {
+            LOG(FATAL) << "cannot sync the log: " << _log_writer.pathname() << ", errno: " << errno;
+        }
+        _unsynced_bytes.store(0);
+        std::lock_guard<std::mutex> lk(_durable_mutex);
+        _durable_sequence.store(last);
+        _durable_cv.notify_all();
+    }
+    else if (_options.durability == Durability::kSyncInterval &&
+             unsynced >= _options.sync_interval_bytes) {
+        _flush_cv.notify_one();
+    }
+
+    // apply in log order, so the last write of a key in the group wins;
+    // the btree first, see _cache
+    for (Writer* u : _group) {
+        if (u->key == nullptr || u->ret != kSucc) continue;
+        if (_generation) log_undo(*u->key);
+        size_t old = Index::kNotFound;
+        if (u->value) {
+            btree.insert(*u->key, u->loc, &old);
+            usage.live += locator_record_size(u->loc, u->key->size());
+        }
+        else {
+            btree.remove(*u->key, &old);
+        }
+        if (old != Index::kNotFound) mark_dead(old, u->key->size());
+        if (!_cache) continue;
+        if (u->value) _cache->update(*u->key, *u->value);
+        else _cache->erase(*u->key);
+    }
+    log_offset = offset;
+    if (log_offset >= _options.segment_size) {
+        rotate_segment();
+        maybe_schedule_gc();
+    }
 }
 
-int Engine::read_key_value(FILE*& fp, Key& key, Value& value)
+bool Engine::exists_before(size_t group_idx, const Key& key)
 {
-    char buf[16];
-    size_t k_size, v_size, n;
+    // the latest logged write of key ahead of us in the group decides
+    for (size_t j = group_idx; j-- > 0; ) {
+        Writer* u = _group[j];
+        if (u->key == nullptr || u->ret != kSucc || *u->key != key) continue;
+        return u->value != nullptr;
+    }
+    return btree.search(key) != Index::kNotFound;
+}
 
-    n = fread(buf, 1, sizeof(size_t), fp);
-    if (n != sizeof(size_t)) return -1;
-    k_size = *(size_t *)(buf);
+// the record of key at loc looks like it should
+bool Engine::check_record(const RecordHeader& header, Locator loc, const Key& key,
+                          const char* stored_key, const char* value)
+{
+    if (!header.plausible() || header.type != kTypeValue || header.key_size != key.size() ||
+        header.value_size != locator_value_size(loc) || memcmp(stored_key, key.data(), key.size()) != 0) {
+        return false;
+    }
+    if (_options.verify_checksums && header.crc != header.compute_crc(stored_key, value)) return false;
+    return true;
+}
 
-    n = fread(buf, 1, sizeof(size_t), fp);
-    if (n != sizeof(size_t)) return -1;
-    v_size = *(size_t *)(buf);
-        
-    if (v_size != (size_t)-1) {  // insert
-        if (!read_num(fp, k_size, key)) return -1;
-        if (!read_num(fp, v_size, value)) return -1;
-        return 1;
+/*
+ * a scan read the record [offset, end) of map: one going through a
+ * segment in log order, as over the key-clustered base, has the next
+ * kScanReadahead bytes read in once it is halfway through the last such
+ * window. The mapping is MADV_RANDOM, for the gets; a scan in no order
+ * gets no readahead either. A thread follows the last few segments it
+ * scanned, as a scan of the base also reads the writes since here and
+ * there.
+ */
+static void scan_readahead(const MappedSegment& map, size_t offset, size_t end)
+{
+    struct Stream {
+        const MappedSegment* map;
+        size_t end;    // of the last record scanned
+        size_t ahead;  // of the window read in
+    };
+    thread_local Stream streams[kScanStreams] = {};
+    thread_local size_t next_victim = 0;
+    Stream* s = std::find_if(streams, streams + kScanStreams, [&map](const Stream& s) { return s.map == &map; });
+    if (s == streams + kScanStreams) {
+        s = &streams[next_victim++ % kScanStreams];
+        *s = Stream{&map, end, 0};
+        return;
     }
-    else {  // remove
-        if (!read_num(fp, k_size, key)) return -1;
-        return 0;
+    bool in_order = offset >= s->end && offset - s->end <= kScanReadGap;
+    s->end = end;
+    if (!in_order) {
+        s->ahead = 0;
+        return;
     }
+    if (s->ahead >= end + kScanReadahead / 2) return;
+    size_t from = std::max(s->ahead, offset);
+    map.will_need(from, kScanReadahead);
+    s->ahead = from + kScanReadahead;
 }
 
-bool Engine::read_num(FILE*&fp, size_t num, std::string& line)
+/*
+ * the value of key at loc in a sealed segment, decoded in place in its
+ * mapping: no syscall and no copy. nullptr if the record is bad.
+ */
+const char* Engine::find_mapped(const MappedSegment& map, Locator loc, const Key& key, bool scan)
 {
-    char buf[8092];
-    size_t s = 0;
-    while (s < num) {
-        size_t len = 8092;
-        if (num - s < 8092) len = num - s;
-        size_t n = fread(buf, 1, len, fp);
-        if (n < len) return false;
-        line.append(buf, n);
-        s += n;
+    size_t offset = locator_offset(loc);
+    size_t end = offset + sizeof(RecordHeader) + key.size() + locator_value_size(loc);
+    if (end > map.size()) return nullptr;
+    if (scan) scan_readahead(map, offset, end);
+
+    const char* p = map.data() + offset;
+    RecordHeader header;
+    memcpy(&header, p, sizeof(header));
+    const char* value = p + sizeof(header) + key.size();
+    return check_record(header, loc, key, p + sizeof(header), value) ? value : nullptr;
+}
+
+/*
+ * the value of key, stored at loc, copied once into the caller's string:
+ * from the mapping of a sealed segment, or with a single preadv from the
+ * active one.
+ */
+bool Engine::read_value(Locator loc, const Key& key, Value& value, bool scan)
+{
+    const Segment* segment = find_segment(locator_segment(loc));
+    if (segment == nullptr) return false;
+
+    if (segment->map) {
+        const char* v = find_mapped(*segment->map, loc, key, scan);
+        if (v == nullptr) return false;
+        value.assign(v, locator_value_size(loc));
+        return true;
+    }
+
+    if (!segment->reader) return false;
+    RecordHeader header;
+    thread_local std::string stored_key;
+    stored_key.resize(key.size());
+    value.resize(locator_value_size(loc));
+    struct iovec iov[3] = {
+        {&header, sizeof(header)},
+        {&stored_key[0], stored_key.size()},
+        {&value[0], value.size()},
+    };
+    if (!preadv_full(*segment->reader, iov, 3, locator_offset(loc))) return false;
+    return check_record(header, loc, key, stored_key.data(), value.data());
+}
+
+bool Engine::read_view(Locator loc, const Key& key, ValueView& view)
+{
+    view.clear();
+    const Segment* segment = find_segment(locator_segment(loc));
+    if (segment == nullptr) return false;
+
+    if (segment->map) {
+        const char* v = find_mapped(*segment->map, loc, key, false);
+        if (v == nullptr) return false;
+        view._pin = segment->map;
+        view._data = v;
+        view._size = locator_value_size(loc);
+        return true;
     }
+    if (!read_value(loc, key, view._buf)) return false;
+    view._data = view._buf.data();
+    view._size = view._buf.size();
     return true;
 }
 
 
+
+
 RetCode Engine::put(const Key &key, const Value &value)
 {
     // TODO: your code here
     // LOG(INFO) << "put(" << key << ", " << value << ")";
-    std::string line;
-    size_t k_size = key.size();
-    size_t v_size = value.size();
-    line.append((char*)&k_size, sizeof(size_t));
-    line.append((char*)&v_size, sizeof(size_t));
-    line.append(key);
-    line.append(value);
-
-    std::lock_guard<std::shared_mutex> w_lock(_mutex);
-    log_fp = fopen(log_filename.c_str(), "a+");
-    if (!log_fp) LOG(FATAL) << "cannot open and read the file: " << log_filename;
-    log_line(log_fp, line);
-    // fsync(fileno(log_fp));
-    fclose(log_fp);
-
-    btree.insert(key, log_offset);
-    log_offset += line.size();
-    return kSucc;
+    Sequence seq;
+    return put(key, value, seq);
 }
 RetCode Engine::remove(const Key &key)
 {
     // TODO: your code here
     // LOG(INFO) << "remove(" << key << ")";
-    std::string line;
-    size_t k_size = key.size();
-    size_t v_size = (size_t)(-1);
-    line.append((char*)&k_size, sizeof(size_t));
-    line.append((char*)&v_size, sizeof(size_t));
-    line.append(key);
-    
-    std::lock_guard<std::shared_mutex> w_lock(_mutex);
-    if (btree.remove(key) == 0) {
+    Sequence seq;
+    return remove(key, seq);
+}
+RetCode Engine::put(const Key &key, const Value &value, Sequence &seq)
+{
+    if (key.size() > kMaxKeySize || value.size() > kMaxValueSize) return kInvalidArgument;
+    Writer w(&key, &value, _options.durability == Durability::kSyncEveryWrite);
+    w.header.encode(key, &value);
+    RetCode ret = commit(w);
+    seq = w.seq;
+    return ret;
+}
+RetCode Engine::remove(const Key &key, Sequence &seq)
+{
+    if (key.size() > kMaxKeySize) return kInvalidArgument;
+    Writer w(&key, nullptr, _options.durability == Durability::kSyncEveryWrite);
+    w.header.encode(key, nullptr);
+    RetCode ret = commit(w);
+    seq = w.seq;
+    return ret;
+}
+RetCode Engine::get(const Key &key, Value &value)
+{
+    // TODO: your code here
+    // LOG(INFO) << "get(" << key << ")";
+    if (_cache && _cache->lookup(key, value)) return kSucc;
+
+    EpochGuard guard;
+    Locator loc = btree.search(key);
+    while (loc != Index::kNotFound && !read_value(loc, key, value)) {
+        // a gc may have moved the record since the search
+        Locator again = btree.search(key);
+        if (again == loc) {
+            LOG(ERROR) << "bad record at offset " << locator_offset(loc) << " of log segment "
+                       << locator_segment(loc) << " for key: " << key;
+            value.clear();
+            return kCorruption;
+        }
+        loc = again;
+    }
+    if (loc == Index::kNotFound) return kNotFound;
+
+    if (_cache) _cache->insert(key, value, [&] { return btree.search(key) == loc; });
+    return kSucc;
+}
+
+RetCode Engine::get(const Key &key, ValueView &view)
+{
+    EpochGuard guard;
+    Locator loc = btree.search(key);
+    while (loc != Index::kNotFound && !read_view(loc, key, view)) {
+        Locator again = btree.search(key);
+        if (again == loc) {
+            LOG(ERROR) << "bad record at offset " << locator_offset(loc) << " of log segment "
+                       << locator_segment(loc) << " for key: " << key;
+            view.clear();
+            return kCorruption;
+        }
+        loc = again;
+    }
+    if (loc == Index::kNotFound) {
+        view.clear();
         return kNotFound;
     }
-    else {
-        log_fp = fopen(log_filename.c_str(), "a+");
-        if (!log_fp) LOG(FATAL) << "cannot open and read the file: " << log_filename;
-        log_line(log_fp, line);
-        // fsync(fileno(log_fp));
-        fclose(log_fp);
+    return kSucc;
+}
 
-        log_offset += line.size();
-        return kSucc;
+RetCode Engine::multi_get(const std::vector<Key> &keys, std::vector<Value> &values, std::vector<RetCode> &statuses)
+{
+    size_t n = keys.size();
+    values.resize(n);
+    for (auto& v : values) v.clear();  // keeping their buffers, for the next batch
+    statuses.assign(n, kNotFound);
+    std::vector<size_t> order;  // the keys to look up, in key order
+    for (size_t i = 0; i < n; i++) {
+        if (_cache && _cache->lookup(keys[i], values[i])) statuses[i] = kSucc;
+        else order.push_back(i);
     }
+    std::vector<int64_t> prefixes(n);  // mostly enough to order the keys
+    for (size_t i : order) prefixes[i] = key_prefix(keys[i]);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return prefixes[a] != prefixes[b] ? prefixes[a] < prefixes[b] : keys[a] < keys[b];
+    });
+
+    EpochGuard guard;
+    std::vector<std::string_view> sorted(order.size());
+    std::vector<Locator> locs(order.size());
+    for (size_t i = 0; i < order.size(); i++) sorted[i] = keys[order[i]];
+    btree.search_sorted(sorted.data(), sorted.size(), locs.data());
+
+    // segment then offset: the order of the bits of a locator
+    std::vector<Read> reads;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (locs[i] != Index::kNotFound) reads.emplace_back(locs[i], order[i]);
+    }
+    std::sort(reads.begin(), reads.end());
+    std::vector<size_t> retry;
+    for (size_t b = 0, e; b < reads.size(); b = e) {
+        for (e = b + 1; e < reads.size() && locator_segment(reads[e].first) == locator_segment(reads[b].first); e++) { }
+        read_segment(&reads[b], e - b, keys, values, statuses, retry);
+    }
+    if (_cache) {
+        for (auto& r : reads) {
+            if (statuses[r.second] != kSucc) continue;
+            const Key& key = keys[r.second];
+            _cache->insert(key, values[r.second], [&] { return btree.search(key) == r.first; });
+        }
+    }
+    // moved by a gc since the lookup, or bad: as get() does
+    for (size_t i : retry) statuses[i] = get(keys[i], values[i]);
+
+    for (RetCode ret : statuses) {
+        if (ret != kSucc && ret != kNotFound) return ret;
+    }
+    return kSucc;
 }
-RetCode Engine::get(const Key &key, Value &value)
+
+void Engine::read_segment(const Read* reads, size_t n, const std::vector<Key>& keys,
+                          std::vector<Value>& values, std::vector<RetCode>& statuses, std::vector<size_t>& retry)
 {
-    // TODO: your code here
-    // LOG(INFO) << "get(" << key << ")";
+    const Segment* segment = find_segment(locator_segment(reads[0].first));
+    auto record_end = [&](const Read& r) {
+        return locator_offset(r.first) + locator_record_size(r.first, keys[r.second].size());
+    };
+    // the runs of reads with at most kMultiGetGap bytes between them, and no longer than kMultiGetSpan
+    auto run_end = [&](size_t b, size_t& end) {
+        size_t e = b + 1;
+        end = record_end(reads[b]);
+        for (; e < n && locator_offset(reads[e].first) <= end + kMultiGetGap &&
+               record_end(reads[e]) - locator_offset(reads[b].first) <= kMultiGetSpan; e++) {
+            end = std::max(end, record_end(reads[e]));
+        }
+        return e;
+    };
 
-    std::shared_lock<std::shared_mutex> r_lock(_mutex);
-    std::shared_lock<std::shared_mutex> r_lock2(_mutex2);
-    size_t index = btree.search(key);
-    if (index == (size_t)-1) return kNotFound;
+    if (segment == nullptr || (!segment->map && !segment->reader)) {
+        for (size_t i = 0; i < n; i++) retry.push_back(reads[i].second);
+    }
+    else if (segment->map) {
+        // have the kernel read the pages of every run in, side by side, before the first copy waits for one
+        const MappedSegment& map = *segment->map;
+        for (size_t b = 0, e, end; _options.multi_get_prefetch && b < n; b = e) {
+            e = run_end(b, end);
+            map.will_need(locator_offset(reads[b].first), end - locator_offset(reads[b].first));
+        }
+        for (size_t i = 0; i < n; i++) {
+            const Key& key = keys[reads[i].second];
+            const char* v = find_mapped(map, reads[i].first, key, false);
+            if (v == nullptr) {
+                retry.push_back(reads[i].second);
+                continue;
+            }
+            values[reads[i].second].assign(v, locator_value_size(reads[i].first));
+            statuses[reads[i].second] = kSucc;
+        }
+    }
     else {
-        FILE* r_fp = fopen(log_filename.c_str(), "r");
-        fseek(r_fp, index, SEEK_SET);
-
-        Key tmp;
-        value.clear();
-        int ret = read_key_value(r_fp, tmp, value);
-        if (ret != 1) LOG(FATAL) << "cannot get value from log: " << key;
-        fclose(r_fp);
-        return kSucc;
+        // the active segment: a pread per run
+        thread_local std::string buf;
+        for (size_t b = 0, e, end; b < n; b = e) {
+            e = run_end(b, end);
+            size_t start = locator_offset(reads[b].first);
+            buf.resize(end - start);
+            bool ok = pread_full(*segment->reader, &buf[0], buf.size(), start);
+            for (size_t i = b; i < e; i++) {
+                const Key& key = keys[reads[i].second];
+                const char* p = buf.data() + locator_offset(reads[i].first) - start;
+                RecordHeader header;
+                memcpy(&header, p, sizeof(header));
+                const char* value = p + sizeof(header) + key.size();
+                if (!ok || !check_record(header, reads[i].first, key, p + sizeof(header), value)) {
+                    retry.push_back(reads[i].second);
+                    continue;
+                }
+                values[reads[i].second].assign(value, locator_value_size(reads[i].first));
+                statuses[reads[i].second] = kSucc;
+            }
+        }
     }
-    
+}
+
+ValueCache::Stats Engine::cache_stats() const
+{
+    return _cache ? _cache->stats() : ValueCache::Stats();
 }
 
 RetCode Engine::sync()
 {
     // TODO: your code here
-    std::lock_guard<std::shared_mutex> w_lock(_mutex);
-    log_fp = fopen(log_filename.c_str(), "a+");
-    if (fsync(fileno(log_fp)) == 0) {
-        fclose(log_fp);
+    // a bare sync joins the commit queue, concurrent callers share one fdatasync
+    Writer w(nullptr, nullptr, true);
+    RetCode ret = commit(w);
+    if (_options.index_checkpoint && _options.checkpoint_interval_bytes > 0) {
+        bool due;
+        {
+            std::lock_guard<std::mutex> log_lock(_log_mutex);
+            due = _checkpoint_bytes >= _options.checkpoint_interval_bytes;
+        }
+        if (due) request_checkpoint();  // written in the background, see write_checkpoint()
+    }
+    return ret;
+}
+
+RetCode Engine::wait_durable(Sequence seq, std::chrono::milliseconds timeout)
+{
+    auto durable = [this, seq] { return _durable_sequence.load() >= seq; };
+    std::unique_lock<std::mutex> lk(_durable_mutex);
+    if (timeout == std::chrono::milliseconds::max()) {
+        _durable_cv.wait(lk, durable);
         return kSucc;
     }
-    else {
-        fclose(log_fp);
-        return kIOError;
+    return _durable_cv.wait_for(lk, timeout, durable) ? kSucc : kTimedOut;
+}
+
+/*
+ * f(key, loc) for the keys of the index from lower on, in order, while it
+ * returns true: kScanBatch keys per EpochGuard, then on past the last one.
+ * A long scan does not hold back the reclamation of what the writers
+ * retire meanwhile.
+ */
+void Engine::scan_index(const Key& lower, const std::function<bool(const Key&, Locator)>& f)
+{
+    Key cursor = lower, key;
+    bool exclusive = false;
+    for (bool more = true; more;) {
+        more = false;
+        EpochGuard guard;
+        size_t scanned = 0;
+        btree.scan(cursor, exclusive, [&](std::string_view k, size_t loc) {
+            if (scanned++ == kScanBatch) {
+                more = true;
+                return false;
+            }
+            key.assign(k);
+            return f(key, loc);
+        });
+        cursor = key;
+        exclusive = true;
     }
 }
 
@@ -225,36 +970,226 @@ RetCode Engine::visit(const Key &lower,
     // TODO: your code here
     // LOG(INFO) << "visit(" << lower << ", " << upper << ")";
 
-    std::shared_lock<std::shared_mutex> r_lock(_mutex);
-    std::shared_lock<std::shared_mutex> r_lock2(_mutex2);
-    BTree::BNode* _hot = nullptr;
-    std::vector<size_t> _hot_idx;
-    btree.search(lower, _hot, _hot_idx);
-
-    BTree::BNode* v = _hot;
-    size_t idx = _hot_idx.back();
-    bool end = false;
-
-    FILE* r_fp = fopen(log_filename.c_str(), "r");
-    while (v != nullptr) {
-        while (idx < v->key.size()) {
-            if (v->key[idx] > upper) {
-                end = true;
-                break;
+    RetCode ret = kSucc;
+    std::string value;
+    scan_index(lower, [&](const Key& key, Locator loc) {
+        if (!upper.empty() && key > upper) return false;
+        RetCode r = read_current(key, loc, value);
+        if (r == kNotFound) return true;  // removed since
+        if (r != kSucc) {
+            ret = r;
+            return false;
+        }
+        visitor(key, value);
+        return true;
+    });
+    return ret;
+}
+
+RetCode Engine::visit_keys(const Key &lower,
+                           const Key &upper,
+                           const KeyVisitor &visitor)
+{
+    scan_index(lower, [&](const Key& key, Locator) {
+        if (!upper.empty() && key > upper) return false;
+        visitor(key);
+        return true;
+    });
+    return kSucc;
+}
+
+RetCode Engine::visit_lazy(const Key &lower,
+                           const Key &upper,
+                           const LazyVisitor &visitor)
+{
+    scan_index(lower, [&](const Key& key, Locator loc) {
+        if (!upper.empty() && key > upper) return false;
+        LazyRead value([&](Value &v) { return read_current(key, loc, v); });
+        visitor(key, value);
+        return true;
+    });
+    return kSucc;
+}
+
+static constexpr size_t kParallelVisitBatch = 256;    // keys a worker of parallel_visit() reads per epoch
+static constexpr size_t kPartitionsPerThread = 4;     // so that the workers end about together
+
+// the first keys of the partitions of a parallel_visit()
+static std::vector<Engine::Key> partitions(const BTree<>& index, const Engine::Key& lower,
+                                           const Engine::Key& upper, size_t n_threads)
+{
+    std::vector<Engine::Key> cuts = index.split_keys(lower, upper, n_threads * kPartitionsPerThread);
+    cuts.insert(cuts.begin(), lower);
+    return cuts;
+}
+
+RetCode Engine::parallel_visit(const Key &lower,
+                               const Key &upper,
+                               size_t n_threads,
+                               const PartitionVisitor &visitor)
+{
+    n_threads = std::max<size_t>(n_threads, 1);
+    std::vector<Key> cuts = partitions(btree, lower, upper, n_threads);
+    std::atomic<size_t> next(0);
+    std::atomic<RetCode> ret(kSucc);
+    auto worker = [&] {
+        for (size_t p = next++; p < cuts.size() && ret.load() == kSucc; p = next++) {
+            RetCode r = read_range(cuts[p], p + 1 < cuts.size() ? cuts[p + 1] : Key(), upper, [&](KVBatch& batch) {
+                for (auto& e : batch) visitor(p, e.first, e.second);
+                return ret.load() == kSucc;
+            });
+            RetCode ok = kSucc;
+            if (r != kSucc) ret.compare_exchange_strong(ok, r);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < std::min(n_threads, cuts.size()); t++) workers.emplace_back(worker);
+    worker();
+    for (auto& w : workers) w.join();
+    return ret.load();
+}
+
+/*
+ * The workers take the partitions in order, and the caller visits them in
+ * order. A worker waits while the buffer is full, but for the partition
+ * being visited, which waits on its own bytes only: whichever partition the
+ * caller waits for is being read, or will be by the next worker free.
+ */
+RetCode Engine::parallel_visit(const Key &lower,
+                               const Key &upper,
+                               size_t n_threads,
+                               const Visitor &visitor)
+{
+    n_threads = std::max<size_t>(n_threads, 1);
+    std::vector<Key> cuts = partitions(btree, lower, upper, n_threads);
+    struct Partition {
+        std::deque<KVBatch> batches;
+        size_t bytes = 0;
+        bool done = false;
+        RetCode ret = kSucc;
+    };
+    std::vector<Partition> parts(cuts.size());
+    std::vector<KVBatch> spares;  // visited, for the workers to read into again
+    const size_t budget = n_threads * kParallelVisitBuffer;
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t current = 0, buffered = 0;  // guarded by mutex
+    bool stop = false;
+    std::atomic<size_t> next(0);
+
+    auto worker = [&] {
+        for (size_t p = next++; p < cuts.size(); p = next++) {
+            Partition& part = parts[p];
+            RetCode r = read_range(cuts[p], p + 1 < cuts.size() ? cuts[p + 1] : Key(), upper, [&](KVBatch& batch) {
+                size_t bytes = 0;
+                for (auto& e : batch) bytes += e.first.size() + e.second.size();
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return stop || (p == current ? part.bytes : buffered) < budget; });
+                if (stop) return false;
+                part.batches.push_back(std::move(batch));
+                part.bytes += bytes;
+                buffered += bytes;
+                batch.clear();
+                if (!spares.empty()) {
+                    batch.swap(spares.back());
+                    spares.pop_back();
+                }
+                cv.notify_all();
+                return true;
+            });
+            std::lock_guard<std::mutex> lock(mutex);
+            part.done = true;
+            part.ret = r;
+            cv.notify_all();
+            if (stop) break;
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < std::min(n_threads, cuts.size()); t++) workers.emplace_back(worker);
+
+    RetCode ret = kSucc;
+    KVBatch batch;
+    for (size_t p = 0; p < parts.size() && ret == kSucc; p++) {
+        Partition& part = parts[p];
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!batch.empty()) spares.push_back(std::move(batch));
+                cv.wait(lock, [&] { return !part.batches.empty() || part.done; });
+                if (part.batches.empty()) {
+                    ret = part.ret;
+                    current = p + 1;
+                    cv.notify_all();
+                    break;
+                }
+                batch = std::move(part.batches.front());
+                part.batches.pop_front();
+                for (auto& e : batch) {
+                    part.bytes -= e.first.size() + e.second.size();
+                    buffered -= e.first.size() + e.second.size();
+                }
+                cv.notify_all();
             }
-            fseek(r_fp, v->data[idx], SEEK_SET);
-            std::string key, value;
-            int ret = read_key_value(r_fp, key, value);
-            if (ret != 1) LOG(FATAL) << "cannot get value from log: " << key;
+            for (auto& e : batch) visitor(e.first, e.second);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        cv.notify_all();
+    }
+    for (auto& w : workers) w.join();
+    return ret;
+}
+
+RetCode Engine::read_range(const Key& from, const Key& to, const Key& upper,
+                           const std::function<bool(KVBatch&)>& sink)
+{
+    KVBatch batch;
+    Key cursor = from, key;
+    bool exclusive = false, more = true;
+    RetCode ret = kSucc;
+    while (more && ret == kSucc) {
+        more = false;
+        {
+            EpochGuard guard;
+            size_t scanned = 0, n = 0;  // the entries of batch are reused, their strings kept
+            btree.scan(cursor, exclusive, [&](std::string_view k, size_t loc) {
+                if (to.empty() ? !upper.empty() && k > upper : k >= to) return false;
+                if (scanned++ == kParallelVisitBatch) {
+                    more = true;
+                    return false;
+                }
+                key.assign(k);
+                if (n == batch.size()) batch.emplace_back();
+                batch[n].first.assign(key);
+                RetCode r = read_current(key, loc, batch[n].second);
+                if (r == kSucc) n++;
+                else if (r != kNotFound) ret = r;  // else removed since
+                return r == kSucc || r == kNotFound;
+            });
+            batch.resize(n);
+        }
+        cursor = key;
+        exclusive = true;
+        if (!batch.empty() && !sink(batch)) break;
+    }
+    return ret;
+}
 
-            visitor(key, value);
-            idx += 1;
+RetCode Engine::read_current(const Key& key, Locator loc, Value& value)
+{
+    while (!read_value(loc, key, value, true)) {
+        Locator again = btree.search(key);
+        if (again == Index::kNotFound) return kNotFound;  // removed since
+        if (again == loc) {
+            LOG(ERROR) << "bad record at offset " << locator_offset(loc) << " of log segment "
+                       << locator_segment(loc) << " for key: " << key;
+            value.clear();
+            return kCorruption;
         }
-        if (end) break;
-        v = v->next;
-        idx = 0;
+        loc = again;  // moved by a gc
     }
-    fclose(r_fp);
     return kSucc;
 }
 
@@ -262,65 +1197,576 @@ RetCode Engine::garbage_collect()
 {
     // TODO: your code here
     // LOG(INFO) << "garbage_collect";
-    auto f = std::async(&Engine::_gc, this);
+    request_gc(true);
     return kSucc;
 }
 
-void Engine::_gc()
+void Engine::wait_gc()
 {
-    // create another new log file
-    std::lock_guard<std::mutex> gc_lock(_mutex_gc);
-    std::shared_lock<std::shared_mutex> r_lock(_mutex);
-    std::vector<size_t> _offset;
-    _offset.reserve(btree.size() + 1);
+    std::unique_lock<std::mutex> lk(_mutex_gc);
+    _gc_cv.wait(lk, [this] { return !_gc_requested && !_checkpoint_requested && !_gc_running; });
+}
 
-    BTree::BNode* first_c = btree.get_root();
-    while (!first_c->is_leaf) first_c = first_c->child[0];
-    BTree::BNode* v = first_c;
+Engine::SpaceUsage Engine::space_usage()
+{
+    std::lock_guard<std::mutex> log_lock(_log_mutex);
+    SpaceUsage space{0, 0};
+    for (auto& it : _usage) {
+        space.log_bytes += it.second.bytes;
+        space.live_bytes += it.second.live;
+    }
+    return space;
+}
+
+/*
+ * the usage of every segment of the manifest, on open: each record the
+ * index points to is live, the rest of the log is garbage
+ */
+void Engine::account_segments()
+{
+    for (SegmentId id : _manifest.segments()) {
+        struct stat st;
+        if (id == _manifest.active_segment()) _usage[id].bytes = log_offset;
+        else if (stat((_path + Manifest::segment_name(id)).c_str(), &st) == 0) _usage[id].bytes = st.st_size;
+    }
+    SegmentId last = kMaxSegmentId + 1;
+    SegmentUsage* usage = nullptr;
+    btree.for_each([&](std::string_view key, size_t loc) {
+        if (locator_segment(loc) != last) {
+            last = locator_segment(loc);
+            usage = &_usage[last];
+        }
+        usage->live += locator_record_size(loc, key.size());
+    });
+}
+
+// the record of a key key_size long at loc was overwritten or removed, caller holds _log_mutex
+void Engine::mark_dead(Locator loc, size_t key_size)
+{
+    auto it = _usage.find(locator_segment(loc));
+    if (it == _usage.end()) return;
+    it->second.live -= std::min(it->second.live, locator_record_size(loc, key_size));
+}
+
+/*
+ * caller holds _log_mutex, before a write of key changes the index: the
+ * first one since the newest snapshot logs where key was
+ */
+void Engine::log_undo(const Key& key)
+{
+    if (_generation->undo.search(key) != Index::kNotFound) return;
+    Locator loc = btree.search(key);
+    _generation->undo.insert(key, loc == Index::kNotFound ? kAbsent : loc);
+    if (loc != Index::kNotFound) _pins[locator_segment(loc)]++;
+}
+
+// caller holds _log_mutex: an undo log let go of the record at loc
+void Engine::unpin(Locator loc)
+{
+    SegmentId id = locator_segment(loc);
+    auto it = _pins.find(id);
+    if (it == _pins.end() || --it->second > 0) return;
+    _pins.erase(it);
+    if (_retained.erase(id) == 0) return;
+
+    // gc took it out of the manifest already
+    SegmentTable* table = new SegmentTable(*_segments.load());
+    table->erase(id);
+    publish_segments(table);
+    std::remove((_path + Manifest::segment_name(id)).c_str());
+}
 
-    std::string log_filename1(log_filename + "(1)");
-    FILE* r_fp = fopen(log_filename.c_str(), "r");
-    FILE* w_fp = fopen(log_filename1.c_str(), "a");
-    size_t off = 0;
-    while (v != nullptr) {
-        for (size_t i = 0; i < v->key.size(); i++) {
-            fseek(r_fp, v->data[i], SEEK_SET);
-            std::string line;
-            read_line(r_fp, line);
-            log_line(w_fp, line);
+// queue a gc; requests while one is queued fold into it
+void Engine::request_gc(bool full)
+{
+    std::lock_guard<std::mutex> lk(_mutex_gc);
+    if (_gc_closing) return;
+    _gc_requested = true;
+    _gc_full |= full;
+    if (!_gc_thread.joinable()) _gc_thread = std::thread(&Engine::gc_loop, this);
+    _gc_cv.notify_all();
+}
 
-            // v->data[i] = off;
-            _offset.emplace_back(off);
-            off += line.size();
+// queue a checkpoint of the index on _gc_thread
+void Engine::request_checkpoint()
+{
+    std::lock_guard<std::mutex> lk(_mutex_gc);
+    if (_gc_closing) return;
+    _checkpoint_requested = true;
+    if (!_gc_thread.joinable()) _gc_thread = std::thread(&Engine::gc_loop, this);
+    _gc_cv.notify_all();
+}
+
+/*
+ * caller holds _log_mutex (or is the constructor): queue a gc if the log
+ * is over gc_space_amplification times its live bytes, unless one is
+ * queued or running already
+ */
+void Engine::maybe_schedule_gc()
+{
+    if (_options.gc_space_amplification <= 0) return;
+    size_t bytes = 0, live = 0;
+    for (auto& it : _usage) {
+        bytes += it.second.bytes;
+        live += it.second.live;
+    }
+    if (bytes - live < _options.segment_size || bytes <= _options.gc_space_amplification * live) return;
+    {
+        std::lock_guard<std::mutex> lk(_mutex_gc);
+        if (_gc_requested || _gc_running) return;
+    }
+    request_gc(false);
+}
+
+/*
+ * caller holds _log_mutex: the sealed segments to compact. Copying a
+ * segment costs its live bytes and frees its garbage, so they go by
+ * their share of garbage, the most first: for a full gc all those with
+ * any, else those with gc_garbage_ratio or more, and then as many as it
+ * takes to bring the log under gc_space_amplification.
+ */
+std::vector<SegmentId> Engine::pick_victims(bool full)
+{
+    size_t bytes = 0, live = 0;
+    std::vector<std::pair<double, SegmentId>> sealed;
+    for (SegmentId id : _manifest.segments()) {
+        const SegmentUsage& u = _usage[id];
+        bytes += u.bytes;
+        live += u.live;
+        if (id != _manifest.active_segment() && u.bytes > u.live && !_pins.count(id)) {
+            sealed.emplace_back((double)(u.bytes - u.live) / u.bytes, id);
         }
-        v = v->next;
     }
-    _offset.emplace_back(off);
-    fclose(w_fp);
-    fclose(r_fp);
+    std::sort(sealed.rbegin(), sealed.rend());
 
-    // update btree indexing
-    std::lock_guard<std::shared_mutex> w_lock2(_mutex2);
-    v = first_c;
-    size_t _off_idx = 0;
-    while (v != nullptr) {
-        for (size_t i = 0; i < v->key.size(); i++) {
-            v->data[i] = _offset[_off_idx];
-            _off_idx += 1;
+    std::vector<SegmentId> victims;
+    for (auto& it : sealed) {
+        bool over = bytes > _options.gc_space_amplification * live;
+        if (!full && it.first < _options.gc_garbage_ratio && !over) break;
+        victims.push_back(it.second);
+        bytes -= _usage[it.second].bytes - _usage[it.second].live;
+    }
+    return victims;
+}
+
+void Engine::gc_loop()
+{
+    std::unique_lock<std::mutex> lk(_mutex_gc);
+    while (true) {
+        _gc_cv.wait(lk, [this] { return _gc_requested || _checkpoint_requested || _gc_closing; });
+        if (!_gc_requested && !_checkpoint_requested) break;  // what was asked for before the close still runs
+        bool gc = _gc_requested, full = _gc_full, checkpoint = _checkpoint_requested;
+        _gc_requested = _gc_full = _checkpoint_requested = false;
+        _gc_running = true;
+        lk.unlock();
+        // a gc drops the checkpoint, the new one is written right away
+        if (gc && _gc(full)) checkpoint |= _options.index_checkpoint;
+        if (checkpoint) write_checkpoint();
+        lk.lock();
+        _gc_running = false;
+        _gc_cv.notify_all();
+    }
+}
+
+static void write_full(real_storage::File& f, const char* p, size_t size)
+{
+    size_t s = 0;
+    while (s < size) {
+        ssize_t n = f.write(p + s, size - s);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) LOG(FATAL) << "cannot append to log segment: " << f.pathname() << ", errno: " << errno;
+        s += n;
+    }
+}
+
+static void append_full(real_storage::File& f, std::string& buf)
+{
+    write_full(f, buf.data(), buf.size());
+    buf.clear();
+}
+
+/*
+ * compaction, on _gc_thread: the victims (see pick_victims(), a full gc
+ * first seals the active segment to take it in too) are rewritten with
+ * their live records only, while writes go on into the active segment.
+ * Without a lock, the locators of the live records are collected from
+ * the index, sorted by their place in the log and copied in that order,
+ * streaming each victim in large reads. Once a new segment is on disk
+ * it is published, then its keys move over to it kGcMoveBatch at a time
+ * under _log_mutex, each only if it was not written meanwhile.
+ *
+ * With gc_cluster_keys, a full gc takes every sealed segment (but those
+ * a snapshot pins) and writes the records in key order instead: each gets
+ * its place in the new segments up front, then each new segment is
+ * filled in memory from its records, read in log order, and written out
+ * whole. The log then starts with a key-clustered base, which a visit()
+ * reads in long runs.
+ *
+ * At the end the new segments replace the victims in the manifest,
+ * right before the segment which was active at the start: a copy is
+ * newer than any other record of its key before there, and one which
+ * lost to a write is older than it.
+ *
+ * A tombstone hides the older records of its key, which may sit in
+ * segments kept: those of the victims after the first segment kept are
+ * carried over, unless the key was written since.
+ *
+ * A victim which a snapshot pinned meanwhile leaves the manifest with the
+ * others, but stays readable until the snapshot is gone, see unpin().
+ */
+bool Engine::_gc(bool full)
+{
+    bool cluster = full && _options.gc_cluster_keys;
+    std::vector<SegmentId> victims, tombstone_sources;
+    std::vector<uint32_t> rank;  // of victims[i] in log order
+    SegmentId before;
+    {
+        std::lock_guard<std::mutex> log_lock(_log_mutex);
+        if (full) rotate_segment();
+        // a clustered gc rewrites every sealed segment into the base
+        if (cluster) {
+            for (SegmentId id : _manifest.segments()) {
+                if (id != _manifest.active_segment() && !_pins.count(id)) victims.push_back(id);
+            }
+        }
+        else {
+            victims = pick_victims(full);
+        }
+        if (victims.empty()) return false;
+        std::sort(victims.begin(), victims.end());
+        rank.resize(victims.size());
+        bool prefix = true;
+        uint32_t n = 0;
+        for (SegmentId id : _manifest.segments()) {
+            auto it = std::lower_bound(victims.begin(), victims.end(), id);
+            bool victim = it != victims.end() && *it == id;
+            if (victim) rank[it - victims.begin()] = n++;
+            if (!victim) prefix = false;
+            else if (!prefix) tombstone_sources.push_back(id);
+        }
+        before = _manifest.active_segment();
+    }
+    auto is_victim = [&victims](SegmentId id) { return std::binary_search(victims.begin(), victims.end(), id); };
+
+    struct Move {
+        Key key;
+        Locator from, to;
+    };
+    std::vector<Move> moves;  // into the segment being written
+    std::vector<SegmentId> new_segments;
+    real_storage::File w_file(-1, "");
+    std::string buf, record;
+    size_t off = 0, kept = 0;  // kept: tombstone bytes in the segment being written
+
+    auto finish_segment = [&] {
+        append_full(w_file, buf);
+        if (w_file.fdatasync() != 0) LOG(FATAL) << "cannot sync log segment: " << w_file.pathname();
+        w_file.close();
+        {
+            // readers may find the new locators from here on
+            std::lock_guard<std::mutex> log_lock(_log_mutex);
+            SegmentTable* table = new SegmentTable(*_segments.load());
+            table->emplace(new_segments.back(), open_segment(new_segments.back(), false));
+            publish_segments(table);
+            _usage[new_segments.back()] = SegmentUsage{off, kept};
+        }
+        // in key order, each batch on a few leaves
+        std::sort(moves.begin(), moves.end(), [](const Move& a, const Move& b) { return a.key < b.key; });
+        for (size_t i = 0; i < moves.size(); i += kGcMoveBatch) {
+            std::lock_guard<std::mutex> log_lock(_log_mutex);
+            SegmentUsage& usage = _usage[new_segments.back()];
+            for (size_t j = i; j < std::min(moves.size(), i + kGcMoveBatch); j++) {
+                if (btree.replace(moves[j].key, moves[j].from, moves[j].to)) {
+                    usage.live += locator_record_size(moves[j].to, moves[j].key.size());
+                }
+            }
+        }
+        moves.clear();
+    };
+    // the next record goes to offset off of the segment being written
+    auto make_room = [&] {
+        if (w_file.valid() && off < _options.segment_size) return;
+        if (w_file.valid()) finish_segment();
+        {
+            std::lock_guard<std::mutex> log_lock(_log_mutex);
+            new_segments.push_back(_manifest.allocate_id());
+        }
+        w_file = _file_pool.open(Manifest::segment_name(new_segments.back()).c_str(), false, true, true);
+        if (!w_file.valid()) LOG(FATAL) << "cannot create log segment: " << w_file.pathname();
+        off = kept = 0;
+    };
+    auto append = [&](const char* r, size_t size) {
+        buf.append(r, size);
+        off += size;
+        if (buf.size() >= kMaxGroupBytes) append_full(w_file, buf);
+    };
+
+    std::set<Key> carried;
+    for (SegmentId id : tombstone_sources) {
+        std::vector<std::pair<Key, Locator>> records;
+        size_t file_size;
+        scan_segment(id, 0, records, file_size);
+        for (auto& r : records) {
+            if (r.second != Index::kNotFound || carried.count(r.first)) continue;
+            {
+                EpochGuard guard;
+                if (btree.search(r.first) != Index::kNotFound) continue;
+            }
+            carried.insert(r.first);
+            RecordHeader header;
+            header.encode(r.first, nullptr);
+            record.assign((const char*)&header, sizeof(header));
+            record.append(r.first);
+            make_room();
+            kept += record.size();
+            append(record.data(), record.size());
         }
-        v = v->next;
     }
+    std::set<Key>().swap(carried);
 
-    // delete old log and rename new log
-    std::remove(log_filename.c_str());
-    std::rename(log_filename1.c_str(), log_filename.c_str());
-    log_offset = _offset.back();
+    // the live records of the victims, in key order
+    struct Live {
+        uint32_t rank;  // of the segment among the victims, in log order
+        uint32_t key_size;
+        Locator loc;
+    };
+    std::vector<Live> live;
+    Key from;
+    bool exclusive = false, done = false;
+    while (!done) {
+        done = true;
+        size_t seen = 0;
+        EpochGuard guard;
+        btree.scan(from, exclusive, [&](std::string_view key, size_t loc) {
+            auto it = std::lower_bound(victims.begin(), victims.end(), locator_segment(loc));
+            if (it != victims.end() && *it == locator_segment(loc)) {
+                live.push_back(Live{rank[it - victims.begin()], (uint32_t)key.size(), loc});
+            }
+            if (++seen < kGcScanBatch) return true;
+            from.assign(key);
+            done = false;
+            return false;
+        });
+        exclusive = true;
+    }
+    auto log_order = [&live](uint32_t a, uint32_t b) {
+        const Live &x = live[a], &y = live[b];
+        return x.rank != y.rank ? x.rank < y.rank : locator_offset(x.loc) < locator_offset(y.loc);
+    };
+
+    /*
+     * the victims streamed in log order, through windows of up to
+     * kGcReadBytes read at once (records less than kGcReadGap apart share
+     * one): emit(i, record) for each of the live records of order, checked
+     */
+    auto stream = [&](const std::vector<uint32_t>& order,
+                      const std::function<void(size_t, const char*, const RecordHeader&)>& emit) {
+        std::string window;
+        real_storage::File reader(-1, "");  // of the victim being read, opened for the stream only
+        for (size_t n = 0; n < order.size();) {
+            const Live& first = live[order[n]];
+            SegmentId id = locator_segment(first.loc);
+            size_t start = locator_offset(first.loc);
+            size_t end = start + locator_record_size(first.loc, first.key_size);
+            size_t m = n + 1;
+            for (; m < order.size() && live[order[m]].rank == first.rank; m++) {
+                size_t offset = locator_offset(live[order[m]].loc);
+                size_t next_end = offset + locator_record_size(live[order[m]].loc, live[order[m]].key_size);
+                if (offset - end > kGcReadGap || next_end - start > kGcReadBytes) break;
+                end = next_end;
+            }
+            if (n == 0 || id != locator_segment(live[order[n - 1]].loc)) {
+                if (reader.valid()) reader.close();
+                reader = _file_pool.open(Manifest::segment_name(id).c_str(), false, false, false);
+                if (!reader.valid()) LOG(FATAL) << "cannot open log segment: " << reader.pathname();
+            }
+            window.resize(end - start);
+            if (!pread_full(reader, &window[0], window.size(), start)) {
+                LOG(FATAL) << "cannot read log segment: " << reader.pathname() << ", errno: " << errno;
+            }
+
+            for (; n < m; n++) {
+                const Live& l = live[order[n]];
+                const char* p = window.data() + locator_offset(l.loc) - start;
+                RecordHeader header;
+                memcpy(&header, p, sizeof(header));
+                const char* key = p + sizeof(header);
+                if (!header.plausible() || header.type != kTypeValue || header.key_size != l.key_size ||
+                    header.value_size != locator_value_size(l.loc) ||
+                    header.crc != header.compute_crc(key, key + header.key_size)) {
+                    LOG(FATAL) << "bad record at offset " << locator_offset(l.loc) << " of log segment " << id;
+                }
+                emit(order[n], p, header);
+            }
+        }
+        if (reader.valid()) reader.close();
+    };
+
+    if (!cluster) {
+        std::vector<uint32_t> order(live.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), log_order);
+        stream(order, [&](size_t i, const char* p, const RecordHeader& header) {
+            make_room();
+            Locator to = make_locator(new_segments.back(), off, header.value_size);
+            moves.push_back(Move{Key(p + sizeof(header), header.key_size), live[i].loc, to});
+            append(p, header.record_size());
+        });
+        if (w_file.valid()) finish_segment();
+    }
+    else {
+        if (w_file.valid()) finish_segment();  // the tombstones carried over
+        // the place of every record in the new segments, in key order:
+        // those of base[k] are live[firsts[k]] up to live[firsts[k + 1]]
+        std::vector<SegmentId> base;
+        std::vector<size_t> sizes, firsts;
+        std::vector<Locator> to(live.size());
+        for (size_t i = 0; i < live.size(); i++) {
+            if (sizes.empty() || sizes.back() >= _options.segment_size) {
+                std::lock_guard<std::mutex> log_lock(_log_mutex);
+                base.push_back(_manifest.allocate_id());
+                sizes.push_back(0);
+                firsts.push_back(i);
+            }
+            to[i] = make_locator(base.back(), sizes.back(), locator_value_size(live[i].loc));
+            sizes.back() += locator_record_size(live[i].loc, live[i].key_size);
+        }
+        firsts.push_back(live.size());
+
+        // the space of the whole base first: a full disk fails the gc, before anything moved
+        for (size_t k = 0; k < base.size(); k++) {
+            std::string filename = _path + Manifest::segment_name(base[k]);
+            int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            int err = fd < 0 ? errno : posix_fallocate(fd, 0, sizes[k]);
+            if (fd >= 0) ::close(fd);
+            if (err == 0) continue;
+            LOG(ERROR) << "cannot allocate log segment: " << filename << ", errno: " << err << ", gc given up";
+            for (size_t j = 0; j <= k; j++) std::remove((_path + Manifest::segment_name(base[j])).c_str());
+            {
+                std::lock_guard<std::mutex> log_lock(_log_mutex);
+                SegmentTable* table = new SegmentTable(*_segments.load());
+                for (SegmentId id : new_segments) {
+                    table->erase(id);
+                    _usage.erase(id);
+                }
+                publish_segments(table);
+            }
+            for (SegmentId id : new_segments) std::remove((_path + Manifest::segment_name(id)).c_str());
+            return false;
+        }
+
+        /*
+         * then one segment at a time: its records read in log order into
+         * a buffer of its size, at their places, and written out at once.
+         * The output goes to disk once and in order, in segment_size of
+         * memory whatever the size of the base.
+         */
+        std::string buf;
+        Key key;
+        for (size_t k = 0; k < base.size(); k++) {
+            std::vector<uint32_t> order(firsts[k + 1] - firsts[k]);
+            for (size_t i = 0; i < order.size(); i++) order[i] = firsts[k] + i;
+            std::sort(order.begin(), order.end(), log_order);
+            buf.resize(sizes[k]);
+            stream(order, [&](size_t i, const char* p, const RecordHeader& header) {
+                memcpy(&buf[locator_offset(to[i])], p, header.record_size());
+            });
+            w_file = _file_pool.open(Manifest::segment_name(base[k]).c_str(), false, false, false);
+            if (!w_file.valid()) LOG(FATAL) << "cannot open log segment: " << w_file.pathname();
+            write_full(w_file, buf.data(), buf.size());
+            if (w_file.fdatasync() != 0) LOG(FATAL) << "cannot sync log segment: " << w_file.pathname();
+            w_file.close();
+            {
+                std::lock_guard<std::mutex> log_lock(_log_mutex);
+                SegmentTable* table = new SegmentTable(*_segments.load());
+                table->emplace(base[k], open_segment(base[k], false));
+                publish_segments(table);
+                _usage[base[k]] = SegmentUsage{sizes[k], 0};
+            }
+            for (size_t i = firsts[k]; i < firsts[k + 1]; i += kGcMoveBatch) {
+                std::lock_guard<std::mutex> log_lock(_log_mutex);
+                for (size_t j = i; j < std::min(firsts[k + 1], i + kGcMoveBatch); j++) {
+                    key.assign(&buf[locator_offset(to[j]) + sizeof(RecordHeader)], live[j].key_size);
+                    if (btree.replace(key, live[j].loc, to[j])) {
+                        _usage[base[k]].live += locator_record_size(to[j], key.size());
+                    }
+                }
+            }
+        }
+        new_segments.insert(new_segments.end(), base.begin(), base.end());
+    }
+
+    {
+        std::lock_guard<std::mutex> log_lock(_log_mutex);
+        std::vector<SegmentId> segments;
+        for (SegmentId id : _manifest.segments()) {
+            if (id == before) segments.insert(segments.end(), new_segments.begin(), new_segments.end());
+            if (!is_victim(id)) segments.push_back(id);
+        }
+        // the checkpoint points into the victims: gone before them (the
+        // manifest syncs the directory), gc_loop() writes the next one
+        IndexCheckpoint(_path).remove();
+        _manifest.set_segments(segments);
+        _manifest.save();
+
+        // a reader still on an old table reads on, the mapping also lives
+        // while a ValueView holds it
+        SegmentTable* table = new SegmentTable(*_segments.load());
+        for (SegmentId id : victims) {
+            _usage.erase(id);
+            if (_pins.count(id)) _retained.insert(id);
+            else table->erase(id);
+        }
+        publish_segments(table);
+        victims.erase(std::remove_if(victims.begin(), victims.end(),
+                                     [this](SegmentId id) { return _retained.count(id) > 0; }),
+                      victims.end());
+    }
+    for (SegmentId id : victims) {
+        std::remove((_path + Manifest::segment_name(id)).c_str());
+    }
+    return true;
+}
+
+std::unique_ptr<IROEngine::Iterator> Engine::new_iterator()
+{
+    std::shared_ptr<Engine> self = weak_from_this().lock();
+    if (!self) {
+        LOG(ERROR) << "new_iterator() of an engine not owned by a shared_ptr";
+        return nullptr;
+    }
+    return std::make_unique<EngineIterator>(self);
 }
 
 std::shared_ptr<IROEngine> Engine::snapshot()
 {
     // TODO: your code here
-    return nullptr;
+    std::shared_ptr<Engine> self = weak_from_this().lock();
+    if (!self) {
+        LOG(ERROR) << "snapshot() of an engine not owned by a shared_ptr";
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> log_lock(_log_mutex);
+    // snapshots with no write in between share a generation
+    if (_generation && _generation->undo.size() == 0) {
+        return std::make_shared<Snapshot>(self, _generation->shared_from_this());
+    }
+    auto generation = std::make_shared<Generation>(this);
+    if (_generation) {
+        _generation->newer = generation;
+        _generation->next.store(generation.get(), std::memory_order_release);
+    }
+    _generation = generation.get();
+    return std::make_shared<Snapshot>(self, generation);
+}
+
+// caller holds _log_mutex, see Snapshot::~Snapshot()
+Engine::Generation::~Generation()
+{
+    undo.for_each([this](std::string_view, size_t loc) {
+        if (loc != kAbsent) engine->unpin(loc);
+    });
+    if (engine->_generation == this) engine->_generation = nullptr;
 }
 
 }  // namespace kvs
@@ -0,0 +1,106 @@
+#include "epoch.h"
+
+namespace kvs
+{
+EpochManager &EpochManager::global()
+{
+    // never destroyed: engines living in globals still retire at exit
+    static EpochManager *manager = new EpochManager();
+    return *manager;
+}
+
+EpochManager::~EpochManager()
+{
+    // no reader is left
+    for (auto &r : _retired) r.deleter(r.p);
+    for (Slot *s : _slots) delete s;
+}
+
+/*
+ * the slot of the calling thread, given back when the thread exits
+ */
+struct SlotOwner {
+    EpochManager::Slot *slot{nullptr};
+    ~SlotOwner()
+    {
+        if (slot) slot->in_use.store(false, std::memory_order_release);
+    }
+};
+
+EpochManager::Slot *EpochManager::slot()
+{
+    thread_local SlotOwner owner;
+    if (owner.slot) return owner.slot;
+
+    std::lock_guard<std::mutex> lk(_slots_mutex);
+    for (Slot *s : _slots) {
+        bool expected = false;
+        if (s->in_use.compare_exchange_strong(expected, true)) {
+            owner.slot = s;
+            return s;
+        }
+    }
+    owner.slot = new Slot();
+    owner.slot->in_use.store(true);
+    _slots.push_back(owner.slot);
+    return owner.slot;
+}
+
+void EpochManager::enter()
+{
+    Slot *s = slot();
+    if (s->depth++ > 0) return;
+    // seq_cst: the announcement is visible before any load of the reader
+    s->epoch.store(_epoch.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+}
+
+void EpochManager::leave()
+{
+    Slot *s = slot();
+    if (--s->depth > 0) return;
+    s->epoch.store(kInactive, std::memory_order_release);
+}
+
+void EpochManager::retire(void *p, Deleter deleter)
+{
+    std::lock_guard<std::mutex> lk(_retired_mutex);
+    _retired.push_back({_epoch.load(std::memory_order_relaxed), p, deleter});
+    if (_retired.size() % kReclaimEvery == 0) reclaim_locked();
+}
+
+size_t EpochManager::reclaim()
+{
+    std::lock_guard<std::mutex> lk(_retired_mutex);
+    return reclaim_locked();
+}
+
+size_t EpochManager::reclaim_locked()
+{
+    // readers entering from now on announce a later epoch than anything retired so far
+    _epoch.fetch_add(1, std::memory_order_seq_cst);
+
+    uint64_t oldest = kInactive;
+    {
+        std::lock_guard<std::mutex> lk(_slots_mutex);
+        for (Slot *s : _slots) {
+            uint64_t e = s->epoch.load(std::memory_order_seq_cst);
+            if (e < oldest) oldest = e;
+        }
+    }
+
+    size_t kept = 0, freed = 0;
+    for (size_t i = 0; i < _retired.size(); i++) {
+        Retired &r = _retired[i];
+        if (r.epoch < oldest) {
+            r.deleter(r.p);
+            freed++;
+        }
+        else {
+            _retired[kept++] = r;
+        }
+    }
+    _retired.resize(kept);
+    return freed;
+}
+
+}  // namespace kvs
@@ -0,0 +1,172 @@
+#include "index_checkpoint.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "crc32c.h"
+#include "glog/logging.h"
+
+namespace kvs
+{
+static constexpr const char *kCheckpointName = "INDEX";
+static constexpr const char *kCheckpointTmpName = "INDEX.tmp";
+static constexpr uint64_t kCheckpointMagic = 0x4b56532d494e4458ull;  // "KVS-INDX"
+static constexpr uint32_t kCheckpointVersion = 1;
+
+struct CheckpointHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t segment_count;
+    uint64_t offset;
+};
+struct CheckpointTrailer {
+    uint64_t count;
+    uint32_t crc;
+} __attribute__((packed));
+
+IndexCheckpoint::IndexCheckpoint(const std::string &dir) : _dir(dir)
+{
+    if (_dir.empty() || _dir.back() != '/') _dir.push_back('/');
+}
+
+IndexCheckpoint::~IndexCheckpoint()
+{
+    if (_fp) fclose(_fp);
+    close();
+}
+
+void IndexCheckpoint::write(const void *p, size_t n)
+{
+    if (fwrite(p, 1, n, _fp) != n) {
+        LOG(FATAL) << "cannot write index checkpoint: " << _dir << kCheckpointTmpName << ", errno: " << errno;
+    }
+    _crc = crc32c::extend(_crc, (const char *)p, n);
+}
+
+void IndexCheckpoint::begin(const std::vector<SegmentId> &segments, size_t offset)
+{
+    std::string tmp = _dir + kCheckpointTmpName;
+    _fp = fopen(tmp.c_str(), "w");
+    if (!_fp) LOG(FATAL) << "cannot create index checkpoint: " << tmp << ", errno: " << errno;
+    setvbuf(_fp, nullptr, _IOFBF, 1 << 20);
+
+    _segments = segments;
+    _offset = offset;
+    _count = 0;
+    _crc = 0;
+    CheckpointHeader header{kCheckpointMagic, kCheckpointVersion, (uint32_t)segments.size(), offset};
+    write(&header, sizeof(header));
+    write(segments.data(), segments.size() * sizeof(SegmentId));
+}
+
+void IndexCheckpoint::add(std::string_view key, Locator loc)
+{
+    uint32_t size = key.size();
+    write(&size, sizeof(size));
+    write(key.data(), key.size());
+    write(&loc, sizeof(loc));
+    _count++;
+}
+
+void IndexCheckpoint::commit()
+{
+    uint64_t count = _count;
+    write(&count, sizeof(count));
+    uint32_t crc = _crc;
+    write(&crc, sizeof(crc));
+
+    std::string tmp = _dir + kCheckpointTmpName;
+    if (fflush(_fp) != 0 || fsync(fileno(_fp)) != 0) {
+        LOG(FATAL) << "cannot write index checkpoint: " << tmp << ", errno: " << errno;
+    }
+    fclose(_fp);
+    _fp = nullptr;
+
+    std::string filename = _dir + kCheckpointName;
+    if (rename(tmp.c_str(), filename.c_str()) != 0) {
+        LOG(FATAL) << "cannot install index checkpoint: " << filename << ", errno: " << errno;
+    }
+    int dir_fd = ::open(_dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0 || fsync(dir_fd) != 0) {
+        LOG(FATAL) << "cannot sync directory: " << _dir << ", errno: " << errno;
+    }
+    ::close(dir_fd);
+}
+
+bool IndexCheckpoint::load()
+{
+    close();
+    unlink((_dir + kCheckpointTmpName).c_str());  // an interrupted write
+    std::string filename = _dir + kCheckpointName;
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CheckpointHeader) + sizeof(CheckpointTrailer)) {
+        ::close(fd);
+        LOG(WARNING) << "ignoring truncated index checkpoint: " << filename;
+        return false;
+    }
+    _map_size = st.st_size;
+    void *map = mmap(nullptr, _map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        LOG(WARNING) << "cannot map index checkpoint: " << filename << ", errno: " << errno;
+        return false;
+    }
+    _map = (const char *)map;
+    madvise(map, _map_size, MADV_SEQUENTIAL);
+
+    CheckpointHeader header;
+    memcpy(&header, _map, sizeof(header));
+    CheckpointTrailer trailer;
+    memcpy(&trailer, _map + _map_size - sizeof(trailer), sizeof(trailer));
+    size_t segments_end = sizeof(header) + (size_t)header.segment_count * sizeof(SegmentId);
+    if (header.magic != kCheckpointMagic || header.version != kCheckpointVersion || header.segment_count == 0 ||
+        segments_end > _map_size - sizeof(trailer) ||
+        trailer.crc != crc32c::value(_map, _map_size - sizeof(trailer.crc))) {
+        LOG(WARNING) << "ignoring damaged index checkpoint: " << filename;
+        close();
+        return false;
+    }
+    _segments.resize(header.segment_count);
+    memcpy(_segments.data(), _map + sizeof(header), header.segment_count * sizeof(SegmentId));
+    _offset = header.offset;
+    _count = trailer.count;
+    _cursor = _map + segments_end;
+    return true;
+}
+
+std::pair<std::string_view, Locator> IndexCheckpoint::next()
+{
+    const char *end = _map + _map_size - sizeof(CheckpointTrailer);
+    uint32_t size;
+    Locator loc;
+    CHECK_LE(_cursor + sizeof(size), end);
+    memcpy(&size, _cursor, sizeof(size));
+    CHECK_LE(_cursor + sizeof(size) + size + sizeof(loc), end);
+    std::string_view key(_cursor + sizeof(size), size);
+    memcpy(&loc, _cursor + sizeof(size) + size, sizeof(loc));
+    _cursor += sizeof(size) + size + sizeof(loc);
+    return {key, loc};
+}
+
+void IndexCheckpoint::close()
+{
+    if (_map) munmap(const_cast<char *>(_map), _map_size);
+    _map = nullptr;
+    _cursor = nullptr;
+}
+
+void IndexCheckpoint::remove()
+{
+    std::string filename = _dir + kCheckpointName;
+    if (unlink(filename.c_str()) != 0 && errno != ENOENT) {
+        LOG(FATAL) << "cannot remove index checkpoint: " << filename << ", errno: " << errno;
+    }
+}
+
+}  // namespace kvs
@@ -0,0 +1,80 @@
+#include "iterator.h"
+
+#include <algorithm>
+
+namespace kvs
+{
+static constexpr size_t kIteratorBatch = 128;  // keys an EngineIterator copies per seek of the index
+
+void IndexIterator::load(const Key &from, bool exclusive, bool reverse)
+{
+    _entries.clear();
+    fill(from, exclusive, reverse, _entries);
+    if (reverse) std::reverse(_entries.begin(), _entries.end());
+    _idx = reverse && !_entries.empty() ? _entries.size() - 1 : 0;
+}
+
+void IndexIterator::seek(const Key &key)
+{
+    load(key, false, false);
+}
+
+void IndexIterator::seek_to_last()
+{
+    load("", false, true);
+}
+
+void IndexIterator::next()
+{
+    if (!valid() || ++_idx < _entries.size()) return;
+    Key last = std::move(_entries.back().first);
+    load(last, true, false);
+}
+
+void IndexIterator::prev()
+{
+    if (!valid()) return;
+    if (_idx > 0) {
+        _idx--;
+        return;
+    }
+    Key first = std::move(_entries.front().first);
+    if (first.empty()) {  // nothing is before ""
+        _entries.clear();
+        return;
+    }
+    load(first, true, true);
+}
+
+void EngineIterator::fill(const Key &from, bool exclusive, bool reverse, std::vector<Entry> &entries)
+{
+    auto f = [&entries](std::string_view key, size_t loc) {
+        entries.emplace_back(Key(key), loc);
+        return entries.size() < kIteratorBatch;
+    };
+    if (reverse) _engine->btree.scan_reverse(from, exclusive, f);
+    else _engine->btree.scan(from, exclusive, f);
+}
+
+// the value as of now: the key may have been written since the copy
+RetCode EngineIterator::read(const Key &key, Locator, Value &value)
+{
+    EpochGuard guard;
+    Locator loc = _engine->btree.search(key);
+    if (loc == Engine::Index::kNotFound) return kNotFound;
+    return _engine->read_current(key, loc, value);
+}
+
+void SnapshotIterator::fill(const Key &from, bool exclusive, bool reverse, std::vector<Entry> &entries)
+{
+    EpochGuard guard;
+    _snapshot->collect(from, exclusive, reverse, entries);
+}
+
+RetCode SnapshotIterator::read(const Key &key, Locator loc, Value &value)
+{
+    EpochGuard guard;
+    return _snapshot->read(key, loc, value, true);
+}
+
+}  // namespace kvs
@@ -0,0 +1,112 @@
+#include "key_prefix.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace kvs
+{
+namespace prefix
+{
+/*
+ * each prefix is loaded once and counted as below p, above p, or neither:
+ * a prefix changed meanwhile cannot be counted twice
+ */
+void count_portable(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal)
+{
+    size_t lt = 0, gt = 0;
+    for (size_t i = 0; i < n; i++) {
+        int64_t x = a[i];
+        lt += x < p;
+        gt += x > p;
+    }
+    less = lt;
+    less_equal = n - gt;
+}
+
+#if defined(__x86_64__)
+
+bool has_sse42()
+{
+    static const bool has = __builtin_cpu_supports("sse4.2");
+    return has;
+}
+
+bool has_avx2()
+{
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+
+__attribute__((target("sse4.2")))
+void count_sse42(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal)
+{
+    __m128i t = _mm_set1_epi64x(p);
+    size_t lt = 0, gt = 0, i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(a + i));
+        lt += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(t, v))));
+        gt += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, t))));
+    }
+    for (; i < n; i++) {
+        int64_t x = a[i];
+        lt += x < p;
+        gt += x > p;
+    }
+    less = lt;
+    less_equal = n - gt;
+}
+
+__attribute__((target("avx2")))
+void count_avx2(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal)
+{
+    __m256i t = _mm256_set1_epi64x(p);
+    size_t lt = 0, gt = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(a + i));
+        lt += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(t, v))));
+        gt += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, t))));
+    }
+    for (; i < n; i++) {
+        int64_t x = a[i];
+        lt += x < p;
+        gt += x > p;
+    }
+    less = lt;
+    less_equal = n - gt;
+}
+
+#else
+
+bool has_sse42() { return false; }
+bool has_avx2() { return false; }
+
+void count_sse42(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal)
+{
+    count_portable(a, n, p, less, less_equal);
+}
+
+void count_avx2(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal)
+{
+    count_portable(a, n, p, less, less_equal);
+}
+
+#endif
+
+using CountFn = void (*)(const int64_t *, size_t, int64_t, size_t &, size_t &);
+
+static CountFn pick()
+{
+    if (has_avx2()) return count_avx2;
+    if (has_sse42()) return count_sse42;
+    return count_portable;
+}
+
+void count(const int64_t *a, size_t n, int64_t p, size_t &less, size_t &less_equal)
+{
+    static const CountFn fn = pick();
+    fn(a, n, p, less, less_equal);
+}
+
+}  // namespace prefix
+}  // namespace kvs
@@ -0,0 +1,124 @@
+#include "manifest.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace kvs
+{
+static constexpr const char *kManifestName = "MANIFEST";
+static constexpr const char *kManifestTmpName = "MANIFEST.tmp";
+static constexpr const char *kSegmentPrefix = "log.";
+static constexpr int kManifestVersion = 1;
+
+Manifest::Manifest(const std::string &dir) : _dir(dir), _next_id(1)
+{
+    if (_dir.empty() || _dir.back() != '/') _dir.push_back('/');
+}
+
+std::string Manifest::segment_name(SegmentId id)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%06u", kSegmentPrefix, id);
+    return buf;
+}
+
+bool Manifest::parse_segment_name(const std::string &name, SegmentId &id)
+{
+    size_t prefix = strlen(kSegmentPrefix);
+    if (name.size() <= prefix || name.compare(0, prefix, kSegmentPrefix) != 0) return false;
+    if (!std::all_of(name.begin() + prefix, name.end(), ::isdigit)) return false;
+    id = std::stoul(name.substr(prefix));
+    return true;
+}
+
+bool Manifest::load()
+{
+    std::string filename = _dir + kManifestName;
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (!fp) return false;
+
+    int version = 0;
+    unsigned next = 0;
+    if (fscanf(fp, "kvs-manifest %d\nnext_segment %u\n", &version, &next) != 2 ||
+        version != kManifestVersion) {
+        LOG(FATAL) << "bad manifest header: " << filename;
+    }
+    if (next == 0 || next > kMaxSegmentId) LOG(FATAL) << "bad next_segment " << next << " in " << filename;
+    _next_id = next;
+    _segments.clear();
+    unsigned id;
+    while (fscanf(fp, "segment %u\n", &id) == 1) {
+        if (id == 0 || id > kMaxSegmentId) LOG(FATAL) << "bad segment id " << id << " in " << filename;
+        _segments.push_back(id);
+    }
+    if (!feof(fp)) LOG(FATAL) << "bad manifest entry: " << filename;
+    fclose(fp);
+    if (_segments.empty()) LOG(FATAL) << "no segment in manifest: " << filename;
+    return true;
+}
+
+void Manifest::save()
+{
+    std::string tmp = _dir + kManifestTmpName;
+    std::string filename = _dir + kManifestName;
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (!fp) LOG(FATAL) << "cannot create manifest: " << tmp << ", errno: " << errno;
+
+    fprintf(fp, "kvs-manifest %d\nnext_segment %u\n", kManifestVersion, _next_id);
+    for (SegmentId id : _segments) fprintf(fp, "segment %u\n", id);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        LOG(FATAL) << "cannot write manifest: " << tmp << ", errno: " << errno;
+    }
+    fclose(fp);
+
+    if (rename(tmp.c_str(), filename.c_str()) != 0) {
+        LOG(FATAL) << "cannot install manifest: " << filename << ", errno: " << errno;
+    }
+    // the rename, and the entries of segments created since the last save
+    int dir_fd = ::open(_dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0 || fsync(dir_fd) != 0) {
+        LOG(FATAL) << "cannot sync directory: " << _dir << ", errno: " << errno;
+    }
+    ::close(dir_fd);
+}
+
+SegmentId Manifest::allocate_id()
+{
+    for (SegmentId i = 0; i < kMaxSegmentId; i++) {
+        SegmentId id = _next_id;
+        _next_id = _next_id % kMaxSegmentId + 1;
+        if (std::find(_segments.begin(), _segments.end(), id) != _segments.end()) continue;
+        if (access((_dir + segment_name(id)).c_str(), F_OK) == 0) continue;
+        return id;
+    }
+    LOG(FATAL) << "out of segment ids in " << _dir;
+    return 0;
+}
+
+void Manifest::remove_orphans() const
+{
+    DIR *dir = opendir(_dir.c_str());
+    if (!dir) LOG(FATAL) << "cannot list directory: " << _dir << ", errno: " << errno;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string name(entry->d_name);
+        SegmentId id;
+        bool orphan = name == kManifestTmpName ||
+                      (parse_segment_name(name, id) &&
+                       std::find(_segments.begin(), _segments.end(), id) == _segments.end());
+        if (!orphan) continue;
+        LOG(WARNING) << "removing " << name << ", which is not in the manifest";
+        unlink((_dir + name).c_str());
+    }
+    closedir(dir);
+}
+
+}  // namespace kvs
@@ -0,0 +1,52 @@
+#include "mapped_segment.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace kvs
+{
+std::shared_ptr<MappedSegment> MappedSegment::map(const std::string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG(WARNING) << "cannot open " << filename << " to map it, errno: " << errno;
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    size_t size = st.st_size;
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // the mapping keeps the file alive
+    if (data == MAP_FAILED) {
+        LOG(WARNING) << "cannot map " << filename << ", errno: " << errno;
+        return nullptr;
+    }
+    madvise(data, size, MADV_RANDOM);
+
+    return std::shared_ptr<MappedSegment>(new MappedSegment((char *) data, size));
+}
+
+MappedSegment::~MappedSegment()
+{
+    munmap(_data, _size);
+}
+
+void MappedSegment::will_need(size_t offset, size_t length) const
+{
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset / page * page;
+    size_t end = std::min(offset + length, _size);
+    if (start < end) madvise(_data + start, end - start, MADV_WILLNEED);
+}
+
+}  // namespace kvs
@@ -0,0 +1,154 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <map>
+
+#include "iterator.h"
+
+namespace kvs
+{
+static constexpr size_t kSnapshotScanBatch = 1024;  // keys of the index per batch of collect()
+
+Snapshot::~Snapshot()
+{
+    // the generations go under _log_mutex, see Engine::Generation
+    std::lock_guard<std::mutex> log_lock(_engine->_log_mutex);
+    _generation.reset();
+}
+
+Locator Snapshot::find(const Key &key) const
+{
+    Locator loc = _engine->btree.search(key);
+    for (const Engine::Generation *g = _generation.get(); g; g = g->next.load(std::memory_order_acquire)) {
+        Locator old = g->undo.search(key);
+        if (old != Engine::Index::kNotFound) return old == Engine::kAbsent ? Engine::Index::kNotFound : old;
+    }
+    return loc;
+}
+
+RetCode Snapshot::read(const Key &key, Locator loc, Value &value, bool scan) const
+{
+    while (!_engine->read_value(loc, key, value, scan)) {
+        // a gc may have moved the record since, not if an undo log points to it
+        Locator again = find(key);
+        if (again == loc || again == Engine::Index::kNotFound) {
+            LOG(ERROR) << "bad record at offset " << locator_offset(loc) << " of log segment "
+                       << locator_segment(loc) << " for key: " << key;
+            value.clear();
+            return kCorruption;
+        }
+        loc = again;
+    }
+    return kSucc;
+}
+
+RetCode Snapshot::get(const Key &key, Value &value)
+{
+    EpochGuard guard;
+    Locator loc = find(key);
+    if (loc == Engine::Index::kNotFound) return kNotFound;
+    return read(key, loc, value, false);
+}
+
+void Snapshot::collect(const Key &from, bool exclusive, bool reverse,
+                       std::vector<std::pair<Key, Locator>> &entries) const
+{
+    std::vector<std::pair<Key, Locator>> batch, undone;
+    std::map<Key, Locator> logged;  // the keys written since, where they were
+    auto before = [reverse](const Key &a, const Key &b) { return reverse ? b < a : a < b; };
+    auto add = [&entries](const std::pair<Key, Locator> &e) {
+        if (e.second != Engine::kAbsent) entries.push_back(e);
+    };
+
+    Key start = from;
+    while (entries.empty()) {
+        batch.clear();
+        logged.clear();
+        auto f = [&batch](std::string_view k, size_t loc) {
+            batch.emplace_back(Key(k), loc);
+            return batch.size() < kSnapshotScanBatch;
+        };
+        if (reverse) _engine->btree.scan_reverse(start, exclusive, f);
+        else _engine->btree.scan(start, exclusive, f);
+        bool more = batch.size() == kSnapshotScanBatch;
+
+        // the undo logs up to where the index was read, the oldest one first
+        const Key *last = more ? &batch.back().first : nullptr;
+        for (const Engine::Generation *g = _generation.get(); g; g = g->next.load(std::memory_order_acquire)) {
+            auto u = [&](std::string_view k, size_t loc) {
+                if (last && (reverse ? k < *last : k > *last)) return false;
+                logged.emplace(Key(k), loc);
+                return true;
+            };
+            if (reverse) g->undo.scan_reverse(start, exclusive, u);
+            else g->undo.scan(start, exclusive, u);
+        }
+        undone.assign(logged.begin(), logged.end());
+        if (reverse) std::reverse(undone.begin(), undone.end());
+
+        auto it = undone.begin();
+        for (auto &b : batch) {
+            for (; it != undone.end() && before(it->first, b.first); ++it) add(*it);
+            bool written = it != undone.end() && it->first == b.first;
+            add(written ? *it++ : b);
+        }
+        for (; it != undone.end(); ++it) add(*it);
+        if (!more) break;
+        start = batch.back().first;
+        exclusive = true;
+    }
+}
+
+RetCode Snapshot::scan(const Key &lower, const Key &upper, const EntryVisitor &f) const
+{
+    std::vector<std::pair<Key, Locator>> entries;
+    Key from = lower;
+    bool exclusive = false;
+    for (;;) {
+        EpochGuard guard;
+        entries.clear();
+        collect(from, exclusive, false, entries);
+        if (entries.empty()) return kSucc;
+        for (auto &e : entries) {
+            if (!upper.empty() && e.first > upper) return kSucc;
+            RetCode ret = f(e.first, e.second);
+            if (ret != kSucc) return ret;
+        }
+        from = entries.back().first;
+        exclusive = true;
+    }
+}
+
+RetCode Snapshot::visit(const Key &lower, const Key &upper, const Visitor &visitor)
+{
+    Value value;
+    return scan(lower, upper, [&](const Key &key, Locator loc) {
+        RetCode ret = read(key, loc, value, true);
+        if (ret == kSucc) visitor(key, value);
+        return ret;
+    });
+}
+
+RetCode Snapshot::visit_keys(const Key &lower, const Key &upper, const KeyVisitor &visitor)
+{
+    return scan(lower, upper, [&](const Key &key, Locator) {
+        visitor(key);
+        return kSucc;
+    });
+}
+
+RetCode Snapshot::visit_lazy(const Key &lower, const Key &upper, const LazyVisitor &visitor)
+{
+    return scan(lower, upper, [&](const Key &key, Locator loc) {
+        LazyRead value([&](Value &v) { return read(key, loc, v, true); });
+        visitor(key, value);
+        return kSucc;
+    });
+}
+
+std::unique_ptr<IROEngine::Iterator> Snapshot::new_iterator()
+{
+    return std::make_unique<SnapshotIterator>(shared_from_this());
+}
+
+}  // namespace kvs
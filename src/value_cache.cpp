@@ -0,0 +1,269 @@
+#include "value_cache.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace kvs
+{
+// what an entry costs beyond its key and value: the slot, the map node,
+// the string headers
+static constexpr size_t kEntryOverhead = 64;
+// sketch counters per byte of cache, about 3% of the budget
+static constexpr size_t kBytesPerCounter = 128;
+
+static uint64_t hash_key(const std::string &key)
+{
+    return std::hash<std::string>{}(key);
+}
+
+static size_t round_up_pow2(size_t n)
+{
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+/*
+ * count-min sketch: 4 rows of counters saturating at 15. An increment only
+ * bumps the counters at the current minimum (conservative update), which
+ * keeps a flood of one-time keys from inflating each other's estimates.
+ * All counters are halved every 10 * width increments, so the estimates
+ * follow what is popular lately rather than since the start.
+ */
+class FrequencySketch
+{
+public:
+    explicit FrequencySketch(size_t width) :
+        _mask(round_up_pow2(std::max<size_t>(width, 64)) - 1),
+        _table(kRows * (_mask + 1), 0),
+        _sample_size(10 * (_mask + 1)),
+        _additions(0)
+    { }
+
+    void increment(uint64_t hash)
+    {
+        int freq = estimate(hash);
+        if (freq == kMaxCount) return;
+        for (size_t i = 0; i < kRows; i++) {
+            uint8_t &c = _table[index(hash, i)];
+            if (c == freq) c++;
+        }
+        if (++_additions >= _sample_size) age();
+    }
+
+    int estimate(uint64_t hash) const
+    {
+        int freq = kMaxCount;
+        for (size_t i = 0; i < kRows; i++) freq = std::min<int>(freq, _table[index(hash, i)]);
+        return freq;
+    }
+
+private:
+    static constexpr size_t kRows = 4;
+    static constexpr uint8_t kMaxCount = 15;
+
+    size_t index(uint64_t hash, size_t row) const
+    {
+        // multiply-shift with one odd multiplier per row: two keys meeting
+        // in one row are unlikely to meet in another
+        static constexpr uint64_t kSeeds[kRows] = {
+            0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull, 0x9ae16a3b2f90404full, 0x9e3779b97f4a7c15ull};
+        uint64_t x = hash * kSeeds[row];
+        return row * (_mask + 1) + ((x >> 32) & _mask);
+    }
+
+    void age()
+    {
+        for (uint8_t &c : _table) c >>= 1;
+        _additions /= 2;
+    }
+
+    size_t _mask;
+    std::vector<uint8_t> _table;
+    size_t _sample_size;
+    size_t _additions;
+};
+
+class ValueCache::Shard
+{
+public:
+    explicit Shard(size_t capacity) :
+        _capacity(capacity), _bytes(0), _hand(0), _sketch(capacity / kBytesPerCounter)
+    { }
+
+    bool lookup(uint64_t hash, const std::string &key, std::string &value)
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _sketch.increment(hash);
+        auto it = _index.find(key);
+        if (it == _index.end()) {
+            _stats.misses++;
+            return false;
+        }
+        Entry &e = _slots[it->second];
+        e.referenced = true;
+        value = e.value;
+        _stats.hits++;
+        return true;
+    }
+
+    void insert(uint64_t hash, const std::string &key, const std::string &value, const std::function<bool()> &current)
+    {
+        size_t charge = key.size() + value.size() + kEntryOverhead;
+        if (charge > _capacity) return;
+
+        std::lock_guard<std::mutex> lk(_mutex);
+        if (!current()) return;  // written since the value was read
+        auto it = _index.find(key);
+        if (it != _index.end()) {  // a racing get was first
+            assign(it->second, value);
+            return;
+        }
+
+        int freq = _sketch.estimate(hash);
+        while (_bytes + charge > _capacity) {
+            size_t victim = next_victim();
+            if (freq <= _sketch.estimate(hash_key(*_slots[victim].key))) {
+                _stats.rejected++;
+                return;
+            }
+            evict(victim);
+        }
+
+        size_t slot;
+        if (_free.empty()) {
+            slot = _slots.size();
+            _slots.emplace_back();
+        }
+        else {
+            slot = _free.back();
+            _free.pop_back();
+        }
+        auto ins = _index.emplace(key, slot).first;
+        Entry &e = _slots[slot];
+        e.key = &ins->first;
+        e.value = value;
+        e.referenced = false;  // a one-hit wonder goes first
+        _bytes += charge;
+        _stats.admitted++;
+    }
+
+    void update(const std::string &key, const std::string &value)
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        auto it = _index.find(key);
+        if (it == _index.end()) return;
+        assign(it->second, value);
+        if (_bytes > _capacity) evict(it->second);
+    }
+
+    void erase(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        auto it = _index.find(key);
+        if (it != _index.end()) evict(it->second);
+    }
+
+    void add_stats(Stats &stats)
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        stats.hits += _stats.hits;
+        stats.misses += _stats.misses;
+        stats.admitted += _stats.admitted;
+        stats.rejected += _stats.rejected;
+        stats.bytes += _bytes;
+        stats.entries += _index.size();
+    }
+
+private:
+    struct Entry {
+        const std::string *key{nullptr};  // the one in _index, nullptr if the slot is free
+        std::string value;
+        bool referenced{false};
+    };
+
+    void assign(size_t slot, const std::string &value)
+    {
+        Entry &e = _slots[slot];
+        _bytes = _bytes - e.value.size() + value.size();
+        e.value = value;
+        e.referenced = true;
+    }
+
+    // CLOCK: the first entry not referenced since the hand last passed it
+    size_t next_victim()
+    {
+        for (;;) {
+            if (_hand >= _slots.size()) _hand = 0;
+            Entry &e = _slots[_hand++];
+            if (e.key == nullptr) continue;
+            if (!e.referenced) return _hand - 1;
+            e.referenced = false;
+        }
+    }
+
+    void evict(size_t slot)
+    {
+        Entry &e = _slots[slot];
+        _bytes -= e.key->size() + e.value.size() + kEntryOverhead;
+        _index.erase(_index.find(*e.key));
+        e.key = nullptr;
+        std::string().swap(e.value);
+        _free.push_back(slot);
+    }
+
+    std::mutex _mutex;
+    size_t _capacity;
+    size_t _bytes;
+    std::unordered_map<std::string, size_t> _index;  // key -> slot
+    std::vector<Entry> _slots;
+    std::vector<size_t> _free;
+    size_t _hand;
+    FrequencySketch _sketch;
+    Stats _stats;
+};
+
+ValueCache::ValueCache(size_t capacity, size_t bypass_size, size_t shard_nr) :
+    _bypass_size(bypass_size)
+{
+    shard_nr = round_up_pow2(std::max<size_t>(shard_nr, 1));
+    for (size_t i = 0; i < shard_nr; i++) _shards.emplace_back(new Shard(capacity / shard_nr));
+}
+
+ValueCache::~ValueCache() = default;
+
+bool ValueCache::lookup(const std::string &key, std::string &value)
+{
+    uint64_t hash = hash_key(key);
+    return shard(hash).lookup(hash, key, value);
+}
+
+void ValueCache::insert(const std::string &key, const std::string &value, const std::function<bool()> &current)
+{
+    if (value.size() > _bypass_size) return;
+    uint64_t hash = hash_key(key);
+    shard(hash).insert(hash, key, value, current);
+}
+
+void ValueCache::update(const std::string &key, const std::string &value)
+{
+    if (value.size() > _bypass_size) {
+        erase(key);
+        return;
+    }
+    shard(hash_key(key)).update(key, value);
+}
+
+void ValueCache::erase(const std::string &key)
+{
+    shard(hash_key(key)).erase(key);
+}
+
+ValueCache::Stats ValueCache::stats() const
+{
+    Stats stats;
+    for (auto &s : _shards) s->add_stats(stats);
+    return stats;
+}
+
+}  // namespace kvs
@@ -0,0 +1,162 @@
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iostream>
+
+#include "engine.h"
+#include "glog/logging.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 10000, "the number of tests");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+
+EngineOptions options(bool checkpoint)
+{
+    EngineOptions options;
+    options.segment_size = 64 * 1024;
+    options.index_checkpoint = checkpoint;
+    options.checkpoint_interval_bytes = 0;
+    return options;
+}
+
+std::string checkpoint_file()
+{
+    return FLAGS_kvdir + "/INDEX";
+}
+
+bool exists(const std::string &filename)
+{
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0;
+}
+
+// puts and removes on random keys
+void write(Engine &engine, std::map<Key, Value> &kv, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!kv.empty() && i % 4 == 0)
+        {
+            auto key = kv.begin()->first;
+            CHECK_EQ(engine.remove(key), kSucc);
+            kv.erase(key);
+            continue;
+        }
+        auto key = gen_rand_key(16);
+        auto value = gen_rand_value(64);
+        CHECK_EQ(engine.put(key, value), kSucc);
+        kv[key] = value;
+    }
+}
+
+void check_all(const std::map<Key, Value> &kv, bool checkpoint = true)
+{
+    auto engine = std::make_shared<Engine>(FLAGS_kvdir, options(checkpoint));
+    for (const auto &it : kv)
+    {
+        std::string value;
+        CHECK_EQ(engine->get(it.first, value), kSucc);
+        CHECK_EQ(value, it.second);
+    }
+    size_t visited = 0;
+    engine->visit("", "", [&](const Key &key, const Value &) {
+        CHECK(kv.count(key)) << "removed key visited: " << key;
+        visited++;
+    });
+    CHECK_EQ(visited, kv.size());
+}
+
+void copy_file(const std::string &from, const std::string &to)
+{
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary);
+    out << in.rdbuf();
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::map<Key, Value> kv;
+    {
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, options(true));
+        write(*engine, kv, FLAGS_test_nr);
+    }
+    LOG(INFO) << "a checkpoint from the close...";
+    CHECK(exists(checkpoint_file()));
+    check_all(kv);
+
+    LOG(INFO) << "a checkpoint and a log tail past it, over several segments...";
+    {
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, options(false));
+        write(*engine, kv, FLAGS_test_nr);
+    }
+    check_all(kv, false);
+    check_all(kv);
+
+    LOG(INFO) << "a checkpoint at sync()...";
+    {
+        auto o = options(false);
+        o.index_checkpoint = true;
+        o.checkpoint_interval_bytes = 1;
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, o);
+        write(*engine, kv, 100);
+        unlink(checkpoint_file().c_str());
+        CHECK_EQ(engine->sync(), kSucc);
+        engine->wait_gc();  // written in the background
+        CHECK(exists(checkpoint_file()));
+    }
+    check_all(kv);
+
+    LOG(INFO) << "a checkpoint written while writes go on...";
+    {
+        auto o = options(false);
+        o.index_checkpoint = true;
+        o.checkpoint_interval_bytes = 1;
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, o);
+        write(*engine, kv, 100);
+        CHECK_EQ(engine->sync(), kSucc);
+        write(*engine, kv, FLAGS_test_nr);
+        engine->wait_gc();
+        copy_file(checkpoint_file(), checkpoint_file() + ".mid");
+    }
+    // rather than the one from the close
+    rename((checkpoint_file() + ".mid").c_str(), checkpoint_file().c_str());
+    check_all(kv);
+
+    LOG(INFO) << "a checkpoint from before a gc...";
+    copy_file(checkpoint_file(), checkpoint_file() + ".old");
+    {
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, options(true));
+        unlink(checkpoint_file().c_str());
+        CHECK_EQ(engine->garbage_collect(), kSucc);
+        write(*engine, kv, 100);
+        engine->wait_gc();  // which writes a new one by itself
+        CHECK(exists(checkpoint_file()));
+    }
+    check_all(kv);
+    copy_file(checkpoint_file() + ".old", checkpoint_file());
+    unlink((checkpoint_file() + ".old").c_str());
+    check_all(kv, false);
+
+    LOG(INFO) << "a damaged checkpoint...";
+    check_all(kv);
+    {
+        std::fstream f(checkpoint_file(), std::ios::in | std::ios::out | std::ios::binary);
+        f.seekg(100);
+        char c = f.get();
+        f.seekp(100);
+        f.put(c ^ 0x5a);
+    }
+    check_all(kv, false);
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <iostream>
+
+#include "engine.h"
+#include "glog/logging.h"
+#include "util/bench.h"
+#include "util/executor.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 1000, "the number of tests");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+
+void test_durability(Durability durability, std::map<Key, Value> &kv)
+{
+    EngineOptions options;
+    options.durability = durability;
+    options.sync_interval_ms = 10;
+    auto engine = std::make_shared<Engine>(FLAGS_kvdir, options);
+
+    Engine::Sequence seq = 0;
+    for (size_t i = 0; i < FLAGS_test_nr; ++i)
+    {
+        auto key = gen_rand_key(8);
+        auto value = gen_rand_value(16);
+        CHECK_EQ(engine->put(key, value, seq), kSucc);
+        kv[key] = value;
+    }
+    CHECK_EQ(seq, engine->last_sequence());
+
+    switch (durability)
+    {
+    case Durability::kSyncEveryWrite:
+    {
+        CHECK_GE(engine->durable_sequence(), seq);
+        break;
+    }
+    case Durability::kSyncInterval:
+    {
+        CHECK_EQ(engine->wait_durable(seq, std::chrono::seconds(10)), kSucc);
+        break;
+    }
+    case Durability::kOsBuffered:
+    {
+        CHECK_EQ(engine->wait_durable(seq, std::chrono::milliseconds(10)),
+                 kTimedOut);
+        CHECK_EQ(engine->sync(), kSucc);
+        CHECK_EQ(engine->wait_durable(seq, std::chrono::milliseconds(10)),
+                 kSucc);
+        break;
+    }
+    }
+    CHECK_GE(engine->durable_sequence(), seq);
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::map<Key, Value> kv;
+    test_durability(Durability::kSyncEveryWrite, kv);
+    test_durability(Durability::kSyncInterval, kv);
+    test_durability(Durability::kOsBuffered, kv);
+
+    LOG(INFO) << "re-opening Engine...";
+    auto engine = Engine::new_instance(FLAGS_kvdir, EngineOptions{});
+    for (const auto &it : kv)
+    {
+        std::string value;
+        CHECK_EQ(engine->get(it.first, value), kSucc);
+        CHECK_EQ(value, it.second);
+    }
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include "engine.h"
+#include "glog/logging.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 10000, "the number of keys");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+
+/*
+ * every operator new of the process is counted: once warmed up, a get
+ * must not allocate, but for growing the value it writes to
+ */
+static std::atomic<size_t> g_allocs(0);
+
+void *operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+EngineOptions options(size_t cache_bytes)
+{
+    EngineOptions options;
+    options.segment_size = 64 * 1024;  // a few sealed (mapped) segments, and the active one
+    options.value_cache_bytes = cache_bytes;
+    return options;
+}
+
+// allocations made by f
+template <typename F>
+size_t allocs_of(F f)
+{
+    size_t before = g_allocs.load();
+    f();
+    return g_allocs.load() - before;
+}
+
+void check_gets(Engine &engine, const std::vector<Key> &keys, const std::vector<Key> &missing)
+{
+    std::string value;
+    value.reserve(1024);
+    ValueView view;
+    auto gets = [&] {
+        for (const auto &key : keys)
+        {
+            CHECK_EQ(engine.get(key, value), kSucc);
+            CHECK_EQ(engine.get(key, view), kSucc);
+        }
+        for (const auto &key : missing)
+        {
+            CHECK_EQ(engine.get(key, value), kNotFound);
+        }
+    };
+    gets();  // the thread's epoch slot, thread-local buffers, cache fill
+
+    size_t n = allocs_of(gets);
+    LOG(INFO) << "allocations in " << 2 * keys.size() + missing.size() << " gets: " << n;
+    CHECK_EQ(n, 0u);
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::vector<Key> keys, missing;
+    for (size_t i = 0; i < FLAGS_test_nr; ++i)
+    {
+        keys.push_back(gen_rand_key(32));  // past the small string buffer
+        missing.push_back(gen_rand_key(32));
+    }
+
+    for (size_t cache_bytes : {(size_t) 0, (size_t) 64 << 20})
+    {
+        LOG(INFO) << "value cache of " << cache_bytes << " bytes";
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, options(cache_bytes));
+        for (const auto &key : keys)
+        {
+            CHECK_EQ(engine->put(key, gen_rand_value(100)), kSucc);
+        }
+        check_gets(*engine, keys, missing);
+    }
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#include "engine.h"
+#include "glog/logging.h"
+#include "test_util.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 5000, "the number of tests");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+
+// one of key_of(), not of the random keys among them
+bool paged(const Key &key)
+{
+    return key.size() == 9 && key[0] == 'k' && std::all_of(key.begin() + 1, key.end(), ::isdigit);
+}
+
+void check_entry(IROEngine::Iterator &it, std::map<Key, Value>::const_iterator expected)
+{
+    CHECK(it.valid());
+    CHECK_EQ(it.key(), expected->first);
+    std::string value;
+    CHECK_EQ(it.value(value), kSucc);
+    CHECK_EQ(value, expected->second);
+}
+
+// the engine or a snapshot holds exactly kv, in both directions and from anywhere
+void check_all(IROEngine &engine, const std::map<Key, Value> &kv)
+{
+    auto it = engine.new_iterator();
+    it->seek("");
+    for (auto e = kv.begin(); e != kv.end(); ++e, it->next())
+    {
+        check_entry(*it, e);
+    }
+    CHECK(!it->valid());
+
+    it->seek_to_last();
+    for (auto e = kv.rbegin(); e != kv.rend(); ++e, it->prev())
+    {
+        check_entry(*it, std::prev(e.base()));
+    }
+    CHECK(!it->valid());
+
+    // to keys there and not there, then back and forth across the batches
+    for (size_t i = 0; i < 20; ++i)
+    {
+        Key target = fast_pseudo_rand_int(0, 1) ? gen_rand_key(8) : std::next(kv.begin(), fast_pseudo_rand_int(kv.size() - 1))->first;
+        auto e = kv.lower_bound(target);
+        it->seek(target);
+        if (e == kv.end())
+        {
+            CHECK(!it->valid());
+            continue;
+        }
+        for (size_t step = 0; step < 1000 && e != kv.end(); ++step)
+        {
+            check_entry(*it, e);
+            bool back = e != kv.begin() && fast_pseudo_rand_int(0, 2) == 0;
+            if (back)
+            {
+                --e;
+                it->prev();
+            }
+            else
+            {
+                ++e;
+                it->next();
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::map<Key, Value> kv;
+    auto engine = std::make_shared<Engine>(FLAGS_kvdir, small_segments(64 * 1024));
+    for (size_t i = 0; i < FLAGS_test_nr; ++i)
+    {
+        if (!kv.empty() && i % 4 == 0)
+        {
+            auto key = std::next(kv.begin(), fast_pseudo_rand_int(kv.size() - 1))->first;
+            CHECK_EQ(engine->remove(key), kSucc);
+            kv.erase(key);
+            continue;
+        }
+        auto key = gen_rand_key(8);
+        kv[key] = gen_rand_value(64);
+        CHECK_EQ(engine->put(key, kv[key]), kSucc);
+    }
+
+    LOG(INFO) << "iterating...";
+    check_all(*engine, kv);
+    {
+        auto it = engine->new_iterator();
+        it->seek(kv.rbegin()->first + "\xff");
+        CHECK(!it->valid());
+        it->next();
+        CHECK(!it->valid());
+        it->seek("");
+        it->prev();
+        CHECK(!it->valid());
+    }
+
+    LOG(INFO) << "values read when asked for...";
+    {
+        auto it = engine->new_iterator();
+        it->seek("");
+        Key first = it->key();
+        CHECK_EQ(engine->put(first, "new"), kSucc);
+        std::string value;
+        CHECK_EQ(it->value(value), kSucc);
+        CHECK_EQ(value, "new");
+        CHECK_EQ(engine->remove(first), kSucc);
+        CHECK_EQ(it->value(value), kNotFound);
+        kv.erase(first);
+    }
+
+    LOG(INFO) << "a snapshot, iterated while writes go on...";
+    auto snapshot_kv = kv;
+    auto snapshot = CHECK_NOTNULL(engine->snapshot());
+    for (size_t i = 0; i < FLAGS_test_nr; ++i)
+    {
+        auto key = std::next(kv.begin(), fast_pseudo_rand_int(kv.size() - 1))->first;
+        if (i % 2 == 0)
+        {
+            CHECK_EQ(engine->remove(key), kSucc);
+            kv.erase(key);
+            continue;
+        }
+        kv[key] = gen_rand_value(64);
+        CHECK_EQ(engine->put(key, kv[key]), kSucc);
+        key = gen_rand_key(8);
+        kv[key] = gen_rand_value(64);
+        CHECK_EQ(engine->put(key, kv[key]), kSucc);
+    }
+    check_all(*snapshot, snapshot_kv);
+    check_all(*engine, kv);
+    snapshot.reset();
+
+    /*
+     * pages of 1000 keys, the even ones, while a writer churns the odd
+     * ones between them: every even key shows up once, in order, and the
+     * writer is never held up for a whole page
+     */
+    LOG(INFO) << "paging alongside a writer...";
+    constexpr size_t kKeys = 20000;
+    for (size_t k = 0; k < kKeys; k += 2)
+    {
+        CHECK_EQ(engine->put(key_of(k), key_of(k)), kSucc);
+    }
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        for (size_t i = 0; !done.load(); ++i)
+        {
+            Key key = key_of(fast_pseudo_rand_int(kKeys / 2 - 1) * 2 + 1);
+            if (i % 2) CHECK_EQ(engine->put(key, "odd"), kSucc);
+            else engine->remove(key);
+        }
+    });
+    for (size_t round = 0; round < 3; ++round)
+    {
+        Key from;
+        size_t next_even = 0;
+        for (bool more = true; more;)
+        {
+            auto it = engine->new_iterator();  // one per page, as a server would
+            it->seek(from);
+            size_t n = 0;
+            for (; it->valid() && n < 1000; it->next(), ++n)
+            {
+                if (it->key() >= key_of(kKeys)) break;
+                if (!paged(it->key()) || std::stoul(it->key().substr(1)) % 2 == 1) continue;
+                std::string value;
+                CHECK_EQ(it->key(), key_of(next_even));
+                CHECK_EQ(it->value(value), kSucc);
+                CHECK_EQ(value, it->key());
+                next_even += 2;
+            }
+            more = it->valid() && it->key() < key_of(kKeys);
+            if (more) from = it->key();
+        }
+        CHECK_EQ(next_even, kKeys);
+
+        // and down
+        auto it = engine->new_iterator();
+        it->seek(key_of(kKeys));
+        it->prev();
+        size_t prev_even = kKeys;
+        for (; it->valid() && it->key() >= key_of(0); it->prev())
+        {
+            if (!paged(it->key()) || std::stoul(it->key().substr(1)) % 2 == 1) continue;
+            prev_even -= 2;
+            CHECK_EQ(it->key(), key_of(prev_even));
+        }
+        CHECK_EQ(prev_even, 0u);
+    }
+    done.store(true);
+    writer.join();
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
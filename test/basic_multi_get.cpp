@@ -0,0 +1,103 @@
+#include <iostream>
+#include <thread>
+
+#include "engine.h"
+#include "glog/logging.h"
+#include "test_util.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 20000, "the number of tests");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+
+// batches of keys there and not, some twice, in no order: each as get() would have it
+void check_batches(Engine &engine, const std::map<Key, Value> &kv, size_t batches)
+{
+    for (size_t b = 0; b < batches; ++b)
+    {
+        std::vector<Key> keys;
+        size_t n = fast_pseudo_rand_int(1, 500);
+        for (size_t i = 0; i < n; ++i)
+        {
+            keys.push_back(key_of(fast_pseudo_rand_int(FLAGS_test_nr * 2)));
+            if (i % 50 == 0) keys.push_back(keys.back());
+        }
+        std::vector<Value> values;
+        std::vector<RetCode> statuses;
+        CHECK_EQ(engine.multi_get(keys, values, statuses), kSucc);
+        CHECK_EQ(values.size(), keys.size());
+        CHECK_EQ(statuses.size(), keys.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            auto it = kv.find(keys[i]);
+            CHECK_EQ(statuses[i], it == kv.end() ? kNotFound : kSucc) << "key: " << keys[i];
+            CHECK_EQ(values[i], it == kv.end() ? "" : it->second) << "key: " << keys[i];
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::map<Key, Value> kv;
+    {
+        auto options = small_segments(256 * 1024);
+        options.multi_get_prefetch = true;
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, options);
+        check_batches(*engine, kv, 10);
+
+        // many sealed segments, mapped, and the active one
+        for (size_t i = 0; i < FLAGS_test_nr; ++i)
+        {
+            auto key = key_of(fast_pseudo_rand_int(FLAGS_test_nr * 2));
+            if (i % 5 == 0)
+            {
+                engine->remove(key);
+                kv.erase(key);
+                continue;
+            }
+            kv[key] = gen_rand_value(fast_pseudo_rand_int(1, 1024));
+            CHECK_EQ(engine->put(key, kv[key]), kSucc);
+        }
+        LOG(INFO) << "batches...";
+        check_batches(*engine, kv, 200);
+
+        LOG(INFO) << "batches alongside writes and a gc...";
+        std::atomic<bool> done(false);
+        std::thread writer([&] {
+            // the values of other keys, which a gc moves the records of kv around
+            for (size_t i = 0; !done.load(); ++i)
+            {
+                CHECK_EQ(engine->put(key_of(FLAGS_test_nr * 3 + i % 1000), gen_rand_value(512)), kSucc);
+                if (i % 2000 == 0) CHECK_EQ(engine->garbage_collect(), kSucc);
+            }
+        });
+        check_batches(*engine, kv, 500);
+        done.store(true);
+        writer.join();
+    }
+
+    LOG(INFO) << "with a value cache...";
+    {
+        auto options = small_segments(256 * 1024);
+        options.value_cache_bytes = 1024 * 1024;
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, options);
+        check_batches(*engine, kv, 100);
+        check_batches(*engine, kv, 100);
+        auto key = kv.begin()->first;
+        kv[key] = "new";
+        CHECK_EQ(engine->put(key, "new"), kSucc);
+        check_batches(*engine, kv, 100);
+        CHECK_GT(engine->cache_stats().hits, 0u);
+    }
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
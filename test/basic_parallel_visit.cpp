@@ -0,0 +1,138 @@
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "engine.h"
+#include "glog/logging.h"
+#include "test_util.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 20000, "the number of tests");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+
+// the entries of kv in [lower, upper], as Engine::visit
+std::vector<std::pair<Key, Value>> range_of(const std::map<Key, Value> &kv, const Key &lower, const Key &upper)
+{
+    auto it = kv.lower_bound(lower);
+    auto end = upper.empty() ? kv.end() : kv.upper_bound(upper);
+    return std::vector<std::pair<Key, Value>>(it, end);
+}
+
+// both ways of parallel_visit() give exactly kv in [lower, upper]
+void check_range(Engine &engine, const std::map<Key, Value> &kv, const Key &lower, const Key &upper, size_t n_threads)
+{
+    auto expected = range_of(kv, lower, upper);
+
+    std::vector<std::pair<Key, Value>> got;
+    CHECK_EQ(engine.parallel_visit(lower, upper, n_threads, [&](const Key &key, const Value &value) {
+        got.emplace_back(key, value);
+    }), kSucc);
+    CHECK(got == expected) << "ordered, [" << lower << ", " << upper << "], " << n_threads << " threads: "
+                           << got.size() << " keys of " << expected.size();
+
+    // each partition in order, the partitions one after the other
+    std::mutex mutex;
+    std::map<size_t, std::vector<std::pair<Key, Value>>> partitions;
+    std::set<std::thread::id> threads;
+    CHECK_EQ(engine.parallel_visit(lower, upper, n_threads, [&](size_t p, const Key &key, const Value &value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        partitions[p].emplace_back(key, value);
+        threads.insert(std::this_thread::get_id());
+    }), kSucc);
+    got.clear();
+    for (auto &[p, entries] : partitions)
+    {
+        got.insert(got.end(), entries.begin(), entries.end());
+    }
+    CHECK(got == expected) << "partitioned, [" << lower << ", " << upper << "], " << n_threads << " threads: "
+                           << got.size() << " keys of " << expected.size();
+    CHECK_LE(threads.size(), n_threads);
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::map<Key, Value> kv;
+    auto engine = std::make_shared<Engine>(FLAGS_kvdir, small_segments(1024 * 1024));
+
+    LOG(INFO) << "an empty engine...";
+    check_range(*engine, kv, "", "", 4);
+
+    // values of up to 8 KB: more than the reorder buffer of a few threads holds
+    for (size_t i = 0; i < FLAGS_test_nr; ++i)
+    {
+        if (!kv.empty() && i % 5 == 0)
+        {
+            auto key = std::next(kv.begin(), fast_pseudo_rand_int(kv.size() - 1))->first;
+            CHECK_EQ(engine->remove(key), kSucc);
+            kv.erase(key);
+            continue;
+        }
+        auto key = key_of(fast_pseudo_rand_int(FLAGS_test_nr * 2));
+        kv[key] = gen_rand_value(fast_pseudo_rand_int(8 * 1024));
+        CHECK_EQ(engine->put(key, kv[key]), kSucc);
+    }
+
+    LOG(INFO) << "visiting...";
+    for (size_t n_threads : {1, 3, 8})
+    {
+        check_range(*engine, kv, "", "", n_threads);
+        check_range(*engine, kv, key_of(FLAGS_test_nr / 3), key_of(FLAGS_test_nr), n_threads);
+        check_range(*engine, kv, kv.begin()->first, kv.begin()->first, n_threads);
+        check_range(*engine, kv, key_of(FLAGS_test_nr * 3), "", n_threads);
+    }
+
+    LOG(INFO) << "a slow visitor...";
+    {
+        auto expected = range_of(kv, "", "");
+        size_t i = 0;
+        CHECK_EQ(engine->parallel_visit("", "", 4, [&](const Key &key, const Value &value) {
+            if (i % 1000 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            CHECK(i < expected.size());
+            CHECK_EQ(key, expected[i].first);
+            CHECK_EQ(value, expected[i].second);
+            i++;
+        }), kSucc);
+        CHECK_EQ(i, expected.size());
+    }
+
+    /*
+     * a writer churns other keys meanwhile: the ones which do not change
+     * are all seen, once, in order
+     */
+    LOG(INFO) << "visiting alongside a writer...";
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        for (size_t i = 0; !done.load(); ++i)
+        {
+            Key key = "k" + gen_rand_key(8) + "~";  // never one of key_of()
+            if (i % 2) CHECK_EQ(engine->put(key, "other"), kSucc);
+            else engine->remove(key);
+        }
+    });
+    for (size_t round = 0; round < 3; ++round)
+    {
+        auto it = kv.begin();
+        CHECK_EQ(engine->parallel_visit("", "", 4, [&](const Key &key, const Value &value) {
+            if (value == "other") return;
+            CHECK(it != kv.end());
+            CHECK_EQ(key, it->first);
+            CHECK_EQ(value, it->second);
+            ++it;
+        }), kSucc);
+        CHECK(it == kv.end());
+    }
+    done.store(true);
+    writer.join();
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
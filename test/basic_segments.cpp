@@ -0,0 +1,183 @@
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <iostream>
+
+#include "engine.h"
+#include "glog/logging.h"
+#include "test_util.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 10000, "the number of tests");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+
+bool exists(const std::string &filename)
+{
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0;
+}
+
+size_t open_files()
+{
+    DIR *dir = opendir("/proc/self/fd");
+    CHECK(dir);
+    size_t n = 0;
+    while (readdir(dir)) n++;
+    closedir(dir);
+    return n;
+}
+
+std::vector<SegmentId> live_segments()
+{
+    Manifest manifest(FLAGS_kvdir);
+    CHECK(manifest.load());
+    for (SegmentId id : manifest.segments())
+    {
+        CHECK(exists(FLAGS_kvdir + "/" + Manifest::segment_name(id)));
+    }
+    return manifest.segments();
+}
+
+void check_all(Engine &engine, const std::map<Key, Value> &kv)
+{
+    for (const auto &it : kv)
+    {
+        std::string value;
+        CHECK_EQ(engine.get(it.first, value), kSucc);
+        CHECK_EQ(value, it.second);
+
+        ValueView view;
+        CHECK_EQ(engine.get(it.first, view), kSucc);
+        CHECK(view.view() == it.second);
+    }
+    size_t visited = 0;
+    engine.visit("", kv.rbegin()->first, [&](const Key &key, const Value &value) {
+        auto it = kv.find(key);
+        CHECK(it != kv.end());
+        CHECK_EQ(value, it->second);
+        visited++;
+    });
+    CHECK_EQ(visited, kv.size());
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::map<Key, Value> kv;
+    {
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, small_segments(16 * 1024));
+        for (size_t i = 0; i < FLAGS_test_nr; ++i)
+        {
+            auto key = gen_rand_key(8);
+            if (!kv.empty() && i % 4 == 0)
+            {
+                key = kv.begin()->first;
+                CHECK_EQ(engine->remove(key), kSucc);
+                kv.erase(key);
+                continue;
+            }
+            auto value = gen_rand_value(64);
+            CHECK_EQ(engine->put(key, value), kSucc);
+            kv[key] = value;
+        }
+        check_all(*engine, kv);
+    }
+    auto before_gc = live_segments();
+    LOG(INFO) << "wrote " << before_gc.size() << " segments";
+    CHECK_GT(before_gc.size(), 1u);
+
+    {
+        LOG(INFO) << "re-opening Engine...";
+        auto engine = std::make_shared<Engine>(FLAGS_kvdir, small_segments(16 * 1024));
+        check_all(*engine, kv);
+        // the sealed segments are mapped, with no descriptor left open
+        CHECK_LT(open_files(), before_gc.size());
+
+        // a view into a sealed segment outlives the segment
+        ValueView view;
+        Value viewed = kv.begin()->second;
+        CHECK_EQ(engine->get(kv.begin()->first, view), kSucc);
+
+        LOG(INFO) << "gc, with writes racing it...";
+        CHECK_EQ(engine->garbage_collect(), kSucc);
+        size_t i = 0;
+        for (auto it = kv.begin(); it != kv.end(); ++i)
+        {
+            if (i % 7 == 0)
+            {
+                CHECK_EQ(engine->remove(it->first), kSucc);
+                it = kv.erase(it);
+                continue;
+            }
+            if (i % 3 == 0)
+            {
+                it->second = gen_rand_value(64);
+                CHECK_EQ(engine->put(it->first, it->second), kSucc);
+            }
+            ++it;
+        }
+        engine->wait_gc();
+        check_all(*engine, kv);
+        CHECK(view.view() == viewed);
+
+        // and writes still go on after it
+        auto key = gen_rand_key(8);
+        auto value = gen_rand_value(64);
+        CHECK_EQ(engine->put(key, value), kSucc);
+        kv[key] = value;
+    }
+    auto after_gc = live_segments();
+    for (SegmentId id : before_gc)
+    {
+        CHECK(!exists(FLAGS_kvdir + "/" + Manifest::segment_name(id)))
+            << "segment " << id << " survived gc";
+    }
+
+    // a segment the manifest does not know, as left by a crash in a rotation
+    std::string orphan = FLAGS_kvdir + "/" + Manifest::segment_name(999999);
+    FILE *fp = fopen(orphan.c_str(), "w");
+    CHECK(fp);
+    fclose(fp);
+
+    LOG(INFO) << "re-opening Engine after gc...";
+    auto engine = std::make_shared<Engine>(FLAGS_kvdir, small_segments(16 * 1024));
+    check_all(*engine, kv);
+    CHECK(!exists(orphan));
+    CHECK(live_segments() == after_gc);
+
+    LOG(INFO) << "gc into a key-clustered base...";
+    CHECK_EQ(engine->garbage_collect(), kSucc);
+    engine->wait_gc();
+    check_all(*engine, kv);
+    auto segments = live_segments();
+    std::string last;
+    size_t records = 0;
+    for (size_t i = 0; i + 1 < segments.size(); ++i)  // but the new active one
+    {
+        std::ifstream in(FLAGS_kvdir + "/" + Manifest::segment_name(segments[i]), std::ios::binary);
+        RecordHeader header;
+        while (in.read((char *)&header, sizeof(header)))
+        {
+            std::string key(header.key_size, '\0');
+            in.read(&key[0], key.size());
+            in.seekg(header.value_size, std::ios::cur);
+            CHECK_EQ(header.type, kTypeValue);
+            CHECK_GT(key, last);
+            last = key;
+            records++;
+        }
+    }
+    CHECK_EQ(records, kv.size());
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include <dirent.h>
+
+#include <iostream>
+#include <thread>
+
+#include "engine.h"
+#include "glog/logging.h"
+#include "test_util.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 5000, "the number of tests");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+
+// the engine or a snapshot holds exactly kv
+void check_all(IROEngine &engine, const std::map<Key, Value> &kv, const std::set<Key> &used)
+{
+    for (const Key &key : used)
+    {
+        auto it = kv.find(key);
+        std::string value;
+        CHECK_EQ(engine.get(key, value), it == kv.end() ? kNotFound : kSucc) << "key: " << key;
+        if (it != kv.end())
+        {
+            CHECK_EQ(value, it->second);
+        }
+    }
+    auto it = kv.begin();
+    engine.visit("", "", [&](const Key &key, const Value &value) {
+        CHECK(it != kv.end()) << "removed key visited: " << key;
+        CHECK_EQ(key, it->first);
+        CHECK_EQ(value, it->second);
+        ++it;
+    });
+    CHECK(it == kv.end());
+
+    // a range, both ends included as by Engine::visit
+    auto lo = std::next(kv.begin(), kv.size() / 3), hi = std::next(kv.begin(), kv.size() / 2);
+    size_t visited = 0;
+    engine.visit(lo->first, hi->first, [&](const Key &key, const Value &) {
+        CHECK_GE(key, lo->first);
+        CHECK_LE(key, hi->first);
+        visited++;
+    });
+    CHECK_EQ(visited, (size_t)std::distance(lo, hi) + 1);
+
+    // the same keys without the values, and with every other one
+    it = kv.begin();
+    CHECK_EQ(engine.visit_keys("", "", [&](const Key &key) {
+        CHECK(it != kv.end()) << "removed key visited: " << key;
+        CHECK_EQ(key, (it++)->first);
+    }), kSucc);
+    CHECK(it == kv.end());
+    it = kv.begin();
+    size_t n = 0;
+    CHECK_EQ(engine.visit_lazy("", "", [&](const Key &key, IROEngine::LazyValue &value) {
+        CHECK(it != kv.end()) << "removed key visited: " << key;
+        CHECK_EQ(key, it->first);
+        if (n++ % 2 == 1)
+        {
+            std::string v;
+            CHECK_EQ(value.get(v), kSucc);
+            CHECK_EQ(v, it->second);
+        }
+        ++it;
+    }), kSucc);
+    CHECK(it == kv.end());
+}
+
+// the log segment files in the directory
+size_t segment_files()
+{
+    size_t n = 0;
+    DIR *dir = opendir(FLAGS_kvdir.c_str());
+    CHECK(dir != nullptr);
+    while (struct dirent *e = readdir(dir))
+    {
+        if (std::string(e->d_name).rfind("log.", 0) == 0) n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+size_t manifest_segments()
+{
+    Manifest manifest(FLAGS_kvdir);
+    CHECK(manifest.load());
+    return manifest.segments().size();
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    std::map<Key, Value> kv;
+    std::set<Key> used;
+    size_t op = 0;
+    auto write = [&](Engine &engine, size_t n) {
+        for (size_t i = 0; i < n; ++i, ++op)
+        {
+            if (!kv.empty() && op % 4 == 0)
+            {
+                auto key = kv.begin()->first;
+                CHECK_EQ(engine.remove(key), kSucc);
+                kv.erase(key);
+                continue;
+            }
+            // new keys and overwrites
+            auto key = op % 3 == 0 || kv.empty() ? gen_rand_key(8) : std::next(kv.begin(), fast_pseudo_rand_int(kv.size() - 1))->first;
+            used.insert(key);
+            kv[key] = gen_rand_value(100);
+            CHECK_EQ(engine.put(key, kv[key]), kSucc);
+        }
+    };
+
+    auto engine = std::make_shared<Engine>(FLAGS_kvdir, small_segments(16 * 1024));
+    write(*engine, FLAGS_test_nr);
+
+    LOG(INFO) << "snapshots apart from the writes...";
+    auto kv1 = kv;
+    auto s1 = CHECK_NOTNULL(engine->snapshot());
+    auto s1_again = CHECK_NOTNULL(engine->snapshot());  // shares the generation of s1
+    write(*engine, FLAGS_test_nr);
+    auto kv2 = kv;
+    auto s2 = CHECK_NOTNULL(engine->snapshot());
+    write(*engine, FLAGS_test_nr);
+    check_all(*s1, kv1, used);
+    check_all(*s1_again, kv1, used);
+    check_all(*s2, kv2, used);
+    check_all(*engine, kv, used);
+
+    LOG(INFO) << "snapshots across a gc...";
+    CHECK_EQ(engine->garbage_collect(), kSucc);
+    engine->wait_gc();
+    write(*engine, FLAGS_test_nr);
+    CHECK_EQ(engine->garbage_collect(), kSucc);
+    engine->wait_gc();
+    check_all(*s1, kv1, used);
+    check_all(*s2, kv2, used);
+    check_all(*engine, kv, used);
+    size_t pinned_bytes = engine->space_usage().log_bytes;  // what the snapshots still read
+
+    LOG(INFO) << "dropping the snapshots...";
+    s1.reset();
+    s1_again.reset();
+    check_all(*s2, kv2, used);
+    s2.reset();
+    CHECK_EQ(engine->garbage_collect(), kSucc);
+    engine->wait_gc();
+    check_all(*engine, kv, used);
+    CHECK_LT(engine->space_usage().log_bytes, pinned_bytes);
+
+    LOG(INFO) << "a snapshot read while writes and a gc go on...";
+    {
+        auto kv3 = kv;
+        auto used3 = used;
+        auto s3 = CHECK_NOTNULL(engine->snapshot());
+        // the gc picks its victims first, then writes all along it pin some of them
+        CHECK_EQ(engine->garbage_collect(), kSucc);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::atomic<bool> gc_done(false), done(false);
+        std::thread gc([&] {
+            engine->wait_gc();
+            gc_done.store(true);
+        });
+        std::thread reader([&] {
+            while (!done.load())
+            {
+                check_all(*s3, kv3, used3);
+            }
+        });
+        do
+        {
+            write(*engine, 10);
+        } while (!gc_done.load());
+        gc.join();
+        done.store(true);
+        reader.join();
+        check_all(*s3, kv3, used3);
+    }
+    engine->wait_gc();
+    CHECK_EQ(segment_files(), manifest_segments());  // none kept for s3 any more
+
+    /*
+     * keys removed while a long visit goes on are freed before it ends:
+     * the visit does not keep its epoch from one batch of keys to the next
+     */
+    LOG(INFO) << "reclaiming during a visit...";
+    for (size_t i = 0; i < 2000; ++i)
+    {
+        CHECK_EQ(engine->put("~a" + key_of(i), "v"), kSucc);
+        CHECK_EQ(engine->put("~b" + key_of(i), "v"), kSucc);
+    }
+    EpochManager::global().reclaim();
+    size_t visited = 0, freed = 0;
+    CHECK_EQ(engine->visit_keys("~a", "~b", [&](const Key &) {
+        if (visited == 0)
+        {
+            for (size_t i = 0; i < 2000; ++i) CHECK_EQ(engine->remove("~b" + key_of(i)), kSucc);
+        }
+        if (++visited == 1500) freed = EpochManager::global().reclaim();
+    }), kSucc);
+    CHECK_EQ(visited, 2000u);
+    CHECK_GT(freed, 0u);
+    for (size_t i = 0; i < 2000; ++i) CHECK_EQ(engine->remove("~a" + key_of(i)), kSucc);
+    check_all(*engine, kv, used);
+
+    LOG(INFO) << "re-opening Engine...";
+    engine.reset();
+    engine = std::make_shared<Engine>(FLAGS_kvdir, small_segments(16 * 1024));
+    check_all(*engine, kv, used);
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <thread>
+
+#include "engine.h"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "util/bench.h"
+
+using namespace kvs;
+using namespace bench;
+
+DEFINE_uint64(test_nr, 200000, "The number of writes");
+DEFINE_string(kvdir, kDefaultTestDir, "The KV Store data directory");
+DEFINE_uint32(thread_nr, 4, "The number of reader threads");
+
+constexpr static size_t kKeys = 4;
+
+/*
+ * one writer puts 1, 2, 3... into a few hot keys, removing them now and
+ * then so that the gets miss the cache and fill it, while readers get
+ * them through the value cache: a get which starts after the put of n
+ * returned never sees a value older than n
+ */
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    EngineOptions options;
+    options.value_cache_bytes = 1024 * 1024;
+    auto engine = std::make_shared<Engine>(FLAGS_kvdir, options);
+
+    std::vector<Key> keys;
+    std::atomic<size_t> last_put[kKeys];
+    for (size_t k = 0; k < kKeys; ++k)
+    {
+        keys.push_back("hot" + std::to_string(k));
+        last_put[k].store(0);
+    }
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < FLAGS_thread_nr; ++t)
+    {
+        readers.emplace_back([&, t] {
+            std::vector<Value> values;
+            std::vector<RetCode> statuses;
+            for (size_t i = 0; !done.load(); ++i)
+            {
+                size_t k = i % kKeys;
+                size_t before = last_put[k].load();
+                if (t % 2 == 0)
+                {
+                    Value value;
+                    RetCode ret = engine->get(keys[k], value);
+                    if (ret == kNotFound) continue;
+                    CHECK_EQ(ret, kSucc);
+                    CHECK_GE(std::stoul(value), before) << "stale value of " << keys[k];
+                    continue;
+                }
+                CHECK_EQ(engine->multi_get({keys[k]}, values, statuses), kSucc);
+                if (statuses[0] == kNotFound) continue;
+                CHECK_GE(std::stoul(values[0]), before) << "stale value of " << keys[k];
+            }
+        });
+    }
+
+    for (size_t n = 1; n <= FLAGS_test_nr; ++n)
+    {
+        size_t k = n % kKeys;
+        if (n % 7 == 0)
+        {
+            CHECK_EQ(engine->remove(keys[k]), kSucc);
+            continue;
+        }
+        CHECK_EQ(engine->put(keys[k], std::to_string(n)), kSucc);
+        last_put[k].store(n);
+    }
+    done.store(true);
+    for (auto &t : readers)
+    {
+        t.join();
+    }
+    CHECK_GT(engine->cache_stats().hits, 0u);
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
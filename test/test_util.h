@@ -1,12 +1,15 @@
 #ifndef __ASM_H__
 #define __ASM_H__
 
+#include <cassert>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <string>
 
+#include "options.h"
+
 inline void color_print(const std::string &s)
 {
     printf("\033[1;32;40m%s\033[0m\n", s.c_str());
@@ -49,4 +52,20 @@ inline int rand_int(int lower, int upper)
     return rand() % (upper - lower + 1) + lower;
 }
 
+// the default options but for segment_size: many segments out of a few keys
+inline kvs::EngineOptions small_segments(size_t segment_size)
+{
+    kvs::EngineOptions options;
+    options.segment_size = segment_size;
+    return options;
+}
+
+// keys which sort as the numbers they are made of
+inline std::string key_of(size_t k)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "k%08zu", k);
+    return buf;
+}
+
 #endif /* __ASM_H__ */
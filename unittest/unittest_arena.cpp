@@ -0,0 +1,113 @@
+#include <iostream>
+#include <set>
+#include <thread>
+
+#include "arena.h"
+#include "util/utils.h"
+using namespace kvs;
+
+void test_slab()
+{
+    Slab slab(1600, false);  // about a fan-out 64 leaf
+    std::set<void *> live;
+    std::vector<void *> blocks;
+    for (size_t i = 0; i < 5000; ++i)  // a few chunks
+    {
+        void *p = slab.allocate();
+        CHECK_EQ((uintptr_t)p % 64, 0u);
+        CHECK(live.insert(p).second);
+        memset(p, 0xab, slab.block_size());
+        blocks.push_back(p);
+    }
+    CHECK_GT(slab.bytes(), Slab::kChunkSize);
+    size_t bytes = slab.bytes();
+
+    // released blocks come back, no new chunk needed
+    for (size_t i = 0; i < blocks.size(); i += 2)
+    {
+        Slab::release(blocks[i]);
+        live.erase(blocks[i]);
+    }
+    for (size_t i = 0; i < blocks.size(); i += 2)
+    {
+        CHECK(live.insert(slab.allocate()).second);
+    }
+    CHECK_EQ(slab.bytes(), bytes);
+}
+
+void test_release_from_other_threads()
+{
+    Slab slab(48, false);
+    constexpr size_t kThreads = 4, kBlocks = 20000;
+    std::vector<std::vector<void *>> blocks(kThreads);
+    for (size_t t = 0; t < kThreads; ++t)
+    {
+        for (size_t i = 0; i < kBlocks; ++i)
+        {
+            blocks[t].push_back(slab.allocate());
+        }
+    }
+    size_t bytes = slab.bytes();
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&, t] {
+            for (void *p : blocks[t])
+            {
+                Slab::release(p);
+            }
+        });
+    }
+    // the allocator goes on meanwhile
+    std::vector<void *> more;
+    for (size_t i = 0; i < kThreads * kBlocks; ++i)
+    {
+        more.push_back(slab.allocate());
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    std::set<void *> distinct(more.begin(), more.end());
+    CHECK_EQ(distinct.size(), more.size());
+    CHECK_LE(slab.bytes(), 2 * bytes);
+}
+
+void test_keys()
+{
+    KeyArena arena(false);
+    std::vector<const ArenaKey *> keys;
+    std::vector<std::string> expected;
+    for (size_t len = 0; len <= 1000; ++len)
+    {
+        expected.push_back(bench::gen_rand_value(len));
+        keys.push_back(arena.make(expected.back()));
+        CHECK_EQ((uintptr_t)keys.back() % alignof(ArenaKey), 0u);
+    }
+    size_t long_keys = 1000 - KeyArena::kMaxSlabKey;
+    CHECK_GT(arena.bytes(), long_keys * (KeyArena::kMaxSlabKey + 1));
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        CHECK(keys[i]->view() == expected[i]);
+        KeyArena::release(keys[i]);
+    }
+    // long keys are given back to malloc, slab chunks stay
+    CHECK_LE(arena.bytes(), (KeyArena::kMaxSlabKey + sizeof(ArenaKey)) / KeyArena::kClassStep * Slab::kChunkSize);
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    test_slab();
+    test_release_from_other_threads();
+    test_keys();
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+
+#include "btree.h"
+#include "util/utils.h"
+using namespace kvs;
+
+std::string key_of(size_t k)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "k%08zu", k);
+    return buf;
+}
+
+template <size_t Fanout>
+void check_same(const BTree<Fanout> &tree, const std::map<std::string, size_t> &expected)
+{
+    CHECK(tree.check());
+    CHECK_EQ(tree.size(), expected.size());
+    auto it = expected.begin();
+    tree.scan("", false, [&](std::string_view key, size_t data) {
+        CHECK(it != expected.end());
+        CHECK_EQ(key, it->first);
+        CHECK_EQ(data, it->second);
+        ++it;
+        return true;
+    });
+    CHECK(it == expected.end());
+
+    auto rit = expected.rbegin();
+    tree.scan_reverse("", false, [&](std::string_view key, size_t data) {
+        CHECK(rit != expected.rend());
+        CHECK_EQ(key, rit->first);
+        CHECK_EQ(data, rit->second);
+        ++rit;
+        return true;
+    });
+    CHECK(rit == expected.rend());
+
+    // each key and one missing after it, in order
+    std::vector<std::string> keys;
+    for (auto &[key, data] : expected)
+    {
+        keys.push_back(key);
+        keys.push_back(key + "x");
+    }
+    std::vector<std::string_view> views(keys.begin(), keys.end());
+    std::vector<size_t> found(keys.size());
+    tree.search_sorted(views.data(), views.size(), found.data());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        CHECK_EQ(found[i], i % 2 ? BTree<Fanout>::kNotFound : expected.at(keys[i]));
+    }
+}
+
+template <size_t Fanout>
+void test_against_map()
+{
+    BTree<Fanout> tree;
+    std::map<std::string, size_t> expected;
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < 200000; ++i)
+    {
+        size_t k = rng() % 5000;
+        std::string key = key_of(k);
+        auto found = expected.find(key);
+        size_t old = BTree<Fanout>::kNotFound;
+        if (rng() % 3 == 0)
+        {
+            CHECK_EQ(tree.remove(key, &old), found != expected.end() ? 1 : 0);
+            if (found != expected.end()) CHECK_EQ(old, found->second);
+            expected.erase(key);
+        }
+        else
+        {
+            CHECK_EQ(tree.insert(key, i, &old), found != expected.end() ? 0 : 1);
+            if (found != expected.end()) CHECK_EQ(old, found->second);
+            expected[key] = i;
+        }
+        size_t probe = rng() % 5000;
+        auto it = expected.find(key_of(probe));
+        CHECK_EQ(tree.search(key_of(probe)), it == expected.end() ? BTree<Fanout>::kNotFound : it->second);
+        if (i % 20000 == 0)
+        {
+            check_same(tree, expected);
+        }
+    }
+    check_same(tree, expected);
+
+    // scan from the middle, inclusive or not, and stop early
+    std::string from = key_of(2500);
+    tree.insert(from, 1);
+    expected[from] = 1;
+    for (bool exclusive : {false, true})
+    {
+        auto it = exclusive ? expected.upper_bound(from) : expected.lower_bound(from);
+        size_t seen = 0;
+        tree.scan(from, exclusive, [&](std::string_view key, size_t) {
+            CHECK_EQ(key, it->first);
+            ++it;
+            return ++seen < 10;
+        });
+        CHECK_EQ(seen, 10u);
+
+        auto rit = std::make_reverse_iterator(exclusive ? expected.lower_bound(from) : expected.upper_bound(from));
+        seen = 0;
+        tree.scan_reverse(from, exclusive, [&](std::string_view key, size_t) {
+            CHECK_EQ(key, rit->first);
+            ++rit;
+            return ++seen < 10;
+        });
+        CHECK_EQ(seen, 10u);
+    }
+
+    // replace only what is still expected
+    CHECK(!tree.replace(from, 2, 3));
+    CHECK(tree.replace(from, 1, 3));
+    CHECK(!tree.replace(key_of(99999), BTree<Fanout>::kNotFound, 3));
+    expected[from] = 3;
+    check_same(tree, expected);
+
+    // empty it, down to a single leaf
+    for (auto &kv : expected)
+    {
+        CHECK_EQ(tree.remove(kv.first), 1);
+    }
+    expected.clear();
+    check_same(tree, expected);
+}
+
+// every size around the node boundaries, then writes into the loaded tree
+template <size_t Fanout>
+void test_bulk_load()
+{
+    constexpr size_t kMax = BTree<Fanout>::kMaxKeys;
+    for (size_t n : {(size_t)0, (size_t)1, kMax - 1, kMax, kMax + 1, 2 * kMax + 1, kMax * Fanout,
+                     kMax * Fanout + 1, (size_t)12345})
+    {
+        std::vector<std::pair<std::string, size_t>> entries;
+        std::map<std::string, size_t> expected;
+        for (size_t k = 0; k < n; ++k)
+        {
+            entries.emplace_back(key_of(2 * k), k);
+            expected[key_of(2 * k)] = k;
+        }
+        BTree<Fanout> tree;
+        tree.bulk_load(entries);
+        check_same(tree, expected);
+
+        std::mt19937 rng(n);
+        for (size_t i = 0; i < 2 * n; ++i)
+        {
+            std::string key = key_of(rng() % (2 * n + 2));
+            if (rng() % 2)
+            {
+                CHECK_EQ(tree.remove(key), (int)expected.erase(key));
+            }
+            else
+            {
+                CHECK_EQ(tree.insert(key, i), expected.count(key) ? 0 : 1);
+                expected[key] = i;
+            }
+        }
+        check_same(tree, expected);
+    }
+}
+
+/*
+ * split_keys() cuts a range into runs of about the same length: the runs
+ * between the keys it picks are within a few subtrees of the average
+ */
+template <size_t Fanout>
+void test_split_keys()
+{
+    constexpr size_t kKeys = 100000;
+    BTree<Fanout> tree;
+    std::mt19937 rng(Fanout);
+    std::vector<size_t> order(kKeys);
+    for (size_t k = 0; k < kKeys; ++k) order[k] = k;
+    std::shuffle(order.begin(), order.end(), rng);
+    for (size_t k : order) CHECK_EQ(tree.insert(key_of(k), k), 1);
+
+    for (auto [lower, upper] : {std::pair<size_t, size_t>{0, kKeys}, {kKeys / 3, kKeys / 2}, {1000, 1100}})
+    {
+        std::string lo = lower == 0 ? "" : key_of(lower), hi = upper == kKeys ? "" : key_of(upper);
+        for (size_t n : {1, 2, 7, 32})
+        {
+            std::vector<std::string> cuts = tree.split_keys(lo, hi, n);
+            CHECK_LE(cuts.size() + 1, n);
+            CHECK(std::is_sorted(cuts.begin(), cuts.end()));
+            CHECK(std::adjacent_find(cuts.begin(), cuts.end()) == cuts.end());
+            for (auto &c : cuts)
+            {
+                CHECK_GT(c, lo);
+                CHECK(hi.empty() || c < hi);
+            }
+            size_t len = upper - lower;
+            if (len >= 64 * n * Fanout)
+            {
+                CHECK_EQ(cuts.size() + 1, n) << "range [" << lower << ", " << upper << ")";
+            }
+            // no run is much over the average, give or take a subtree of the level cut
+            size_t prev = lower;
+            for (size_t i = 0; i <= cuts.size(); ++i)
+            {
+                size_t end = i < cuts.size() ? std::stoul(cuts[i].substr(1)) : upper;
+                size_t run = end - prev, avg = len / (cuts.size() + 1);
+                CHECK_LE(run, 2 * avg + Fanout) << "run " << i << " of " << cuts.size() + 1;
+                prev = end;
+            }
+        }
+    }
+}
+
+/*
+ * one writer churns the odd keys while readers look for the even ones,
+ * which never change: a reader must always find them, and a scan must
+ * return them all, in order
+ */
+template <size_t Fanout>
+void test_concurrent_readers()
+{
+    constexpr size_t kKeys = 20000;
+    constexpr size_t kReaders = 4;
+    BTree<Fanout> tree;
+    for (size_t k = 0; k < kKeys; k += 2)
+    {
+        tree.insert(key_of(k), k);
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<size_t> reads(0);
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < kReaders; ++t)
+    {
+        readers.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            while (!done.load())
+            {
+                size_t k = rng() % kKeys & ~(size_t)1;
+                CHECK_EQ(tree.search(key_of(k)), k);
+
+                // the next 64 entries from k: even keys in a row, odd ones maybe
+                size_t next_even = k;
+                std::string last;
+                size_t seen = 0;
+                tree.scan(key_of(k), false, [&](std::string_view key, size_t data) {
+                    CHECK_GT(key, last);
+                    last = key;
+                    if (data % 2 == 0)
+                    {
+                        CHECK_EQ(key, key_of(next_even));
+                        CHECK_EQ(data, next_even);
+                        next_even += 2;
+                    }
+                    return ++seen < 64;
+                });
+                CHECK(seen == 64 || next_even >= kKeys);
+
+                // and the 64 before it, down
+                size_t prev_even = k;
+                seen = 0;
+                tree.scan_reverse(key_of(k), false, [&](std::string_view key, size_t data) {
+                    CHECK(seen == 0 || key < last);
+                    last = key;
+                    if (data % 2 == 0)
+                    {
+                        CHECK_EQ(key, key_of(prev_even));
+                        prev_even -= 2;
+                    }
+                    return ++seen < 64;
+                });
+                CHECK(seen == 64 || prev_even + 2 == 0);
+
+                // a batch of even keys from k on, found in one pass
+                std::vector<std::string> batch;
+                for (size_t j = k; j < kKeys && batch.size() < 64; j += 2 + rng() % 8 * 2)
+                {
+                    batch.push_back(key_of(j));
+                }
+                std::vector<std::string_view> views(batch.begin(), batch.end());
+                std::vector<size_t> found(batch.size());
+                tree.search_sorted(views.data(), views.size(), found.data());
+                for (size_t j = 0; j < batch.size(); ++j)
+                {
+                    CHECK_EQ(key_of(found[j]), batch[j]);
+                }
+                reads++;
+            }
+        });
+    }
+
+    std::mt19937 rng(1234);
+    for (size_t i = 0; i < 300000; ++i)
+    {
+        size_t k = rng() % kKeys | 1;
+        if (rng() % 2)
+        {
+            tree.insert(key_of(k), k);
+        }
+        else
+        {
+            tree.remove(key_of(k));
+        }
+    }
+    done.store(true);
+    for (auto &r : readers)
+    {
+        r.join();
+    }
+    CHECK(tree.check());
+    LOG(INFO) << "fan-out " << Fanout << ", reads alongside the writer: " << reads.load();
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    // a small fan-out splits and merges a lot, a big one has deep binary searches
+    test_against_map<5>();
+    test_against_map<16>();
+    test_against_map<256>();
+    test_bulk_load<5>();
+    test_bulk_load<64>();
+    test_split_keys<5>();
+    test_split_keys<64>();
+    test_concurrent_readers<5>();
+    test_concurrent_readers<64>();
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <iostream>
+
+#include "crc32c.h"
+#include "util/utils.h"
+using namespace kvs;
+
+constexpr static size_t kTestTime = 10000;
+constexpr static size_t kMaxLen = 64 * 1024;
+
+void test_standard_vectors()
+{
+    // RFC 3720, B.4
+    char buf[32];
+    memset(buf, 0, sizeof(buf));
+    CHECK_EQ(crc32c::value(buf, sizeof(buf)), 0x8a9136aaU);
+
+    memset(buf, 0xff, sizeof(buf));
+    CHECK_EQ(crc32c::value(buf, sizeof(buf)), 0x62a8ab43U);
+
+    for (int i = 0; i < 32; i++)
+    {
+        buf[i] = i;
+    }
+    CHECK_EQ(crc32c::value(buf, sizeof(buf)), 0x46dd794eU);
+
+    for (int i = 0; i < 32; i++)
+    {
+        buf[i] = 31 - i;
+    }
+    CHECK_EQ(crc32c::value(buf, sizeof(buf)), 0x113fdb5cU);
+
+    CHECK_EQ(crc32c::value("123456789", 9), 0xe3069283U);
+}
+
+void test_implementations_agree()
+{
+    LOG(INFO) << "sse4.2: " << crc32c::has_sse42()
+              << ", pclmul: " << crc32c::has_pclmul();
+
+    auto data = bench::gen_rand_value(kMaxLen);
+    for (size_t i = 0; i < kTestTime; ++i)
+    {
+        // every length around the stripe boundaries, then random ones
+        size_t len = i < 4096 ? i : bench::fast_pseudo_rand_int(kMaxLen - 8);
+        size_t off = bench::fast_pseudo_rand_int(7);
+        uint32_t init = bench::fast_pseudo_rand_int(0xffffffff);
+
+        auto expect = crc32c::extend_portable(init, data.data() + off, len);
+        CHECK_EQ(crc32c::extend(init, data.data() + off, len), expect);
+        if (crc32c::has_sse42())
+        {
+            CHECK_EQ(crc32c::extend_sse42(init, data.data() + off, len),
+                     expect);
+        }
+        if (crc32c::has_pclmul())
+        {
+            CHECK_EQ(
+                crc32c::extend_sse42_pclmul(init, data.data() + off, len),
+                expect)
+                << "len " << len;
+        }
+    }
+}
+
+void test_extend()
+{
+    auto data = bench::gen_rand_value(kMaxLen);
+    for (size_t i = 0; i < kTestTime; ++i)
+    {
+        size_t len = bench::fast_pseudo_rand_int(kMaxLen);
+        size_t split = bench::fast_pseudo_rand_int(len);
+        auto whole = crc32c::value(data.data(), len);
+        auto head = crc32c::value(data.data(), split);
+        CHECK_EQ(crc32c::extend(head, data.data() + split, len - split),
+                 whole);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    test_standard_vectors();
+    test_implementations_agree();
+    test_extend();
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+#include "key_prefix.h"
+#include "util/utils.h"
+using namespace kvs;
+
+std::string random_key(std::mt19937 &rng)
+{
+    // short keys, and few distinct bytes: plenty of shared prefixes and zeros
+    std::string key(rng() % 12, '\0');
+    for (auto &c : key)
+    {
+        c = "\0\1ab\xff"[rng() % 5];
+    }
+    return key;
+}
+
+void test_order()
+{
+    std::mt19937 rng(7);
+    for (size_t i = 0; i < 100000; ++i)
+    {
+        std::string a = random_key(rng), b = random_key(rng);
+        int64_t pa = key_prefix(a), pb = key_prefix(b);
+        if (pa != pb)
+        {
+            // different prefixes decide like the keys would
+            CHECK_EQ(pa < pb, a < b) << i;
+        }
+        else
+        {
+            // equal ones only when the first 8 bytes agree, up to zero padding
+            std::string a8 = a.substr(0, 8), b8 = b.substr(0, 8);
+            a8.resize(8, '\0');
+            b8.resize(8, '\0');
+            CHECK_EQ(a8, b8);
+        }
+    }
+}
+
+void test_count()
+{
+    std::mt19937 rng(11);
+    for (size_t n = 0; n <= 70; ++n)
+    {
+        std::vector<int64_t> a(n);
+        for (auto &x : a)
+        {
+            x = (int64_t)(rng() % 8) - 4;
+        }
+        std::sort(a.begin(), a.end());
+        for (int64_t p = -5; p <= 5; ++p)
+        {
+            size_t lt = std::lower_bound(a.begin(), a.end(), p) - a.begin();
+            size_t le = std::upper_bound(a.begin(), a.end(), p) - a.begin();
+            size_t less, less_equal;
+            prefix::count_portable(a.data(), n, p, less, less_equal);
+            CHECK_EQ(less, lt);
+            CHECK_EQ(less_equal, le);
+            if (prefix::has_sse42())
+            {
+                prefix::count_sse42(a.data(), n, p, less, less_equal);
+                CHECK_EQ(less, lt);
+                CHECK_EQ(less_equal, le);
+            }
+            if (prefix::has_avx2())
+            {
+                prefix::count_avx2(a.data(), n, p, less, less_equal);
+                CHECK_EQ(less, lt);
+                CHECK_EQ(less_equal, le);
+            }
+            prefix::count(a.data(), n, p, less, less_equal);
+            CHECK_EQ(less, lt);
+            CHECK_EQ(less_equal, le);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    LOG(INFO) << "sse4.2: " << prefix::has_sse42()
+              << ", avx2: " << prefix::has_avx2();
+    test_order();
+    test_count();
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}
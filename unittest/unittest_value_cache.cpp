@@ -0,0 +1,126 @@
+#include <iostream>
+
+#include "util/utils.h"
+#include "value_cache.h"
+using namespace kvs;
+
+constexpr static size_t kCapacity = 1024 * 1024;
+constexpr static size_t kValueSize = 1000;
+
+// the key was not written since the value was read
+bool unchanged()
+{
+    return true;
+}
+
+std::string key_of(size_t k)
+{
+    return "key-" + std::to_string(k);
+}
+
+void test_lookup_update_erase()
+{
+    ValueCache cache(kCapacity, kValueSize);
+    std::string value;
+    CHECK(!cache.lookup("a", value));
+    cache.insert("a", "1", unchanged);
+    CHECK(cache.lookup("a", value));
+    CHECK_EQ(value, "1");
+
+    cache.update("a", "2");
+    CHECK(cache.lookup("a", value));
+    CHECK_EQ(value, "2");
+
+    // update does not add a key which is not cached
+    cache.update("b", "3");
+    CHECK(!cache.lookup("b", value));
+
+    cache.erase("a");
+    CHECK(!cache.lookup("a", value));
+
+    // too big values bypass the cache, and an update to one drops the key
+    cache.insert("c", std::string(kValueSize + 1, 'c'), unchanged);
+    CHECK(!cache.lookup("c", value));
+    cache.insert("d", "4", unchanged);
+    cache.update("d", std::string(kValueSize + 1, 'd'));
+    CHECK(!cache.lookup("d", value));
+
+    // a value which lost to a write is refused
+    cache.insert("e", "5", [] { return false; });
+    CHECK(!cache.lookup("e", value));
+
+    auto stats = cache.stats();
+    CHECK_EQ(stats.hits, 2u);
+    CHECK_EQ(stats.misses, 6u);
+    CHECK_EQ(stats.entries, 0u);
+}
+
+void test_capacity()
+{
+    ValueCache cache(kCapacity, kValueSize);
+    std::string value(kValueSize, 'v');
+    std::string got;
+    for (size_t k = 0; k < 100 * kCapacity / kValueSize; ++k)
+    {
+        // ask twice, so the newcomer wins over the old ones
+        cache.lookup(key_of(k), got);
+        cache.lookup(key_of(k), got);
+        cache.insert(key_of(k), value, unchanged);
+        CHECK_LE(cache.stats().bytes, kCapacity);
+    }
+    CHECK_GT(cache.stats().entries, 0u);
+}
+
+void test_scan_resistance()
+{
+    ValueCache cache(kCapacity, kValueSize);
+    std::string value(kValueSize, 'v');
+    std::string got;
+
+    // a hot set of half the capacity, read over and over
+    size_t hot_nr = kCapacity / 2 / (kValueSize + 64);
+    for (size_t round = 0; round < 8; ++round)
+    {
+        for (size_t k = 0; k < hot_nr; ++k)
+        {
+            if (!cache.lookup(key_of(k), got))
+            {
+                cache.insert(key_of(k), value, unchanged);
+            }
+        }
+    }
+
+    // then a scan over many more keys, each read once
+    for (size_t k = hot_nr; k < hot_nr + 10 * kCapacity / kValueSize; ++k)
+    {
+        if (!cache.lookup(key_of(k), got))
+        {
+            cache.insert(key_of(k), value, unchanged);
+        }
+    }
+
+    size_t hit = 0;
+    for (size_t k = 0; k < hot_nr; ++k)
+    {
+        hit += cache.lookup(key_of(k), got);
+    }
+    LOG(INFO) << "hot keys still cached after the scan: " << hit << "/"
+              << hot_nr << ", rejected: " << cache.stats().rejected;
+    CHECK_GE(hit, hot_nr * 9 / 10);
+}
+
+int main(int argc, char *argv[])
+{
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = true;
+
+    test_lookup_update_erase();
+    test_capacity();
+    test_scan_resistance();
+
+    LOG(INFO) << "PASS " << argv[0];
+
+    return 0;
+}